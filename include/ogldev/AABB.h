@@ -1,11 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdio>
 #include <float.h>
 #include <limits.h>
 #include <math.h>
 
 #include <ogldev/vec3f.h>
+#include <ogldev/vec4f.h>
 
 // struct PersProjInfo
 // {
@@ -45,21 +47,83 @@ public:
 	void
 	Add(const Vector3f& v)
 	{
-		MinX = fmin(MinX, v.x);
-		MinY = fmin(MinY, v.y);
-		MinZ = fmin(MinZ, v.z);
+		MinX = std::min(MinX, v.x);
+		MinY = std::min(MinY, v.y);
+		MinZ = std::min(MinZ, v.z);
 
-		MaxX = fmax(MaxX, v.x);
-		MaxY = fmax(MaxY, v.y);
-		MaxZ = fmax(MaxZ, v.z);
+		MaxX = std::max(MaxX, v.x);
+		MaxY = std::max(MaxY, v.y);
+		MaxZ = std::max(MaxZ, v.z);
 	}
 
+	void
+	Add(const Vector4f& v)
+	{
+		Add(v.to3f());
+	}
+
+	void
+	Add(const AABB& aabb)
+	{
+		MinX = std::min(MinX, aabb.MinX);
+		MinY = std::min(MinY, aabb.MinY);
+		MinZ = std::min(MinZ, aabb.MinZ);
+
+		MaxX = std::max(MaxX, aabb.MaxX);
+		MaxY = std::max(MaxY, aabb.MaxY);
+		MaxZ = std::max(MaxZ, aabb.MaxZ);
+	}
+
+	// False until the first point is added
+	bool
+	IsValid() const
+	{
+		return (MinX <= MaxX) && (MinY <= MaxY) && (MinZ <= MaxZ);
+	}
+
+	Vector3f
+	GetCenter() const
+	{
+		return Vector3f((MinX + MaxX) * 0.5f, (MinY + MaxY) * 0.5f, (MinZ + MaxZ) * 0.5f);
+	}
+
+	// Half the size along every axis
+	Vector3f
+	GetExtents() const
+	{
+		return Vector3f((MaxX - MinX) * 0.5f, (MaxY - MinY) * 0.5f, (MaxZ - MinZ) * 0.5f);
+	}
+
+	float
+	GetSurfaceArea() const
+	{
+		float dx = MaxX - MinX;
+		float dy = MaxY - MinY;
+		float dz = MaxZ - MinZ;
+
+		return 2.0f * (dx * dy + dy * dz + dz * dx);
+	}
+
+	bool
+	Intersects(const AABB& aabb) const
+	{
+		return (MinX <= aabb.MaxX) && (MaxX >= aabb.MinX) && (MinY <= aabb.MaxY) && (MaxY >= aabb.MinY) &&
+			   (MinZ <= aabb.MaxZ) && (MaxZ >= aabb.MinZ);
+	}
+
+	bool
+	Contains(const Vector3f& p) const
+	{
+		return (p.x >= MinX) && (p.x <= MaxX) && (p.y >= MinY) && (p.y <= MaxY) && (p.z >= MinZ) && (p.z <= MaxZ);
+	}
+
+	// The member order is relied upon by the SIMD batch tests in frustum.h
 	float MinX = FLT_MAX;
-	float MaxX = FLT_MIN;
+	float MaxX = -FLT_MAX;
 	float MinY = FLT_MAX;
-	float MaxY = FLT_MIN;
+	float MaxY = -FLT_MAX;
 	float MinZ = FLT_MAX;
-	float MaxZ = FLT_MIN;
+	float MaxZ = -FLT_MAX;
 
 	void
 	Print()
@@ -79,4 +143,10 @@ public:
 		o.n = MinZ;
 		o.f = MaxZ;
 	}
-};
\ No newline at end of file
+};
+
+struct BoundingSphere
+{
+	Vector3f Center = Vector3f(0.0f, 0.0f, 0.0f);
+	float Radius = 0.0f;
+};
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <climits>
 #include <glad/glad.h>
 #include <map>
+#include <stddef.h>
+#include <type_traits>
 #include <vector>
 
 #include <assimp/Importer.hpp>	// C++ importer interface
@@ -9,12 +13,19 @@
 #include <assimp/scene.h>		// Output data structure
 
 #include <meshoptimizer.h>
+#include <ogldev/AABB.h>
+#include <ogldev/bvh.h>
 #include <ogldev/engine_common.h>
+#include <ogldev/frustum.h>
 #include <ogldev/material.h>
+#include <ogldev/mesh_cache.h>
 #include <ogldev/mesh_common.h>
+#include <ogldev/ray.h>
 #include <ogldev/texture.h>
+#include <ogldev/thread_pool.h>
 #include <ogldev/utility.h>
 #include <ogldev/vec2f.h>
+#include <ogldev/vertex_packing.h>
 #include <ogldev/world_transform.h>
 
 using namespace std;
@@ -22,10 +33,256 @@ using namespace std;
 #define POSITION_LOCATION 0
 #define TEX_COORD_LOCATION 1
 #define NORMAL_LOCATION 2
+#define INSTANCE_WVP_LOCATION 3	  // mat4, uses locations 3-6
+#define INSTANCE_WORLD_LOCATION 7 // mat4, uses locations 7-10
 
 #define INVALID_MATERIAL 0xFFFFFFFF
 
-// #define USE_MESH_OPTIMIZER
+// Meshlet size, see MeshLoadOptions::BuildMeshlets
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_CONE_WEIGHT 0.25f // how much meshopt_buildMeshlets() favors tight normal cones over tight spheres
+
+// Bytes of a GPU buffer copied by one BasicMesh::UploadNextPart()
+#define MESH_UPLOAD_CHUNK_SIZE (4 * 1024 * 1024)
+
+// Closest triangle hit by a ray, see BasicMesh::RayCast()
+struct MeshRayHit
+{
+	uint DrawIndex = 0; // submesh
+	uint PrimID = 0;	// triangle inside the submesh, same as gl_PrimitiveID
+	float t = FLT_MAX;	// hit point is Ray.GetPoint(t)
+	float u = 0.0f;		// barycentrics: p = (1 - u - v) * v0 + u * v1 + v * v2
+	float v = 0.0f;
+};
+
+// A triangle of the mesh, as identified by the picking pass
+struct MeshTriangleID
+{
+	uint DrawIndex; // submesh
+	uint PrimID;	// triangle inside the submesh, same as gl_PrimitiveID
+};
+
+//
+// A set of highlighted triangles of one BasicMesh instance (e.g. the selection).
+// The triangles are kept in a dynamic index buffer with a range per submesh so
+// BasicMesh::RenderHighlight() draws them with one call per submesh. Add() and
+// Remove() are O(1) and only mark the changed part of the submesh range, which
+// is uploaded on the next render. A range is regrown (and the whole buffer
+// uploaded) only when a submesh outgrows its capacity.
+//
+class TriangleHighlight
+{
+public:
+	TriangleHighlight() {}
+
+	TriangleHighlight(const TriangleHighlight&) = delete;
+
+	TriangleHighlight&
+	operator=(const TriangleHighlight&) = delete;
+
+	~TriangleHighlight()
+	{
+		if (m_buffer != 0)
+		{
+			glDeleteBuffers(1, &m_buffer);
+		}
+	}
+
+	// Returns false if the triangle was already highlighted
+	bool
+	Add(uint DrawIndex, uint PrimID)
+	{
+		assert(DrawIndex < m_subMeshes.size());
+		SubMesh& Sub = m_subMeshes[DrawIndex];
+		assert(PrimID < Sub.NumTriangles);
+
+		if (Sub.Slots.empty())
+		{
+			Sub.Slots.resize(Sub.NumTriangles, 0);
+		}
+		else if (Sub.Slots[PrimID] != 0)
+		{
+			return false;
+		}
+
+		Sub.Prims.push_back(PrimID);
+		Sub.Slots[PrimID] = (uint)Sub.Prims.size();
+		MarkDirty(Sub, (uint)Sub.Prims.size() - 1);
+
+		if (Sub.Prims.size() > Sub.Capacity)
+		{
+			m_isLayoutDirty = true;
+		}
+
+		m_numTriangles++;
+
+		return true;
+	}
+
+	// Returns false if the triangle wasn't highlighted
+	bool
+	Remove(uint DrawIndex, uint PrimID)
+	{
+		assert(DrawIndex < m_subMeshes.size());
+		SubMesh& Sub = m_subMeshes[DrawIndex];
+
+		if (Sub.Slots.empty() || (Sub.Slots[PrimID] == 0))
+		{
+			return false;
+		}
+
+		// Move the last triangle into the hole
+		uint Slot = Sub.Slots[PrimID] - 1;
+		uint Last = Sub.Prims.back();
+		Sub.Prims[Slot] = Last;
+		Sub.Slots[Last] = Slot + 1;
+		Sub.Slots[PrimID] = 0;
+		Sub.Prims.pop_back();
+
+		if (Slot < Sub.Prims.size())
+		{
+			MarkDirty(Sub, Slot);
+		}
+
+		m_numTriangles--;
+
+		return true;
+	}
+
+	bool
+	IsHighlighted(uint DrawIndex, uint PrimID) const
+	{
+		assert(DrawIndex < m_subMeshes.size());
+		const SubMesh& Sub = m_subMeshes[DrawIndex];
+		return !Sub.Slots.empty() && (Sub.Slots[PrimID] != 0);
+	}
+
+	void
+	Clear()
+	{
+		for (SubMesh& Sub : m_subMeshes)
+		{
+			for (uint PrimID : Sub.Prims)
+			{
+				Sub.Slots[PrimID] = 0;
+			}
+
+			Sub.Prims.clear();
+			Sub.DirtyBegin = UINT_MAX;
+			Sub.DirtyEnd = 0;
+		}
+
+		m_numTriangles = 0;
+	}
+
+	uint
+	GetNumTriangles() const
+	{
+		return m_numTriangles;
+	}
+
+private:
+	friend class BasicMesh;
+
+	struct SubMesh
+	{
+		uint NumTriangles = 0;	   // in the submesh
+		std::vector<uint> Prims;   // the highlighted ones, in buffer order
+		std::vector<uint> Slots;   // index into Prims + 1 per triangle, 0 if not highlighted (allocated on first use)
+		uint Offset = 0;		   // first triangle of the range in the buffer
+		uint Capacity = 0;		   // triangles
+		uint DirtyBegin = UINT_MAX; // part of Prims that must be uploaded
+		uint DirtyEnd = 0;
+	};
+
+	void
+	MarkDirty(SubMesh& Sub, uint Slot)
+	{
+		Sub.DirtyBegin = std::min(Sub.DirtyBegin, Slot);
+		Sub.DirtyEnd = std::max(Sub.DirtyEnd, Slot + 1);
+	}
+
+	std::vector<SubMesh> m_subMeshes;
+	uint m_numTriangles = 0;
+	bool m_isLayoutDirty = true;
+	GLuint m_buffer = 0;
+	std::vector<uint> m_uploadIndices; // scratch space
+};
+
+//
+// How BasicMesh::LoadMesh() imports a model. The default is a plain import
+// without any of the meshoptimizer stages.
+//
+struct MeshLoadOptions
+{
+	ogl::ThreadPool* pThreadPool = NULL; // imports the submeshes in parallel
+	bool UseCache = true;				 // see BasicMesh::LoadMesh()
+
+	// meshoptimizer stages, in the order they run on every submesh
+	bool RemoveDuplicateVertices = false;
+	bool OptimizeVertexCache = false;
+	bool OptimizeOverdraw = false;
+	float OverdrawThreshold = 1.05f; // how much worse the vertex cache may get to reduce overdraw
+	bool OptimizeVertexFetch = false;
+
+	// 16 instead of 32 bytes per vertex in the GPU buffer, see BasicMesh::PackedVertex
+	bool PackVertices = false;
+
+	// 16 bit indices in the GPU buffer for the submeshes whose indices fit
+	bool UseShortIndices = true;
+
+	//
+	// Simplified versions of every submesh, see BasicMesh::RenderLOD(). Every
+	// entry adds a LOD after the full detail one and is its target error relative
+	// to the size of the submesh (e.g. 0.01 is 1%), so they should be increasing.
+	// A LOD that doesn't remove any triangles is skipped.
+	//
+	std::vector<float> LODErrors;
+
+	// Splits the full detail version of every submesh into meshlets for BasicMesh::RenderMeshlets()
+	bool BuildMeshlets = false;
+
+	bool
+	IsOptimizerEnabled() const
+	{
+		return RemoveDuplicateVertices || OptimizeVertexCache || OptimizeOverdraw || OptimizeVertexFetch ||
+			   !LODErrors.empty() || BuildMeshlets;
+	}
+};
+
+// A range of the index buffer that draws a submesh at some level of detail
+struct MeshLOD
+{
+	uint BaseIndex;
+	uint NumIndices;
+	float Error; // in local space, how far the surface may be from the full detail one
+};
+
+//
+// A cluster of up to MESHLET_MAX_TRIANGLES neighbouring triangles of a submesh
+// with its bounding sphere and the cone that contains all its normals. The
+// triangles are a range of the full detail indices.
+//
+struct Meshlet
+{
+	uint BaseIndex;
+	uint NumIndices;
+	Vector3f Center;
+	float Radius;
+	Vector3f ConeAxis;
+	float ConeCutoff; // cos of the cone half angle, 1 if the normals are too spread out for cone culling
+};
+
+// Accumulated by BasicMesh::RenderMeshlets() until BasicMesh::ResetMeshletStats()
+struct MeshletStats
+{
+	uint NumMeshlets = 0;		 // tested
+	uint NumFrustumCulled = 0; // outside the frustum
+	uint NumConeCulled = 0;	 // all triangles facing away from the camera
+	uint NumTriangles = 0;	 // drawn
+	uint NumDraws = 0;		 // ranges of consecutive visible meshlets
+};
 
 class BasicMesh : public MeshCommon
 {
@@ -38,6 +295,32 @@ private:
 		Vector3f Normal;
 	};
 
+	//
+	// The GPU copy of a Vertex when MeshLoadOptions::PackVertices is set. All the
+	// formats are decoded by the vertex fetch so the shaders don't change. Half
+	// float positions keep 11 significant bits, i.e. the error is at most 1/2048
+	// of the coordinate (0.03 for a coordinate of 100). The normal components are
+	// within 1/1022 and the tex coords within 1/2048 of their value. The CPU keeps
+	// the full precision vertices for ray casts and the mesh cache.
+	//
+	struct PackedVertex
+	{
+		u16 Position[4];  // half floats, the last one is padding
+		u16 TexCoords[2]; // half floats
+		u32 Normal;		  // snorm 10:10:10:2
+	};
+
+	static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay 16 bytes");
+
+	struct VertexAttribute
+	{
+		GLuint Location;
+		GLint Size;
+		GLenum Type;
+		GLboolean IsNormalized;
+		GLuint Offset;
+	};
+
 	std::vector<Material> m_Materials;
 
 	// Temporary space for vertex stuff before we load them into the GPU
@@ -45,51 +328,183 @@ private:
 
 	Assimp::Importer m_Importer;
 
+	MeshLoadOptions m_LoadOptions;
+
+	// Output of the mesh optimizer for one submesh, before it is concatenated with the others
+	struct OptimizedSubMesh
+	{
+		std::vector<Vertex> Vertices;
+		std::vector<uint> Indices; // all the LODs
+		std::vector<MeshLOD> LODs; // BaseIndex is relative to Indices
+		std::vector<Meshlet> Meshlets; // same
+	};
+
+	// Where the textures of every material were loaded from, for the mesh cache
+	struct TextureSource
+	{
+		std::string Path;			  // full path of a texture file...
+		const void* pEmbedded = NULL; // ...or an image inside the Assimp scene
+		uint EmbeddedSize = 0;
+	};
+
+	struct MaterialSource
+	{
+		TextureSource Diffuse;
+		TextureSource SpecularExponent;
+	};
+
+	std::vector<MaterialSource> m_MaterialSources;
+
 public:
 	BasicMesh(){};
 
 	~BasicMesh() { Clear(); }
 
+	//
+	// The first load of a file imports it with Assimp and writes the result to a
+	// binary cache next to it (<Filename>.oglmesh, see mesh_cache.h). Later loads
+	// map the cache and skip Assimp as long as the size and hash of the source
+	// file and the options still match.
+	//
 	bool
-	LoadMesh(const std::string& Filename)
+	LoadMesh(const std::string& Filename, const MeshLoadOptions& Options = MeshLoadOptions())
 	{
 		// Release the previously loaded mesh (if it exists)
 		Clear();
 
-		// Create the VAO
-		// if (IsGLVersionHigher(4, 5)) {
-		//   glGenertexArrays(1, &m_VAO);
-		//   glCreateBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
-		// } else {
-		glGenVertexArrays(1, &m_VAO);
-		glBindVertexArray(m_VAO);
-		glGenBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
-		// }
+		if (!ImportMesh(Filename, Options))
+		{
+			return false;
+		}
+
+		while (!UploadNextPart())
+		{
+		}
+
+		return GLCheckError();
+	}
+
+	//
+	// LoadMesh() in two steps for loading in the background (see ogl::MeshLoader).
+	// ImportMesh() does all the CPU work: the import or the cache, the optimizer,
+	// the GPU buffer layout and the texture decoding. It doesn't call GL so it can
+	// run on any thread, but only on a new mesh. UploadNextPart() then creates
+	// the GL objects on the GL thread.
+	//
+	bool
+	ImportMesh(const std::string& Filename, const MeshLoadOptions& Options = MeshLoadOptions())
+	{
+		assert(m_VAO == 0);
+
+		m_LoadOptions = Options;
 
 		bool Ret = false;
 
-		m_pScene = m_Importer.ReadFile(Filename.c_str(), ASSIMP_LOAD_FLAGS);
+		// The hash of the source validates the cache and is stored in a new one
+		u64 SourceSize = 0;
+		u64 SourceHash = 0;
+		bool IsSourceHashed = m_LoadOptions.UseCache && ogl::HashFile(Filename, SourceSize, SourceHash);
 
-		if (m_pScene)
+		if (IsSourceHashed && InitFromCache(Filename, SourceSize, SourceHash))
 		{
-			m_GlobalInverseTransform = m_pScene->mRootNode->mTransformation;
-			m_GlobalInverseTransform = m_GlobalInverseTransform.Inverse();
-			Ret = InitFromScene(m_pScene, Filename);
+			m_pScene = NULL;
+			Ret = true;
 		}
 		else
 		{
-			printf("Error parsing '%s': '%s'\n", Filename.c_str(), m_Importer.GetErrorString());
-		}
+			m_pScene = m_Importer.ReadFile(Filename.c_str(), ASSIMP_LOAD_FLAGS);
 
-		// Make sure the VAO is not changed from the outside
-		// if (!IsGLVersionHigher(4, 5)) {
-		//   glBindVertexArray(0);
-		// }
-		glBindVertexArray(0);
+			if (m_pScene)
+			{
+				m_GlobalInverseTransform = m_pScene->mRootNode->mTransformation;
+				m_GlobalInverseTransform = m_GlobalInverseTransform.Inverse();
+				Ret = InitFromScene(m_pScene, Filename);
+
+				if (Ret && IsSourceHashed)
+				{
+					WriteMeshCache(Filename, SourceSize, SourceHash);
+				}
+			}
+			else
+			{
+				printf("Error parsing '%s': '%s'\n", Filename.c_str(), m_Importer.GetErrorString());
+			}
+		}
 
 		return Ret;
 	}
 
+	//
+	// Does the next part of the GPU upload after ImportMesh() and returns true
+	// once the mesh can be drawn. The first call creates the VAO and the buffers,
+	// the following ones copy MESH_UPLOAD_CHUNK_SIZE bytes of the vertices and
+	// then of the indices and the last ones create a texture each. A caller with
+	// a time budget per frame can stop between any two calls.
+	//
+	bool
+	UploadNextPart()
+	{
+		PendingUpload& Upload = m_Upload;
+
+		if (!Upload.IsPending)
+		{
+			return true;
+		}
+
+		if (m_VAO == 0)
+		{
+			// Create the VAO
+			// if (IsGLVersionHigher(4, 5)) {
+			//   glGenertexArrays(1, &m_VAO);
+			//   glCreateBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+			// } else {
+			glGenVertexArrays(1, &m_VAO);
+			glBindVertexArray(m_VAO);
+			glGenBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+			// }
+
+			PopulateBuffers();
+
+			// Make sure the VAO is not changed from the outside
+			// if (!IsGLVersionHigher(4, 5)) {
+			//   glBindVertexArray(0);
+			// }
+			glBindVertexArray(0);
+		}
+		else if (Upload.VertexBytesDone < Upload.VertexBufferSize)
+		{
+			UploadBufferChunk(
+				m_Buffers[VERTEX_BUFFER],
+				Upload.pVertexData,
+				Upload.VertexBufferSize,
+				Upload.VertexBytesDone);
+		}
+		else if (Upload.IndexBytesDone < Upload.IndexBufferSize)
+		{
+			UploadBufferChunk(
+				m_Buffers[INDEX_BUFFER],
+				Upload.pIndexData,
+				Upload.IndexBufferSize,
+				Upload.IndexBytesDone);
+		}
+		else if (Upload.NumTexturesDone < Upload.Textures.size())
+		{
+			Upload.Textures[Upload.NumTexturesDone]->Upload();
+			Upload.NumTexturesDone++;
+		}
+
+		if ((Upload.VertexBytesDone < Upload.VertexBufferSize) || (Upload.IndexBytesDone < Upload.IndexBufferSize) ||
+			(Upload.NumTexturesDone < Upload.Textures.size()))
+		{
+			return false;
+		}
+
+		// Release the staging copies
+		Upload = PendingUpload();
+
+		return true;
+	}
+
 	void
 	Render(IRenderCallbacks* pRenderCallbacks = NULL)
 	{
@@ -97,56 +512,174 @@ public:
 
 		for (unsigned int i = 0; i < m_Meshes.size(); i++)
 		{
-			unsigned int MaterialIndex = m_Meshes[i].MaterialIndex;
-			assert(MaterialIndex < m_Materials.size());
+			DrawSubMesh(i, pRenderCallbacks);
+		}
 
-			if (m_Materials[MaterialIndex].pDiffuse)
-			{
-				m_Materials[MaterialIndex].pDiffuse->Bind(COLOR_TEXTURE_UNIT);
-			}
+		// Make sure the VAO is not changed from the outside
+		glBindVertexArray(0);
+	}
 
-			if (m_Materials[MaterialIndex].pSpecularExponent)
-			{
-				m_Materials[MaterialIndex].pSpecularExponent->Bind(SPECULAR_EXPONENT_UNIT);
+	//
+	// Same as above but skips the submeshes whose bounding box is outside the frustum.
+	// The frustum must be in the local space of the mesh, i.e. built from the WVP
+	// matrix of this instance. That is equivalent to testing the world space bounds
+	// against the ViewProj frustum but it doesn't require transforming every box.
+	// The bounds of the whole mesh are tested first (using pCullingCache, if given,
+	// which should be kept per instance) and the submeshes are only tested when
+	// the mesh intersects the frustum.
+	//
+	void
+	Render(const FrustumCulling& LocalFrustum, IRenderCallbacks* pRenderCallbacks = NULL, CullingCache* pCullingCache = NULL)
+	{
+		RenderCulled(LocalFrustum, pRenderCallbacks, pCullingCache, -1.0f, 0.0f);
+	}
 
-				if (pRenderCallbacks)
-				{
-					pRenderCallbacks->ControlSpecularExponent(true);
-				}
+	//
+	// Same as above but every submesh is drawn at the coarsest LOD whose error is
+	// at most MaxPixelError pixels on screen (see MeshLoadOptions::LODErrors).
+	// PixelsPerUnit comes from CalcPixelsPerUnit() for the instance. gl_PrimitiveID
+	// is relative to the LOD so picking and visibility passes must use Render().
+	//
+	void
+	RenderLOD(
+		const FrustumCulling& LocalFrustum,
+		float PixelsPerUnit,
+		float MaxPixelError = 1.0f,
+		IRenderCallbacks* pRenderCallbacks = NULL,
+		CullingCache* pCullingCache = NULL)
+	{
+		RenderCulled(LocalFrustum, pRenderCallbacks, pCullingCache, PixelsPerUnit, MaxPixelError);
+	}
+
+	//
+	// Same as Render() with a frustum but the submeshes that have meshlets (see
+	// MeshLoadOptions::BuildMeshlets) are culled per meshlet, against the frustum
+	// and by their normal cones, and the visible ones are drawn with a single
+	// multi draw per submesh. CameraLocalPos is the camera position in the local
+	// space of the instance, the cone test relies on the world transform having
+	// a uniform scale. gl_PrimitiveID restarts in every range of meshlets so, as
+	// with RenderLOD(), picking and visibility passes must use Render().
+	//
+	void
+	RenderMeshlets(
+		const FrustumCulling& LocalFrustum,
+		const Vector3f& CameraLocalPos,
+		IRenderCallbacks* pRenderCallbacks = NULL,
+		CullingCache* pCullingCache = NULL)
+	{
+		bool IsInside = false;
+
+		if (!CullSubMeshes(LocalFrustum, pCullingCache, &IsInside))
+		{
+			return;
+		}
+
+		glBindVertexArray(m_VAO);
+
+		for (uint i = 0; i < m_Meshes.size(); i++)
+		{
+			if (!m_SubMeshVisible[i])
+			{
+				continue;
 			}
-			else
+
+			if (m_Meshes[i].NumMeshlets == 0)
 			{
-				if (pRenderCallbacks)
-				{
-					pRenderCallbacks->ControlSpecularExponent(false);
-				}
+				DrawSubMesh(i, pRenderCallbacks);
+				continue;
 			}
 
-			if (pRenderCallbacks)
+			m_MeshletDraws.Clear();
+			CullMeshlets(i, LocalFrustum, CameraLocalPos, IsInside);
+
+			if (m_MeshletDraws.Counts.empty())
 			{
-				if (m_Materials[MaterialIndex].pDiffuse)
-				{
-					pRenderCallbacks->DrawStartCB(i);
-					pRenderCallbacks->SetMaterial(m_Materials[MaterialIndex]);
-				}
-				else
-				{
-					pRenderCallbacks->DisableDiffuseTexture();
-				}
+				continue;
 			}
 
-			glDrawElementsBaseVertex(
+			SetupSubMeshMaterial(i, pRenderCallbacks);
+
+			glMultiDrawElementsBaseVertex(
 				GL_TRIANGLES,
-				m_Meshes[i].NumIndices,
-				GL_UNSIGNED_INT,
-				(void*)(sizeof(unsigned int) * m_Meshes[i].BaseIndex),
-				m_Meshes[i].BaseVertex);
+				m_MeshletDraws.Counts.data(),
+				m_Meshes[i].IndexType,
+				m_MeshletDraws.Offsets.data(),
+				(GLsizei)m_MeshletDraws.Counts.size(),
+				m_MeshletDraws.BaseVertices.data());
 		}
 
 		// Make sure the VAO is not changed from the outside
 		glBindVertexArray(0);
 	}
 
+	const MeshletStats&
+	GetMeshletStats() const
+	{
+		return m_MeshletStats;
+	}
+
+	void
+	ResetMeshletStats()
+	{
+		m_MeshletStats = MeshletStats();
+	}
+
+	uint
+	GetNumMeshlets(uint DrawIndex) const
+	{
+		return m_Meshes[DrawIndex].NumMeshlets;
+	}
+
+	//
+	// Screen pixels per local space unit for an instance, at the point of its
+	// bounding sphere that is closest to the camera. WVP is the matrix of the
+	// instance (uniformly scaled) and ViewportHeight is in pixels.
+	//
+	float
+	CalcPixelsPerUnit(const Matrix4f& WVP, float ViewportHeight) const
+	{
+		// Clip space y and w of a local point are the dot products with rows 1 and 3.
+		// The length of their xyz part is how much they change per unit of distance.
+		Vector3f RowY(WVP.m[1][0], WVP.m[1][1], WVP.m[1][2]);
+		Vector3f RowW(WVP.m[3][0], WVP.m[3][1], WVP.m[3][2]);
+		const Vector3f& Center = m_BoundingSphere.Center;
+
+		float CenterW = RowW.Dot(Center) + WVP.m[3][3];
+		float NearW = CenterW - m_BoundingSphere.Radius * RowW.Length();
+
+		if (NearW <= 0.0f)
+		{
+			return FLT_MAX; // the camera is inside the bounds
+		}
+
+		return RowY.Length() * 0.5f * ViewportHeight / NearW;
+	}
+
+	uint
+	GetNumLODs(uint DrawIndex) const
+	{
+		assert(DrawIndex < m_Meshes.size());
+		return m_Meshes[DrawIndex].NumLODs;
+	}
+
+	// The coarsest LOD of a submesh whose error is at most MaxPixelError pixels
+	uint
+	SelectLOD(uint DrawIndex, float PixelsPerUnit, float MaxPixelError = 1.0f) const
+	{
+		assert(DrawIndex < m_Meshes.size());
+		const BasicMeshEntry& Mesh = m_Meshes[DrawIndex];
+
+		for (uint LOD = Mesh.NumLODs - 1; LOD > 0; LOD--)
+		{
+			if (m_LODs[Mesh.FirstLOD + LOD].Error * PixelsPerUnit <= MaxPixelError)
+			{
+				return LOD;
+			}
+		}
+
+		return 0;
+	}
+
 	void
 	Render(uint DrawIndex, uint PrimID)
 	{
@@ -168,50 +701,109 @@ public:
 		glDrawElementsBaseVertex(
 			GL_TRIANGLES,
 			3,
-			GL_UNSIGNED_INT,
-			(void*)(sizeof(unsigned int) * (m_Meshes[DrawIndex].BaseIndex + PrimID * 3)),
+			m_Meshes[DrawIndex].IndexType,
+			GetIndexBufferOffset(DrawIndex, m_Meshes[DrawIndex].BaseIndex + PrimID * 3),
 			m_Meshes[DrawIndex].BaseVertex);
 
 		// Make sure the VAO is not changed from the outside
 		glBindVertexArray(0);
 	}
 
+	//
+	// Draws every submesh once for all the instances. The matrices are read by the
+	// vertex shader from the INSTANCE_WVP_LOCATION/INSTANCE_WORLD_LOCATION
+	// attributes (as rows, i.e. gl_Position = vec4(Position, 1.0) * WVP).
+	// WorldMats can be NULL if the shader doesn't need it.
+	//
 	void
-	Render(uint NumInstances, const Matrix4f* WVPMats, const Matrix4f* WorldMats)
+	Render(
+		uint NumInstances,
+		const Matrix4f* WVPMats,
+		const Matrix4f* WorldMats,
+		IRenderCallbacks* pRenderCallbacks = NULL)
 	{
 		glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[WVP_MAT_BUFFER]);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(Matrix4f) * NumInstances, WVPMats, GL_DYNAMIC_DRAW);
 
-		glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[WORLD_MAT_BUFFER]);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(Matrix4f) * NumInstances, WorldMats, GL_DYNAMIC_DRAW);
+		if (WorldMats)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[WORLD_MAT_BUFFER]);
+			glBufferData(GL_ARRAY_BUFFER, sizeof(Matrix4f) * NumInstances, WorldMats, GL_DYNAMIC_DRAW);
+		}
 
 		glBindVertexArray(m_VAO);
 
 		for (unsigned int i = 0; i < m_Meshes.size(); i++)
 		{
-			const unsigned int MaterialIndex = m_Meshes[i].MaterialIndex;
+			DrawSubMesh(i, pRenderCallbacks, NumInstances);
+		}
 
-			assert(MaterialIndex < m_Materials.size());
+		// Make sure the VAO is not changed from the outside
+		glBindVertexArray(0);
+	}
 
-			if (m_Materials[MaterialIndex].pDiffuse)
+	// Sizes the highlight for this mesh and clears it
+	void
+	InitHighlight(TriangleHighlight& Highlight) const
+	{
+		Highlight.m_subMeshes.clear();
+		Highlight.m_subMeshes.resize(m_Meshes.size());
+
+		for (uint i = 0; i < m_Meshes.size(); i++)
+		{
+			Highlight.m_subMeshes[i].NumTriangles = m_Meshes[i].NumIndices / 3;
+		}
+
+		Highlight.m_numTriangles = 0;
+		Highlight.m_isLayoutDirty = true;
+	}
+
+	//
+	// Draws the highlighted triangles (see TriangleHighlight), one draw per
+	// submesh that has any. Only DrawStartCB() of the callbacks is called, no
+	// textures are bound, i.e. this is meant for a flat color technique.
+	//
+	void
+	RenderHighlight(TriangleHighlight& Highlight, IRenderCallbacks* pRenderCallbacks = NULL)
+	{
+		assert(Highlight.m_subMeshes.size() == m_Meshes.size());
+
+		if (Highlight.m_numTriangles == 0)
+		{
+			return;
+		}
+
+		UpdateHighlightBuffer(Highlight);
+
+		glBindVertexArray(m_VAO);
+
+		// The element buffer binding is part of the VAO, it is restored below
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Highlight.m_buffer);
+
+		for (uint i = 0; i < m_Meshes.size(); i++)
+		{
+			const TriangleHighlight::SubMesh& Sub = Highlight.m_subMeshes[i];
+
+			if (Sub.Prims.empty())
 			{
-				m_Materials[MaterialIndex].pDiffuse->Bind(COLOR_TEXTURE_UNIT);
+				continue;
 			}
 
-			if (m_Materials[MaterialIndex].pSpecularExponent)
+			if (pRenderCallbacks)
 			{
-				m_Materials[MaterialIndex].pSpecularExponent->Bind(SPECULAR_EXPONENT_UNIT);
+				pRenderCallbacks->DrawStartCB(i);
 			}
 
-			glDrawElementsInstancedBaseVertex(
+			glDrawElementsBaseVertex(
 				GL_TRIANGLES,
-				m_Meshes[i].NumIndices,
+				(GLsizei)Sub.Prims.size() * 3,
 				GL_UNSIGNED_INT,
-				(void*)(sizeof(unsigned int) * m_Meshes[i].BaseIndex),
-				NumInstances,
+				(void*)(sizeof(uint) * 3 * Sub.Offset),
 				m_Meshes[i].BaseVertex);
 		}
 
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
+
 		// Make sure the VAO is not changed from the outside
 		glBindVertexArray(0);
 	}
@@ -230,396 +822,1840 @@ public:
 		return m_Materials[0];
 	}
 
+	uint
+	GetNumMaterials() const
+	{
+		return (uint)m_Materials.size();
+	}
+
+	const Material&
+	GetMaterial(uint MaterialIndex) const
+	{
+		assert(MaterialIndex < m_Materials.size());
+		return m_Materials[MaterialIndex];
+	}
+
+	//
+	// For shaders that fetch the triangles themselves, e.g. the shading pass of a
+	// visibility buffer. Binds three consecutive shader storage buffer slots:
+	//   FirstBinding     - the vertices, as 8 floats (position, tex coords, normal) or
+	//                      4 uints when HasPackedVertices() (see PackedVertex)
+	//   FirstBinding + 1 - the indices, 16 or 32 bit per submesh (see BasicMeshEntry::IndexType)
+	//   FirstBinding + 2 - one uvec4 per submesh: the position of the first index in units of its
+	//                      size, BaseVertex, MaterialIndex and the index size in bytes
+	//
+	void
+	BindStorageBuffers(uint FirstBinding) const
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FirstBinding, m_Buffers[VERTEX_BUFFER]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FirstBinding + 1, m_Buffers[INDEX_BUFFER]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FirstBinding + 2, m_Buffers[DRAW_INFO_BUFFER]);
+	}
+
+	// The format of the GPU vertex buffer, see MeshLoadOptions::PackVertices
+	bool
+	HasPackedVertices() const
+	{
+		return m_LoadOptions.PackVertices;
+	}
+
 	PBRMaterial&
 	GetPBRMaterial()
 	{
 		return m_Materials[0].PBRmaterial;
 	};
 
+	uint
+	GetNumSubMeshes() const
+	{
+		return (uint)m_Meshes.size();
+	}
+
+	// Bounds of the whole mesh in local space
+	const AABB&
+	GetAABB() const
+	{
+		return m_AABB;
+	}
+
+	const BoundingSphere&
+	GetBoundingSphere() const
+	{
+		return m_BoundingSphere;
+	}
+
+	// Bounds of a single submesh (draw index) in local space
+	const AABB&
+	GetSubMeshAABB(uint SubMeshIndex) const
+	{
+		assert(SubMeshIndex < m_SubMeshAABBs.size());
+		return m_SubMeshAABBs[SubMeshIndex];
+	}
+
+	const BoundingSphere&
+	GetSubMeshBoundingSphere(uint SubMeshIndex) const
+	{
+		assert(SubMeshIndex < m_SubMeshSpheres.size());
+		return m_SubMeshSpheres[SubMeshIndex];
+	}
+
+	//
+	// Closest triangle hit by a ray in the local space of the mesh (use
+	// TransformRay() with the inverse world matrix of the instance). Walks the
+	// triangle BVH that is built at load time so it doesn't need the GPU.
+	//
+	bool
+	RayCast(const Ray& LocalRay, MeshRayHit& Hit, float tMax = FLT_MAX) const
+	{
+		return m_TriangleBVH.QueryRay(LocalRay, tMax, [&](uint Triangle, float, float& t) {
+			const TriangleRef& Ref = m_Triangles[Triangle];
+			Vector3f v0, v1, v2;
+			GetTrianglePositions(Ref.DrawIndex, Ref.PrimID, v0, v1, v2);
+
+			float tHit, u, v;
+
+			if (!RayIntersectsTriangle(LocalRay, v0, v1, v2, t, tHit, u, v))
+			{
+				return false;
+			}
+
+			t = tHit;
+			Hit.DrawIndex = Ref.DrawIndex;
+			Hit.PrimID = Ref.PrimID;
+			Hit.t = tHit;
+			Hit.u = u;
+			Hit.v = v;
+
+			return true;
+		});
+	}
+
+	//
+	// Appends the triangles whose bounds intersect the frustum, which must be in
+	// the local space of the mesh (e.g. built from the WVP matrix of the
+	// instance). Conservative: a triangle that only has its box in the frustum is
+	// included too. Uses the same triangle BVH as RayCast().
+	//
+	void
+	QueryFrustum(const FrustumCulling& LocalFrustum, std::vector<MeshTriangleID>& Triangles) const
+	{
+		std::vector<uint> Items;
+		m_TriangleBVH.QueryFrustum(LocalFrustum, Items);
+
+		for (uint Item : Items)
+		{
+			Triangles.push_back({m_Triangles[Item].DrawIndex, m_Triangles[Item].PrimID});
+		}
+	}
+
+	void
+	GetTrianglePositions(uint DrawIndex, uint PrimID, Vector3f& v0, Vector3f& v1, Vector3f& v2) const
+	{
+		assert(DrawIndex < m_Meshes.size());
+		const BasicMeshEntry& Mesh = m_Meshes[DrawIndex];
+
+		assert(PrimID * 3 < Mesh.NumIndices);
+		const uint* pIndices = &m_Indices[Mesh.BaseIndex + PrimID * 3];
+
+		v0 = m_Vertices[Mesh.BaseVertex + pIndices[0]].Position;
+		v1 = m_Vertices[Mesh.BaseVertex + pIndices[1]].Position;
+		v2 = m_Vertices[Mesh.BaseVertex + pIndices[2]].Position;
+	}
+
+	// Uses the final buffers rather than the Assimp scene, which doesn't exist when the mesh came from the cache
 	void
 	GetLeadingVertex(uint DrawIndex, uint PrimID, Vector3f& Vertex)
 	{
-		uint MeshIndex = DrawIndex; // Each mesh is rendered in its own draw call
+		Vector3f v1, v2;
+		GetTrianglePositions(DrawIndex, PrimID, Vertex, v1, v2);
+	}
+
+protected:
+	void
+	Clear()
+	{
+		if (m_Buffers[0] != 0)
+		{
+			glDeleteBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+		}
+
+		if (m_VAO != 0)
+		{
+			glDeleteVertexArrays(1, &m_VAO);
+			m_VAO = 0;
+		}
+
+		m_Upload = PendingUpload();
+	}
+
+	// The arrays are sized up front and every submesh fills its own range, see CountVerticesAndIndices()
+	virtual void
+	ReserveSpace(uint NumVertices, uint NumIndices)
+	{
+		m_Vertices.resize(NumVertices);
+		m_Indices.resize(NumIndices);
+	}
+
+	virtual void
+	InitSingleMesh(uint MeshIndex, const aiMesh* paiMesh)
+	{
+		const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
+
+		// printf("Mesh %d\n", MeshIndex);
+		// Populate the vertex attribute vectors
+		Vertex v;
+
+		Vertex* pVertices = m_Vertices.data() + m_Meshes[MeshIndex].BaseVertex;
+		uint* pIndices = m_Indices.data() + m_Meshes[MeshIndex].BaseIndex;
+
+		for (unsigned int i = 0; i < paiMesh->mNumVertices; i++)
+		{
+			const aiVector3D& pPos = paiMesh->mVertices[i];
+			// printf("%d: ", i); Vector3f v(pPos.x, pPos.y, pPos.z); v.Print();
+			v.Position = Vector3f(pPos.x, pPos.y, pPos.z);
+
+			if (paiMesh->mNormals)
+			{
+				const aiVector3D& pNormal = paiMesh->mNormals[i];
+				v.Normal = Vector3f(pNormal.x, pNormal.y, pNormal.z);
+			}
+			else
+			{
+				aiVector3D Normal(0.0f, 1.0f, 0.0f);
+				v.Normal = Vector3f(Normal.x, Normal.y, Normal.z);
+			}
+
+			const aiVector3D& pTexCoord = paiMesh->HasTextureCoords(0) ? paiMesh->mTextureCoords[0][i] : Zero3D;
+			v.TexCoords = Vector2f(pTexCoord.x, pTexCoord.y);
+
+			pVertices[i] = v;
+		}
+
+		CalcSubMeshBounds(MeshIndex, pVertices, paiMesh->mNumVertices);
+
+		// Populate the index buffer
+		for (unsigned int i = 0; i < paiMesh->mNumFaces; i++)
+		{
+			const aiFace& Face = paiMesh->mFaces[i];
+			pIndices[i * 3 + 0] = Face.mIndices[0];
+			pIndices[i * 3 + 1] = Face.mIndices[1];
+			pIndices[i * 3 + 2] = Face.mIndices[2];
+		}
+	}
+
+	// The result goes to Output because the optimizer changes the number of vertices and indices
+	virtual void
+	InitSingleMeshOpt(uint MeshIndex, const aiMesh* paiMesh, OptimizedSubMesh& Output)
+	{
+		const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
+
+		// printf("Mesh %d\n", MeshIndex);
+		// Populate the vertex attribute vectors
+		Vertex v;
+
+		std::vector<Vertex> Vertices(paiMesh->mNumVertices);
+
+		for (unsigned int i = 0; i < paiMesh->mNumVertices; i++)
+		{
+			const aiVector3D& pPos = paiMesh->mVertices[i];
+			// printf("%d: ", i); Vector3f v(pPos.x, pPos.y, pPos.z); v.Print();
+			v.Position = Vector3f(pPos.x, pPos.y, pPos.z);
+
+			if (paiMesh->mNormals)
+			{
+				const aiVector3D& pNormal = paiMesh->mNormals[i];
+				v.Normal = Vector3f(pNormal.x, pNormal.y, pNormal.z);
+			}
+			else
+			{
+				aiVector3D Normal(0.0f, 1.0f, 0.0f);
+				v.Normal = Vector3f(Normal.x, Normal.y, Normal.z);
+			}
+
+			const aiVector3D& pTexCoord = paiMesh->HasTextureCoords(0) ? paiMesh->mTextureCoords[0][i] : Zero3D;
+			v.TexCoords = Vector2f(pTexCoord.x, pTexCoord.y);
+
+			Vertices[i] = v;
+		}
+
+		CalcSubMeshBounds(MeshIndex, Vertices.data(), paiMesh->mNumVertices);
+
+		int NumIndices = paiMesh->mNumFaces * 3;
+
+		std::vector<uint> Indices;
+		Indices.resize(NumIndices);
+
+		// Populate the index buffer
+		for (unsigned int i = 0; i < paiMesh->mNumFaces; i++)
+		{
+			const aiFace& Face = paiMesh->mFaces[i];
+			Indices[i * 3 + 0] = Face.mIndices[0];
+			Indices[i * 3 + 1] = Face.mIndices[1];
+			Indices[i * 3 + 2] = Face.mIndices[2];
+		}
+
+		OptimizeMesh(Indices, Vertices);
+
+		if (m_LoadOptions.BuildMeshlets)
+		{
+			BuildMeshlets(Vertices, Indices, Output.Meshlets);
+		}
+
+		GenerateLODs(Vertices, Indices, Output.LODs);
+
+		Output.Vertices.swap(Vertices);
+		Output.Indices.swap(Indices);
+	}
+
+	virtual void
+	PopulateBuffers()
+	{
+		// The DSA version requires objects created by glCreate*() while LoadMesh uses glGen*()
+		PopulateBuffersNonDSA();
+
+		InitInstanceAttributes(INSTANCE_WVP_LOCATION, m_Buffers[WVP_MAT_BUFFER]);
+		InitInstanceAttributes(INSTANCE_WORLD_LOCATION, m_Buffers[WORLD_MAT_BUFFER]);
+
+		InitDrawInfoBuffer();
+	}
+
+	// The submesh table for BindStorageBuffers()
+	void
+	InitDrawInfoBuffer()
+	{
+		std::vector<uint> DrawInfo(m_Meshes.size() * 4);
+
+		for (uint i = 0; i < m_Meshes.size(); i++)
+		{
+			uint IndexSize = GetIndexSize(m_Meshes[i].IndexType);
+			DrawInfo[i * 4 + 0] = (uint)(m_Meshes[i].IndexByteOffset / IndexSize);
+			DrawInfo[i * 4 + 1] = m_Meshes[i].BaseVertex;
+			DrawInfo[i * 4 + 2] = m_Meshes[i].MaterialIndex;
+			DrawInfo[i * 4 + 3] = IndexSize;
+		}
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_Buffers[DRAW_INFO_BUFFER]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint) * DrawInfo.size(), DrawInfo.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// A matrix per instance, one row per attribute location
+	void
+	InitInstanceAttributes(uint Location, GLuint Buffer)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, Buffer);
+
+		for (uint i = 0; i < 4; i++)
+		{
+			glEnableVertexAttribArray(Location + i);
+			glVertexAttribPointer(
+				Location + i,
+				4,
+				GL_FLOAT,
+				GL_FALSE,
+				sizeof(Matrix4f),
+				(const void*)(i * 4 * sizeof(float)));
+			glVertexAttribDivisor(Location + i, 1);
+		}
+	}
+
+	// The vertex attributes of the current vertex buffer format
+	void
+	GetVertexAttributes(VertexAttribute (&Attributes)[3], GLsizei& Stride) const
+	{
+		if (m_LoadOptions.PackVertices)
+		{
+			Attributes[0] = {POSITION_LOCATION, 3, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, Position)};
+			Attributes[1] = {TEX_COORD_LOCATION, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, TexCoords)};
+			Attributes[2] = {NORMAL_LOCATION, 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(PackedVertex, Normal)};
+			Stride = sizeof(PackedVertex);
+		}
+		else
+		{
+			Attributes[0] = {POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Position)};
+			Attributes[1] = {TEX_COORD_LOCATION, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, TexCoords)};
+			Attributes[2] = {NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Normal)};
+			Stride = sizeof(Vertex);
+		}
+	}
+
+	// Returns the contents of the vertex buffer, PackedVertices is the storage for the packed format
+	const void*
+	GetVertexBufferData(std::vector<PackedVertex>& PackedVertices, size_t& Size) const
+	{
+		if (!m_LoadOptions.PackVertices)
+		{
+			Size = sizeof(Vertex) * m_Vertices.size();
+			return m_Vertices.data();
+		}
+
+		PackedVertices.resize(m_Vertices.size());
+
+		for (size_t i = 0; i < m_Vertices.size(); i++)
+		{
+			const Vertex& v = m_Vertices[i];
+			PackedVertex& p = PackedVertices[i];
+
+			p.Position[0] = ogl::FloatToHalf(v.Position.x);
+			p.Position[1] = ogl::FloatToHalf(v.Position.y);
+			p.Position[2] = ogl::FloatToHalf(v.Position.z);
+			p.Position[3] = 0;
+			p.TexCoords[0] = ogl::FloatToHalf(v.TexCoords.x);
+			p.TexCoords[1] = ogl::FloatToHalf(v.TexCoords.y);
+			p.Normal = ogl::PackSnorm1010102(v.Normal.x, v.Normal.y, v.Normal.z);
+		}
+
+		Size = sizeof(PackedVertex) * PackedVertices.size();
+		return PackedVertices.data();
+	}
+
+	static uint
+	GetIndexSize(GLenum IndexType)
+	{
+		return (IndexType == GL_UNSIGNED_SHORT) ? sizeof(u16) : sizeof(uint);
+	}
+
+	// Where the index FirstIndex (of m_Indices) of a submesh is in the GPU index buffer
+	const void*
+	GetIndexBufferOffset(uint MeshIndex, uint FirstIndex) const
+	{
+		const BasicMeshEntry& Mesh = m_Meshes[MeshIndex];
+		assert(FirstIndex >= Mesh.BaseIndex);
+		u64 Offset = Mesh.IndexByteOffset + (u64)(FirstIndex - Mesh.BaseIndex) * GetIndexSize(Mesh.IndexType);
+		return (const void*)(size_t)Offset;
+	}
+
+	//
+	// Picks the index type of every submesh and lays out the GPU index buffer.
+	// The indices are relative to the base vertex so most submeshes fit in 16
+	// bits. The range of a submesh covers all its LODs and the 32 bit ranges are
+	// 4 byte aligned. Returns the contents of the buffer, which is m_Indices as
+	// is when every submesh uses 32 bits, IndexData is the storage otherwise.
+	//
+	const void*
+	GetIndexBufferData(std::vector<u8>& IndexData, size_t& Size)
+	{
+		std::vector<uint> RangeEnds(m_Meshes.size());
+		bool HasShortIndices = false;
+
+		for (uint i = 0; i < m_Meshes.size(); i++)
+		{
+			BasicMeshEntry& Mesh = m_Meshes[i];
+			uint End = Mesh.BaseIndex + Mesh.NumIndices;
+
+			for (uint l = 0; l < Mesh.NumLODs; l++)
+			{
+				const MeshLOD& LOD = m_LODs[Mesh.FirstLOD + l];
+				End = std::max(End, LOD.BaseIndex + LOD.NumIndices);
+			}
+
+			RangeEnds[i] = End;
+			Mesh.IndexType = GL_UNSIGNED_INT;
+
+			if (m_LoadOptions.UseShortIndices)
+			{
+				uint MaxIndex = 0;
+
+				for (uint j = Mesh.BaseIndex; j < End; j++)
+				{
+					MaxIndex = std::max(MaxIndex, m_Indices[j]);
+				}
+
+				if (MaxIndex <= USHRT_MAX)
+				{
+					Mesh.IndexType = GL_UNSIGNED_SHORT;
+					HasShortIndices = true;
+				}
+			}
+		}
+
+		if (!HasShortIndices)
+		{
+			for (BasicMeshEntry& Mesh : m_Meshes)
+			{
+				Mesh.IndexByteOffset = (u64)Mesh.BaseIndex * sizeof(uint);
+			}
 
-		assert(MeshIndex < m_pScene->mNumMeshes);
-		const aiMesh* paiMesh = m_pScene->mMeshes[MeshIndex];
+			Size = sizeof(uint) * m_Indices.size();
+			return m_Indices.data();
+		}
+
+		u64 Offset = 0;
+
+		for (uint i = 0; i < m_Meshes.size(); i++)
+		{
+			BasicMeshEntry& Mesh = m_Meshes[i];
+			uint IndexSize = GetIndexSize(Mesh.IndexType);
+			Offset = (Offset + IndexSize - 1) & ~(u64)(IndexSize - 1);
+			Mesh.IndexByteOffset = Offset;
+			Offset += (u64)(RangeEnds[i] - Mesh.BaseIndex) * IndexSize;
+		}
+
+		// Whole words for the shaders that read it as a uint array (see BindStorageBuffers())
+		IndexData.resize((size_t)((Offset + 3) & ~3ull));
+
+		for (uint i = 0; i < m_Meshes.size(); i++)
+		{
+			const BasicMeshEntry& Mesh = m_Meshes[i];
+			u8* pDst = IndexData.data() + Mesh.IndexByteOffset;
 
-		assert(PrimID < paiMesh->mNumFaces);
-		const aiFace& Face = paiMesh->mFaces[PrimID];
+			if (Mesh.IndexType == GL_UNSIGNED_SHORT)
+			{
+				for (uint j = Mesh.BaseIndex; j < RangeEnds[i]; j++, pDst += sizeof(u16))
+				{
+					u16 Index = (u16)m_Indices[j];
+					memcpy(pDst, &Index, sizeof(Index));
+				}
+			}
+			else
+			{
+				memcpy(pDst, &m_Indices[Mesh.BaseIndex], sizeof(uint) * (RangeEnds[i] - Mesh.BaseIndex));
+			}
+		}
+
+		Size = IndexData.size();
+		return IndexData.data();
+	}
+
+	// The vertex and index buffers get their size here, the contents are copied by UploadNextPart()
+	virtual void
+	PopulateBuffersNonDSA()
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[VERTEX_BUFFER]);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
+
+		glBufferData(GL_ARRAY_BUFFER, m_Upload.VertexBufferSize, NULL, GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_Upload.IndexBufferSize, NULL, GL_STATIC_DRAW);
+
+		VertexAttribute Attributes[3];
+		GLsizei Stride = 0;
+		GetVertexAttributes(Attributes, Stride);
+
+		for (uint i = 0; i < ARRAY_SIZE_IN_ELEMENTS(Attributes); i++)
+		{
+			const VertexAttribute& a = Attributes[i];
+			glEnableVertexAttribArray(a.Location);
+			glVertexAttribPointer(a.Location, a.Size, a.Type, a.IsNormalized, Stride, (const void*)(size_t)a.Offset);
+		}
+	}
+
+	virtual void
+	PopulateBuffersDSA()
+	{
+		glNamedBufferStorage(m_Buffers[VERTEX_BUFFER], m_Upload.VertexBufferSize, NULL, GL_DYNAMIC_STORAGE_BIT);
+		glNamedBufferStorage(m_Buffers[INDEX_BUFFER], m_Upload.IndexBufferSize, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+		VertexAttribute Attributes[3];
+		GLsizei Stride = 0;
+		GetVertexAttributes(Attributes, Stride);
+
+		glVertexArrayVertexBuffer(m_VAO, 0, m_Buffers[VERTEX_BUFFER], 0, Stride);
+		glVertexArrayElementBuffer(m_VAO, m_Buffers[INDEX_BUFFER]);
+
+		for (uint i = 0; i < ARRAY_SIZE_IN_ELEMENTS(Attributes); i++)
+		{
+			const VertexAttribute& a = Attributes[i];
+			glEnableVertexArrayAttrib(m_VAO, a.Location);
+			glVertexArrayAttribFormat(m_VAO, a.Location, a.Size, a.Type, a.IsNormalized, a.Offset);
+			glVertexArrayAttribBinding(m_VAO, a.Location, 0);
+		}
+	}
+
+	// Through the copy target so that neither the bindings of the VAO nor the ones of the caller change
+	void
+	UploadBufferChunk(GLuint Buffer, const void* pData, size_t Size, size_t& BytesDone)
+	{
+		size_t ChunkSize = std::min(Size - BytesDone, (size_t)MESH_UPLOAD_CHUNK_SIZE);
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, Buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, BytesDone, ChunkSize, (const u8*)pData + BytesDone);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		BytesDone += ChunkSize;
+	}
+
+	//
+	// The GPU side of the mesh between ImportMesh() and the last UploadNextPart().
+	// The buffer contents are prepared by the import so the GL thread only copies
+	// them.
+	//
+	struct PendingUpload
+	{
+		bool IsPending = false;
+		std::vector<PackedVertex> PackedVertices; // storage of pVertexData, see GetVertexBufferData()
+		std::vector<u8> IndexData;				  // storage of pIndexData, see GetIndexBufferData()
+		const void* pVertexData = NULL;
+		size_t VertexBufferSize = 0;
+		size_t VertexBytesDone = 0;
+		const void* pIndexData = NULL;
+		size_t IndexBufferSize = 0;
+		size_t IndexBytesDone = 0;
+		std::vector<Texture*> Textures; // decoded, see Texture::Decode()
+		uint NumTexturesDone = 0;
+	};
+
+	PendingUpload m_Upload;
+
+	// The last step of ImportMesh()
+	void
+	PrepareUpload()
+	{
+		m_Upload = PendingUpload();
+		m_Upload.IsPending = true;
+		m_Upload.pVertexData = GetVertexBufferData(m_Upload.PackedVertices, m_Upload.VertexBufferSize);
+		m_Upload.pIndexData = GetIndexBufferData(m_Upload.IndexData, m_Upload.IndexBufferSize);
+
+		for (const Material& Mat : m_Materials)
+		{
+			if (Mat.pDiffuse && Mat.pDiffuse->IsDecoded())
+			{
+				m_Upload.Textures.push_back(Mat.pDiffuse);
+			}
+
+			if (Mat.pSpecularExponent && Mat.pSpecularExponent->IsDecoded())
+			{
+				m_Upload.Textures.push_back(Mat.pSpecularExponent);
+			}
+		}
+	}
+
+	struct BasicMeshEntry
+	{
+		BasicMeshEntry()
+		{
+			NumIndices = 0;
+			BaseVertex = 0;
+			BaseIndex = 0;
+			MaterialIndex = INVALID_MATERIAL;
+			FirstLOD = 0;
+			NumLODs = 0;
+			IndexType = GL_UNSIGNED_INT;
+			IndexByteOffset = 0;
+			FirstMeshlet = 0;
+			NumMeshlets = 0;
+		}
+
+		// The full detail version, same as LOD 0
+		uint NumIndices;
+		uint BaseVertex;
+		uint BaseIndex;
+		uint MaterialIndex;
+
+		// Range of m_LODs
+		uint FirstLOD;
+		uint NumLODs;
+
+		// The GPU index buffer, see GetIndexBufferData()
+		GLenum IndexType; // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+		u64 IndexByteOffset;
+
+		// Range of m_Meshlets, they cover the full detail indices
+		uint FirstMeshlet;
+		uint NumMeshlets;
+	};
+
+	std::vector<BasicMeshEntry> m_Meshes;
+	std::vector<MeshLOD> m_LODs;
+	std::vector<Meshlet> m_Meshlets;
+
+	// The ranges of the visible meshlets of a submesh, for glMultiDrawElementsBaseVertex()
+	struct MeshletDraws
+	{
+		std::vector<GLsizei> Counts;
+		std::vector<const void*> Offsets;
+		std::vector<GLint> BaseVertices;
+
+		void
+		Clear()
+		{
+			Counts.clear();
+			Offsets.clear();
+			BaseVertices.clear();
+		}
+	};
+
+	MeshletDraws m_MeshletDraws;
+	MeshletStats m_MeshletStats;
+
+	// Local space bounds, one per entry in m_Meshes. The boxes are kept in their own
+	// array so that they can be culled in one batch.
+	std::vector<AABB> m_SubMeshAABBs;
+	std::vector<BoundingSphere> m_SubMeshSpheres;
+	std::vector<u8> m_SubMeshVisible;
+	AABB m_AABB;
+	BoundingSphere m_BoundingSphere;
+
+	// Every triangle of every submesh, indexed by the items of m_TriangleBVH
+	struct TriangleRef
+	{
+		uint DrawIndex;
+		uint PrimID;
+	};
+
+	std::vector<TriangleRef> m_Triangles;
+	ogl::BVH m_TriangleBVH;
+
+	const aiScene* m_pScene = NULL; // NULL when the mesh was loaded from the cache
+
+	Matrix4f m_GlobalInverseTransform;
+
+	vector<uint> m_Indices;
+
+	enum BUFFER_TYPE
+	{
+		INDEX_BUFFER = 0,
+		VERTEX_BUFFER = 1,
+		WVP_MAT_BUFFER = 2,	  // required only for instancing
+		WORLD_MAT_BUFFER = 3, // required only for instancing
+		DRAW_INFO_BUFFER = 4, // required only for BindStorageBuffers()
+		NUM_BUFFERS = 5
+	};
+
+	GLuint m_VAO = 0;
+
+	GLuint m_Buffers[NUM_BUFFERS] = {0};
+
+private:
+	bool
+	InitFromScene(const aiScene* pScene, const std::string& Filename)
+	{
+		m_Meshes.resize(pScene->mNumMeshes);
+		m_SubMeshAABBs.resize(pScene->mNumMeshes);
+		m_SubMeshSpheres.resize(pScene->mNumMeshes);
+		m_Materials.resize(pScene->mNumMaterials);
+
+		unsigned int NumVertices = 0;
+		unsigned int NumIndices = 0;
+
+		CountVerticesAndIndices(pScene, NumVertices, NumIndices);
+
+		ReserveSpace(NumVertices, NumIndices);
+
+		InitAllMeshes(pScene);
+
+		CalcMeshBounds();
+
+		BuildTriangleBVH();
+
+		if (!InitMaterials(pScene, Filename))
+		{
+			return false;
+		}
+
+		PrepareUpload();
+
+		return true;
+	}
+
+	//
+	// Mesh cache (see mesh_cache.h). The sections are copied into the same
+	// vectors that the import fills because ray casts and highlights need the
+	// CPU copies. The triangle BVH is restored from the stored layout rather
+	// than built again. From there everything is the same as after an import.
+	//
+	bool
+	InitFromCache(const std::string& Filename, u64 SourceSize, u64 SourceHash)
+	{
+		static_assert(std::is_trivially_copyable<Vertex>::value, "Vertex is stored as is");
+		static_assert(std::is_trivially_copyable<BasicMeshEntry>::value, "BasicMeshEntry is stored as is");
+		static_assert(std::is_trivially_copyable<AABB>::value, "AABB is stored as is");
+		static_assert(std::is_trivially_copyable<BoundingSphere>::value, "BoundingSphere is stored as is");
+		static_assert(std::is_trivially_copyable<ogl::BVH::NodeLayout>::value, "BVH::NodeLayout is stored as is");
+		static_assert(std::is_trivially_copyable<MeshLOD>::value, "MeshLOD is stored as is");
+		static_assert(std::is_trivially_copyable<Meshlet>::value, "Meshlet is stored as is");
+
+		ogl::MappedFile File;
+
+		if (!File.Open(ogl::GetMeshCacheFilename(Filename)))
+		{
+			return false;
+		}
+
+		const u8* pFile = (const u8*)File.GetData();
+
+		if (!IsMeshCacheValid(pFile, File.GetSize(), SourceSize, SourceHash))
+		{
+			printf("Mesh cache of '%s' is invalid or out of date\n", Filename.c_str());
+			return false;
+		}
+
+		const ogl::MeshCacheHeader& Header = *(const ogl::MeshCacheHeader*)pFile;
+
+		// The textures go first so that a missing texture file fails before the mesh is touched
+		const ogl::MeshCacheMaterial* pMaterials = (const ogl::MeshCacheMaterial*)(pFile + Header.MaterialsOffset);
+		m_Materials.clear();
+		m_Materials.resize(Header.NumMaterials);
+		m_MaterialSources.clear();
+
+		for (uint i = 0; i < Header.NumMaterials; i++)
+		{
+			m_Materials[i].AmbientColor = pMaterials[i].AmbientColor;
+			m_Materials[i].DiffuseColor = pMaterials[i].DiffuseColor;
+			m_Materials[i].SpecularColor = pMaterials[i].SpecularColor;
+
+			if (!LoadCachedTexture(pFile, pMaterials[i].Diffuse, m_Materials[i].pDiffuse) ||
+				!LoadCachedTexture(pFile, pMaterials[i].SpecularExponent, m_Materials[i].pSpecularExponent))
+			{
+				for (Material& Mat : m_Materials)
+				{
+					delete Mat.pDiffuse;
+					delete Mat.pSpecularExponent;
+				}
+
+				m_Materials.clear();
+
+				return false;
+			}
+		}
+
+		const BasicMeshEntry* pMeshes = (const BasicMeshEntry*)(pFile + Header.MeshesOffset);
+		m_Meshes.assign(pMeshes, pMeshes + Header.NumMeshes);
+
+		const AABB* pAABBs = (const AABB*)(pFile + Header.AABBsOffset);
+		m_SubMeshAABBs.assign(pAABBs, pAABBs + Header.NumMeshes);
+
+		const BoundingSphere* pSpheres = (const BoundingSphere*)(pFile + Header.SpheresOffset);
+		m_SubMeshSpheres.assign(pSpheres, pSpheres + Header.NumMeshes);
+
+		const Vertex* pVertices = (const Vertex*)(pFile + Header.VerticesOffset);
+		m_Vertices.assign(pVertices, pVertices + Header.NumVertices);
+
+		const uint* pIndices = (const uint*)(pFile + Header.IndicesOffset);
+		m_Indices.assign(pIndices, pIndices + Header.NumIndices);
+
+		const MeshLOD* pLODs = (const MeshLOD*)(pFile + Header.LODsOffset);
+		m_LODs.assign(pLODs, pLODs + Header.NumLODs);
+
+		const Meshlet* pMeshlets = (const Meshlet*)(pFile + Header.MeshletsOffset);
+		m_Meshlets.assign(pMeshlets, pMeshlets + Header.NumMeshlets);
+
+		memcpy(&m_GlobalInverseTransform.m[0][0], Header.GlobalInverseTransform, sizeof(Header.GlobalInverseTransform));
+
+		CalcMeshBounds();
+
+		BuildTriangleBVH(
+			(const ogl::BVH::NodeLayout*)(pFile + Header.BVHNodesOffset),
+			Header.NumBVHNodes,
+			(const uint*)(pFile + Header.BVHItemsOffset),
+			Header.NumBVHItems);
+
+		PrepareUpload();
+
+		printf("Loaded '%s' from the mesh cache\n", Filename.c_str());
+
+		return true;
+	}
+
+	static bool
+	IsInsideIndexRange(uint BaseIndex, uint NumIndices, const BasicMeshEntry& Mesh)
+	{
+		return (BaseIndex >= Mesh.BaseIndex) && ((u64)BaseIndex + NumIndices <= (u64)Mesh.BaseIndex + Mesh.NumIndices);
+	}
+
+	// Everything is checked before the mesh is touched so that a bad cache falls back to the import
+	bool
+	IsMeshCacheValid(const u8* pFile, size_t FileSize, u64 SourceSize, u64 SourceHash) const
+	{
+		if (FileSize < sizeof(ogl::MeshCacheHeader))
+		{
+			return false;
+		}
+
+		const ogl::MeshCacheHeader& Header = *(const ogl::MeshCacheHeader*)pFile;
+
+		if ((memcmp(Header.Magic, ogl::MESH_CACHE_MAGIC, sizeof(Header.Magic)) != 0) ||
+			(Header.Version != MESH_CACHE_VERSION) || (Header.VertexSize != sizeof(Vertex)) ||
+			(Header.ImportFlags != ASSIMP_LOAD_FLAGS) || (Header.Options != GetMeshCacheOptions()) ||
+			(Header.FileSize != FileSize) || (Header.SourceSize != SourceSize) || (Header.SourceHash != SourceHash))
+		{
+			return false;
+		}
+
+		if (!ogl::IsMeshCacheRangeValid(Header, Header.MeshesOffset, (u64)Header.NumMeshes * sizeof(BasicMeshEntry)) ||
+			!ogl::IsMeshCacheRangeValid(
+				Header,
+				Header.BVHNodesOffset,
+				(u64)Header.NumBVHNodes * sizeof(ogl::BVH::NodeLayout)) ||
+			!ogl::IsMeshCacheRangeValid(Header, Header.BVHItemsOffset, (u64)Header.NumBVHItems * sizeof(uint)) ||
+			!ogl::IsMeshCacheRangeValid(Header, Header.AABBsOffset, (u64)Header.NumMeshes * sizeof(AABB)) ||
+			!ogl::IsMeshCacheRangeValid(Header, Header.SpheresOffset, (u64)Header.NumMeshes * sizeof(BoundingSphere)) ||
+			!ogl::IsMeshCacheRangeValid(Header, Header.VerticesOffset, (u64)Header.NumVertices * sizeof(Vertex)) ||
+			!ogl::IsMeshCacheRangeValid(Header, Header.IndicesOffset, (u64)Header.NumIndices * sizeof(uint)) ||
+			!ogl::IsMeshCacheRangeValid(Header, Header.LODsOffset, (u64)Header.NumLODs * sizeof(MeshLOD)) ||
+			!ogl::IsMeshCacheRangeValid(Header, Header.MeshletsOffset, (u64)Header.NumMeshlets * sizeof(Meshlet)) ||
+			!ogl::IsMeshCacheRangeValid(
+				Header,
+				Header.MaterialsOffset,
+				(u64)Header.NumMaterials * sizeof(ogl::MeshCacheMaterial)))
+		{
+			return false;
+		}
+
+		const BasicMeshEntry* pMeshes = (const BasicMeshEntry*)(pFile + Header.MeshesOffset);
+
+		for (uint i = 0; i < Header.NumMeshes; i++)
+		{
+			if (((u64)pMeshes[i].BaseIndex + pMeshes[i].NumIndices > Header.NumIndices) ||
+				(pMeshes[i].BaseVertex > Header.NumVertices) || (pMeshes[i].MaterialIndex >= Header.NumMaterials) ||
+				(pMeshes[i].NumLODs == 0) || ((u64)pMeshes[i].FirstLOD + pMeshes[i].NumLODs > Header.NumLODs) ||
+				((u64)pMeshes[i].FirstMeshlet + pMeshes[i].NumMeshlets > Header.NumMeshlets))
+			{
+				return false;
+			}
+		}
+
+		const MeshLOD* pLODs = (const MeshLOD*)(pFile + Header.LODsOffset);
+
+		for (uint i = 0; i < Header.NumLODs; i++)
+		{
+			if ((u64)pLODs[i].BaseIndex + pLODs[i].NumIndices > Header.NumIndices)
+			{
+				return false;
+			}
+		}
+
+		const Meshlet* pMeshlets = (const Meshlet*)(pFile + Header.MeshletsOffset);
+
+		for (uint i = 0; i < Header.NumMeshlets; i++)
+		{
+			if ((u64)pMeshlets[i].BaseIndex + pMeshlets[i].NumIndices > Header.NumIndices)
+			{
+				return false;
+			}
+		}
+
+		// The indices are relative to BaseVertex, a LOD or meshlet range inside the full detail one is already checked
+		const uint* pIndices = (const uint*)(pFile + Header.IndicesOffset);
+
+		for (uint i = 0; i < Header.NumMeshes; i++)
+		{
+			const BasicMeshEntry& Mesh = pMeshes[i];
+
+			if (!ogl::AreMeshCacheIndicesValid(
+					pIndices,
+					Mesh.BaseIndex,
+					Mesh.NumIndices,
+					Mesh.BaseVertex,
+					Header.NumVertices))
+			{
+				return false;
+			}
+
+			for (uint j = Mesh.FirstLOD; j < Mesh.FirstLOD + Mesh.NumLODs; j++)
+			{
+				if (!IsInsideIndexRange(pLODs[j].BaseIndex, pLODs[j].NumIndices, Mesh) &&
+					!ogl::AreMeshCacheIndicesValid(
+						pIndices,
+						pLODs[j].BaseIndex,
+						pLODs[j].NumIndices,
+						Mesh.BaseVertex,
+						Header.NumVertices))
+				{
+					return false;
+				}
+			}
+
+			for (uint j = Mesh.FirstMeshlet; j < Mesh.FirstMeshlet + Mesh.NumMeshlets; j++)
+			{
+				if (!IsInsideIndexRange(pMeshlets[j].BaseIndex, pMeshlets[j].NumIndices, Mesh) &&
+					!ogl::AreMeshCacheIndicesValid(
+						pIndices,
+						pMeshlets[j].BaseIndex,
+						pMeshlets[j].NumIndices,
+						Mesh.BaseVertex,
+						Header.NumVertices))
+				{
+					return false;
+				}
+			}
+		}
+
+		const ogl::MeshCacheMaterial* pMaterials = (const ogl::MeshCacheMaterial*)(pFile + Header.MaterialsOffset);
+
+		for (uint i = 0; i < Header.NumMaterials; i++)
+		{
+			if (!ogl::IsMeshCacheRangeValid(Header, pMaterials[i].Diffuse.Offset, pMaterials[i].Diffuse.Size) ||
+				!ogl::IsMeshCacheRangeValid(
+					Header,
+					pMaterials[i].SpecularExponent.Offset,
+					pMaterials[i].SpecularExponent.Size))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Returns false if a texture file can't be loaded, pTexture is then NULL
+	bool
+	LoadCachedTexture(const u8* pFile, const ogl::MeshCacheTexture& CacheTexture, Texture*& pTexture)
+	{
+		pTexture = NULL;
+
+		if (CacheTexture.Type == ogl::MESH_CACHE_TEXTURE_FILE)
+		{
+			std::string Path((const char*)(pFile + CacheTexture.Offset), CacheTexture.Size);
+			pTexture = new Texture(GL_TEXTURE_2D, Path);
+
+			if (!pTexture->Decode())
+			{
+				printf("Error loading texture '%s'\n", Path.c_str());
+				delete pTexture;
+				pTexture = NULL;
+				return false;
+			}
+		}
+		else if (CacheTexture.Type == ogl::MESH_CACHE_TEXTURE_EMBEDDED)
+		{
+			pTexture = new Texture(GL_TEXTURE_2D);
+			pTexture->Decode(CacheTexture.Size, pFile + CacheTexture.Offset);
+		}
+
+		return true;
+	}
+
+	//
+	// Called right after the import, while the Assimp scene (and the embedded
+	// textures in it) still exists. The header is written last so a file that
+	// wasn't completely written never passes IsMeshCacheValid().
+	//
+	void
+	WriteMeshCache(const std::string& Filename, u64 SourceSize, u64 SourceHash)
+	{
+		std::string CacheFilename = ogl::GetMeshCacheFilename(Filename);
+
+		FILE* f = fopen(CacheFilename.c_str(), "wb");
+
+		if (!f)
+		{
+			printf("Can't write the mesh cache '%s'\n", CacheFilename.c_str());
+			return;
+		}
+
+		ogl::MeshCacheHeader Header;
+		memset(&Header, 0, sizeof(Header));
+		memcpy(Header.Magic, ogl::MESH_CACHE_MAGIC, sizeof(Header.Magic));
+		Header.Version = MESH_CACHE_VERSION;
+		Header.VertexSize = sizeof(Vertex);
+		Header.ImportFlags = ASSIMP_LOAD_FLAGS;
+		Header.Options = GetMeshCacheOptions();
+		Header.NumMeshes = (u32)m_Meshes.size();
+		Header.NumMaterials = (u32)m_Materials.size();
+		Header.NumVertices = (u32)m_Vertices.size();
+		Header.NumIndices = (u32)m_Indices.size();
+		Header.NumLODs = (u32)m_LODs.size();
+		Header.NumMeshlets = (u32)m_Meshlets.size();
+		Header.SourceSize = SourceSize;
+		Header.SourceHash = SourceHash;
+		memcpy(Header.GlobalInverseTransform, &m_GlobalInverseTransform.m[0][0], sizeof(Header.GlobalInverseTransform));
+
+		// Lay out the sections
+		u64 Offset = sizeof(Header);
+
+		auto Allocate = [&Offset](u64 Size) {
+			u64 SectionOffset = ogl::AlignMeshCacheOffset(Offset);
+			Offset = SectionOffset + Size;
+			return SectionOffset;
+		};
+
+		Header.MeshesOffset = Allocate(sizeof(BasicMeshEntry) * m_Meshes.size());
+		Header.AABBsOffset = Allocate(sizeof(AABB) * m_SubMeshAABBs.size());
+		Header.SpheresOffset = Allocate(sizeof(BoundingSphere) * m_SubMeshSpheres.size());
+		Header.VerticesOffset = Allocate(sizeof(Vertex) * m_Vertices.size());
+		Header.IndicesOffset = Allocate(sizeof(uint) * m_Indices.size());
+		Header.LODsOffset = Allocate(sizeof(MeshLOD) * m_LODs.size());
+		Header.MeshletsOffset = Allocate(sizeof(Meshlet) * m_Meshlets.size());
+		Header.MaterialsOffset = Allocate(sizeof(ogl::MeshCacheMaterial) * m_Materials.size());
+
+		std::vector<ogl::BVH::NodeLayout> BVHNodes;
+		std::vector<uint> BVHItems;
+		m_TriangleBVH.GetLayout(BVHNodes, BVHItems);
+		Header.NumBVHNodes = (u32)BVHNodes.size();
+		Header.NumBVHItems = (u32)BVHItems.size();
+		Header.BVHNodesOffset = Allocate(sizeof(ogl::BVH::NodeLayout) * BVHNodes.size());
+		Header.BVHItemsOffset = Allocate(sizeof(uint) * BVHItems.size());
+
+		std::vector<ogl::MeshCacheMaterial> Materials(m_Materials.size());
+		std::vector<const TextureSource*> TextureSources;
+		std::vector<ogl::MeshCacheTexture*> CacheTextures;
+
+		for (uint i = 0; i < m_Materials.size(); i++)
+		{
+			Materials[i].AmbientColor = m_Materials[i].AmbientColor;
+			Materials[i].DiffuseColor = m_Materials[i].DiffuseColor;
+			Materials[i].SpecularColor = m_Materials[i].SpecularColor;
+
+			TextureSources.push_back(&m_MaterialSources[i].Diffuse);
+			CacheTextures.push_back(&Materials[i].Diffuse);
+			TextureSources.push_back(&m_MaterialSources[i].SpecularExponent);
+			CacheTextures.push_back(&Materials[i].SpecularExponent);
+		}
+
+		for (uint i = 0; i < TextureSources.size(); i++)
+		{
+			const TextureSource& Source = *TextureSources[i];
+			ogl::MeshCacheTexture& CacheTexture = *CacheTextures[i];
+
+			if (Source.pEmbedded)
+			{
+				CacheTexture.Type = ogl::MESH_CACHE_TEXTURE_EMBEDDED;
+				CacheTexture.Size = Source.EmbeddedSize;
+			}
+			else if (!Source.Path.empty())
+			{
+				CacheTexture.Type = ogl::MESH_CACHE_TEXTURE_FILE;
+				CacheTexture.Size = (u32)Source.Path.size();
+			}
+
+			CacheTexture.Offset = Allocate(CacheTexture.Size);
+		}
+
+		Header.FileSize = Offset;
+
+		// The header area is zero filled by the padding of the first section, the real one is written last
+		u64 Pos = 0;
+		bool IsOK = true;
+
+		auto Write = [&](u64 SectionOffset, const void* pData, u64 Size) {
+			static const u8 Zeros[MESH_CACHE_ALIGNMENT] = {0};
+
+			while (IsOK && (Pos < SectionOffset))
+			{
+				u64 PadSize = std::min(SectionOffset - Pos, (u64)sizeof(Zeros));
+				IsOK = fwrite(Zeros, 1, PadSize, f) == PadSize;
+				Pos += PadSize;
+			}
+
+			if (IsOK && (Size > 0))
+			{
+				IsOK = fwrite(pData, 1, Size, f) == Size;
+				Pos += Size;
+			}
+		};
+
+		Write(Header.MeshesOffset, m_Meshes.data(), sizeof(BasicMeshEntry) * m_Meshes.size());
+		Write(Header.AABBsOffset, m_SubMeshAABBs.data(), sizeof(AABB) * m_SubMeshAABBs.size());
+		Write(Header.SpheresOffset, m_SubMeshSpheres.data(), sizeof(BoundingSphere) * m_SubMeshSpheres.size());
+		Write(Header.VerticesOffset, m_Vertices.data(), sizeof(Vertex) * m_Vertices.size());
+		Write(Header.IndicesOffset, m_Indices.data(), sizeof(uint) * m_Indices.size());
+		Write(Header.LODsOffset, m_LODs.data(), sizeof(MeshLOD) * m_LODs.size());
+		Write(Header.MeshletsOffset, m_Meshlets.data(), sizeof(Meshlet) * m_Meshlets.size());
+		Write(Header.MaterialsOffset, Materials.data(), sizeof(ogl::MeshCacheMaterial) * Materials.size());
+		Write(Header.BVHNodesOffset, BVHNodes.data(), sizeof(ogl::BVH::NodeLayout) * BVHNodes.size());
+		Write(Header.BVHItemsOffset, BVHItems.data(), sizeof(uint) * BVHItems.size());
+
+		for (uint i = 0; i < TextureSources.size(); i++)
+		{
+			const TextureSource& Source = *TextureSources[i];
+			const void* pData = Source.pEmbedded ? Source.pEmbedded : Source.Path.data();
+			Write(CacheTextures[i]->Offset, pData, CacheTextures[i]->Size);
+		}
+
+		if (IsOK)
+		{
+			IsOK = (fseek(f, 0, SEEK_SET) == 0) && (fwrite(&Header, 1, sizeof(Header), f) == sizeof(Header));
+		}
+
+		IsOK = (fclose(f) == 0) && IsOK;
+
+		if (IsOK)
+		{
+			printf("Wrote the mesh cache '%s'\n", CacheFilename.c_str());
+		}
+		else
+		{
+			printf("Error writing the mesh cache '%s'\n", CacheFilename.c_str());
+			remove(CacheFilename.c_str());
+		}
+	}
+
+	// Hash of the load options that change the output of the import
+	u32
+	GetMeshCacheOptions() const
+	{
+		if (!m_LoadOptions.IsOptimizerEnabled())
+		{
+			return 0;
+		}
+
+		const MeshLoadOptions& o = m_LoadOptions;
+		u8 Flags[5] = {
+			o.RemoveDuplicateVertices,
+			o.OptimizeVertexCache,
+			o.OptimizeOverdraw,
+			o.OptimizeVertexFetch,
+			o.BuildMeshlets};
+		u64 Hash = ogl::HashMemory(Flags, sizeof(Flags));
+		Hash ^= ogl::HashMemory(&o.OverdrawThreshold, sizeof(o.OverdrawThreshold));
+		Hash ^= ogl::HashMemory(o.LODErrors.data(), sizeof(float) * o.LODErrors.size()) * 31;
+
+		// Zero is reserved for "no optimizer"
+		return (u32)(Hash ^ (Hash >> 32)) | 1;
+	}
+
+	void
+	CountVerticesAndIndices(const aiScene* pScene, uint& NumVertices, uint& NumIndices)
+	{
+		for (unsigned int i = 0; i < m_Meshes.size(); i++)
+		{
+			m_Meshes[i].MaterialIndex = pScene->mMeshes[i]->mMaterialIndex;
+			m_Meshes[i].NumIndices = pScene->mMeshes[i]->mNumFaces * 3;
+			m_Meshes[i].BaseVertex = NumVertices;
+			m_Meshes[i].BaseIndex = NumIndices;
+
+			NumVertices += pScene->mMeshes[i]->mNumVertices;
+			NumIndices += m_Meshes[i].NumIndices;
+		}
+	}
+
+	//
+	// The submeshes are independent so they are imported in parallel when there
+	// is a thread pool. Without the optimizer every submesh writes straight into
+	// its own range of the vertex and index arrays. The optimizer changes the
+	// sizes (and adds the LODs) so its output is kept per submesh and concatenated
+	// at the end, using the prefix sum of the sizes as the new base vertex/index.
+	//
+	void
+	InitAllMeshes(const aiScene* pScene)
+	{
+		m_LODs.clear();
+		m_Meshlets.clear();
+
+		if (!m_LoadOptions.IsOptimizerEnabled())
+		{
+			ForEachSubMesh(pScene, [&](uint i) { InitSingleMesh(i, pScene->mMeshes[i]); });
+
+			for (uint i = 0; i < m_Meshes.size(); i++)
+			{
+				m_Meshes[i].FirstLOD = i;
+				m_Meshes[i].NumLODs = 1;
+				m_Meshes[i].FirstMeshlet = 0;
+				m_Meshes[i].NumMeshlets = 0;
+				m_LODs.push_back({m_Meshes[i].BaseIndex, m_Meshes[i].NumIndices, 0.0f});
+			}
+
+			return;
+		}
+
+		std::vector<OptimizedSubMesh> SubMeshes(m_Meshes.size());
+
+		ForEachSubMesh(pScene, [&](uint i) { InitSingleMeshOpt(i, pScene->mMeshes[i], SubMeshes[i]); });
+
+		uint NumVertices = 0;
+		uint NumIndices = 0;
+
+		for (uint i = 0; i < m_Meshes.size(); i++)
+		{
+			const OptimizedSubMesh& SubMesh = SubMeshes[i];
+
+			m_Meshes[i].BaseVertex = NumVertices;
+			m_Meshes[i].BaseIndex = NumIndices;
+			m_Meshes[i].NumIndices = SubMesh.LODs[0].NumIndices;
+			m_Meshes[i].FirstLOD = (uint)m_LODs.size();
+			m_Meshes[i].NumLODs = (uint)SubMesh.LODs.size();
+			m_Meshes[i].FirstMeshlet = (uint)m_Meshlets.size();
+			m_Meshes[i].NumMeshlets = (uint)SubMesh.Meshlets.size();
+
+			for (const MeshLOD& LOD : SubMesh.LODs)
+			{
+				m_LODs.push_back({NumIndices + LOD.BaseIndex, LOD.NumIndices, LOD.Error});
+			}
+
+			for (Meshlet m : SubMesh.Meshlets)
+			{
+				m.BaseIndex += NumIndices;
+				m_Meshlets.push_back(m);
+			}
+
+			NumVertices += (uint)SubMesh.Vertices.size();
+			NumIndices += (uint)SubMesh.Indices.size();
+		}
+
+		m_Vertices.resize(NumVertices);
+		m_Indices.resize(NumIndices);
+
+		ForEachSubMesh(pScene, [&](uint i) {
+			const OptimizedSubMesh& SubMesh = SubMeshes[i];
+			std::copy(SubMesh.Vertices.begin(), SubMesh.Vertices.end(), m_Vertices.begin() + m_Meshes[i].BaseVertex);
+			std::copy(SubMesh.Indices.begin(), SubMesh.Indices.end(), m_Indices.begin() + m_Meshes[i].BaseIndex);
+		});
+	}
+
+	// Calls Func(MeshIndex) for every submesh, on the thread pool if there is one
+	template <typename Func>
+	void
+	ForEachSubMesh(const aiScene* pScene, Func&& f)
+	{
+		ogl::ThreadPool* pThreadPool = m_LoadOptions.pThreadPool;
+
+		if (!pThreadPool)
+		{
+			for (uint i = 0; i < m_Meshes.size(); i++)
+			{
+				f(i);
+			}
+
+			return;
+		}
+
+		// Largest first so that a big submesh doesn't start last and keep one thread busy alone
+		std::vector<uint> Order(m_Meshes.size());
+
+		for (uint i = 0; i < Order.size(); i++)
+		{
+			Order[i] = i;
+		}
+
+		std::sort(Order.begin(), Order.end(), [pScene](uint a, uint b) {
+			return pScene->mMeshes[a]->mNumVertices + pScene->mMeshes[a]->mNumFaces >
+				   pScene->mMeshes[b]->mNumVertices + pScene->mMeshes[b]->mNumFaces;
+		});
+
+		pThreadPool->ParallelFor((uint)Order.size(), [&](uint i) { f(Order[i]); });
+	}
+
+	void
+	CalcSubMeshBounds(uint MeshIndex, const Vertex* pVertices, uint NumVertices)
+	{
+		AABB aabb;
+
+		for (uint i = 0; i < NumVertices; i++)
+		{
+			aabb.Add(pVertices[i].Position);
+		}
+
+		// Centered on the box but sized by the actual vertices, which is usually
+		// tighter than half the diagonal
+		BoundingSphere Sphere;
+		Sphere.Center = aabb.GetCenter();
+		float MaxDistSq = 0.0f;
+
+		for (uint i = 0; i < NumVertices; i++)
+		{
+			Vector3f d = pVertices[i].Position - Sphere.Center;
+			MaxDistSq = fmax(MaxDistSq, d.x * d.x + d.y * d.y + d.z * d.z);
+		}
+
+		Sphere.Radius = sqrtf(MaxDistSq);
+
+		m_SubMeshAABBs[MeshIndex] = aabb;
+		m_SubMeshSpheres[MeshIndex] = Sphere;
+	}
+
+	void
+	CalcMeshBounds()
+	{
+		m_AABB = AABB();
+
+		for (const AABB& aabb : m_SubMeshAABBs)
+		{
+			m_AABB.Add(aabb);
+		}
+
+		m_BoundingSphere.Center = m_AABB.GetCenter();
+		m_BoundingSphere.Radius = 0.0f;
+
+		for (const BoundingSphere& Sphere : m_SubMeshSpheres)
+		{
+			float Dist = (Sphere.Center - m_BoundingSphere.Center).Length() + Sphere.Radius;
+			m_BoundingSphere.Radius = fmax(m_BoundingSphere.Radius, Dist);
+		}
+	}
+
+	//
+	// For CPU ray picking. Uses the final index buffer, i.e. after the (optional) mesh optimizer.
+	// The tree can be restored from a layout (see BVH::GetLayout()) instead of being built.
+	//
+	void
+	BuildTriangleBVH(
+		const ogl::BVH::NodeLayout* pLayoutNodes = NULL,
+		uint NumLayoutNodes = 0,
+		const uint* pLayoutItems = NULL,
+		uint NumLayoutItems = 0)
+	{
+		m_Triangles.clear();
+
+		for (uint i = 0; i < m_Meshes.size(); i++)
+		{
+			for (uint j = 0; j < m_Meshes[i].NumIndices / 3; j++)
+			{
+				m_Triangles.push_back({i, j});
+			}
+		}
+
+		std::vector<AABB> Boxes(m_Triangles.size());
+
+		for (uint i = 0; i < m_Triangles.size(); i++)
+		{
+			Vector3f v0, v1, v2;
+			GetTrianglePositions(m_Triangles[i].DrawIndex, m_Triangles[i].PrimID, v0, v1, v2);
+			Boxes[i].Add(v0);
+			Boxes[i].Add(v1);
+			Boxes[i].Add(v2);
+		}
+
+		if (!pLayoutNodes || (NumLayoutItems != Boxes.size()) ||
+			!m_TriangleBVH.Build(Boxes.data(), (uint)Boxes.size(), pLayoutNodes, NumLayoutNodes, pLayoutItems))
+		{
+			m_TriangleBVH.Build(Boxes.data(), (uint)Boxes.size());
+		}
+	}
+
+	//
+	// Fills m_SubMeshVisible. Returns false if the whole mesh is outside the
+	// frustum, pIsInside (if given) receives true if it is completely inside.
+	//
+	bool
+	CullSubMeshes(const FrustumCulling& LocalFrustum, CullingCache* pCullingCache, bool* pIsInside = NULL)
+	{
+		CullingCache TempCache;
+		uint Mask = 0;
+
+		if (!LocalFrustum.IsAABBInsideViewFrustum(m_AABB, pCullingCache ? *pCullingCache : TempCache, 0, &Mask))
+		{
+			return false;
+		}
+
+		m_SubMeshVisible.resize(m_Meshes.size());
+
+		if (Mask == FrustumCulling::ALL_PLANES_MASK)
+		{
+			std::fill(m_SubMeshVisible.begin(), m_SubMeshVisible.end(), 1);
+		}
+		else
+		{
+			LocalFrustum.CullAABBs(m_SubMeshAABBs.data(), (uint)m_SubMeshAABBs.size(), m_SubMeshVisible.data());
+		}
+
+		if (pIsInside)
+		{
+			*pIsInside = (Mask == FrustumCulling::ALL_PLANES_MASK);
+		}
+
+		return true;
+	}
+
+	//
+	// Appends the index ranges of the visible meshlets of a submesh to
+	// m_MeshletDraws, merging the meshlets that are next to each other in the
+	// index buffer. The frustum test is skipped when the mesh is known to be
+	// inside. A meshlet faces away when the camera is outside the cone, built
+	// around its bounding sphere, from which any of its triangles can be seen.
+	//
+	void
+	CullMeshlets(uint MeshIndex, const FrustumCulling& LocalFrustum, const Vector3f& CameraLocalPos, bool IsInside)
+	{
+		const BasicMeshEntry& Mesh = m_Meshes[MeshIndex];
+		uint RangeBegin = 0;
+		uint RangeEnd = 0;
+
+		m_MeshletStats.NumMeshlets += Mesh.NumMeshlets;
+
+		for (uint i = Mesh.FirstMeshlet; i < Mesh.FirstMeshlet + Mesh.NumMeshlets; i++)
+		{
+			const Meshlet& m = m_Meshlets[i];
+
+			if (!IsInside && !LocalFrustum.IsSphereInsideViewFrustum(m.Center, m.Radius))
+			{
+				m_MeshletStats.NumFrustumCulled++;
+				continue;
+			}
+
+			Vector3f ToCenter = m.Center - CameraLocalPos;
+
+			if (ToCenter.Dot(m.ConeAxis) >= m.ConeCutoff * ToCenter.Length() + m.Radius)
+			{
+				m_MeshletStats.NumConeCulled++;
+				continue;
+			}
+
+			if ((RangeEnd != RangeBegin) && (m.BaseIndex == RangeEnd))
+			{
+				RangeEnd += m.NumIndices;
+				continue;
+			}
+
+			AddMeshletDraw(MeshIndex, RangeBegin, RangeEnd);
+			RangeBegin = m.BaseIndex;
+			RangeEnd = m.BaseIndex + m.NumIndices;
+		}
+
+		AddMeshletDraw(MeshIndex, RangeBegin, RangeEnd);
+	}
+
+	void
+	AddMeshletDraw(uint MeshIndex, uint BeginIndex, uint EndIndex)
+	{
+		if (BeginIndex == EndIndex)
+		{
+			return;
+		}
 
-		uint LeadingIndex = Face.mIndices[0];
+		m_MeshletDraws.Counts.push_back((GLsizei)(EndIndex - BeginIndex));
+		m_MeshletDraws.Offsets.push_back(GetIndexBufferOffset(MeshIndex, BeginIndex));
+		m_MeshletDraws.BaseVertices.push_back((GLint)m_Meshes[MeshIndex].BaseVertex);
 
-		assert(LeadingIndex < paiMesh->mNumVertices);
-		const aiVector3D& Pos = paiMesh->mVertices[LeadingIndex];
-		Vertex.x = Pos.x;
-		Vertex.y = Pos.y;
-		Vertex.z = Pos.z;
+		m_MeshletStats.NumTriangles += (EndIndex - BeginIndex) / 3;
+		m_MeshletStats.NumDraws++;
 	}
 
-protected:
+	// Negative PixelsPerUnit draws the full detail LOD
 	void
-	Clear()
+	RenderCulled(
+		const FrustumCulling& LocalFrustum,
+		IRenderCallbacks* pRenderCallbacks,
+		CullingCache* pCullingCache,
+		float PixelsPerUnit,
+		float MaxPixelError)
 	{
-		if (m_Buffers[0] != 0)
+		if (!CullSubMeshes(LocalFrustum, pCullingCache))
 		{
-			glDeleteBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+			return;
 		}
 
-		if (m_VAO != 0)
+		glBindVertexArray(m_VAO);
+
+		for (unsigned int i = 0; i < m_Meshes.size(); i++)
 		{
-			glDeleteVertexArrays(1, &m_VAO);
-			m_VAO = 0;
+			if (m_SubMeshVisible[i])
+			{
+				uint LOD = (PixelsPerUnit < 0.0f) ? 0 : SelectLOD(i, PixelsPerUnit, MaxPixelError);
+				DrawSubMesh(i, pRenderCallbacks, 0, LOD);
+			}
 		}
-	}
 
-	virtual void
-	ReserveSpace(uint NumVertices, uint NumIndices)
-	{
-		m_Vertices.reserve(NumVertices);
-		m_Indices.reserve(NumIndices);
+		// Make sure the VAO is not changed from the outside
+		glBindVertexArray(0);
 	}
 
-	virtual void
-	InitSingleMesh(uint MeshIndex, const aiMesh* paiMesh)
+	void
+	UpdateHighlightBuffer(TriangleHighlight& Highlight)
 	{
-		const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
+		if (Highlight.m_buffer == 0)
+		{
+			glGenBuffers(1, &Highlight.m_buffer);
+		}
 
-		// printf("Mesh %d\n", MeshIndex);
-		// Populate the vertex attribute vectors
-		Vertex v;
+		glBindBuffer(GL_COPY_WRITE_BUFFER, Highlight.m_buffer);
 
-		for (unsigned int i = 0; i < paiMesh->mNumVertices; i++)
+		if (Highlight.m_isLayoutDirty)
 		{
-			const aiVector3D& pPos = paiMesh->mVertices[i];
-			// printf("%d: ", i); Vector3f v(pPos.x, pPos.y, pPos.z); v.Print();
-			v.Position = Vector3f(pPos.x, pPos.y, pPos.z);
+			// Twice the current size so that the ranges don't have to move on every Add()
+			uint NumTriangles = 0;
 
-			if (paiMesh->mNormals)
-			{
-				const aiVector3D& pNormal = paiMesh->mNormals[i];
-				v.Normal = Vector3f(pNormal.x, pNormal.y, pNormal.z);
-			}
-			else
+			for (TriangleHighlight::SubMesh& Sub : Highlight.m_subMeshes)
 			{
-				aiVector3D Normal(0.0f, 1.0f, 0.0f);
-				v.Normal = Vector3f(Normal.x, Normal.y, Normal.z);
+				Sub.Offset = NumTriangles;
+				Sub.Capacity = Sub.Prims.empty() ? 0 : std::min(std::max((uint)Sub.Prims.size() * 2, 64u), Sub.NumTriangles);
+				Sub.DirtyBegin = 0;
+				Sub.DirtyEnd = (uint)Sub.Prims.size();
+				NumTriangles += Sub.Capacity;
 			}
 
-			const aiVector3D& pTexCoord = paiMesh->HasTextureCoords(0) ? paiMesh->mTextureCoords[0][i] : Zero3D;
-			v.TexCoords = Vector2f(pTexCoord.x, pTexCoord.y);
-
-			m_Vertices.push_back(v);
+			glBufferData(GL_COPY_WRITE_BUFFER, sizeof(uint) * 3 * NumTriangles, NULL, GL_DYNAMIC_DRAW);
+			Highlight.m_isLayoutDirty = false;
 		}
 
-		// Populate the index buffer
-		for (unsigned int i = 0; i < paiMesh->mNumFaces; i++)
+		for (uint i = 0; i < m_Meshes.size(); i++)
 		{
-			const aiFace& Face = paiMesh->mFaces[i];
-			m_Indices.push_back(Face.mIndices[0]);
-			m_Indices.push_back(Face.mIndices[1]);
-			m_Indices.push_back(Face.mIndices[2]);
+			TriangleHighlight::SubMesh& Sub = Highlight.m_subMeshes[i];
+			uint End = std::min(Sub.DirtyEnd, (uint)Sub.Prims.size());
+
+			if (Sub.DirtyBegin < End)
+			{
+				Highlight.m_uploadIndices.resize((End - Sub.DirtyBegin) * 3);
+				uint* pDst = Highlight.m_uploadIndices.data();
+
+				for (uint j = Sub.DirtyBegin; j < End; j++)
+				{
+					const uint* pSrc = &m_Indices[m_Meshes[i].BaseIndex + Sub.Prims[j] * 3];
+					*pDst++ = pSrc[0];
+					*pDst++ = pSrc[1];
+					*pDst++ = pSrc[2];
+				}
+
+				glBufferSubData(
+					GL_COPY_WRITE_BUFFER,
+					sizeof(uint) * 3 * (Sub.Offset + Sub.DirtyBegin),
+					sizeof(uint) * Highlight.m_uploadIndices.size(),
+					Highlight.m_uploadIndices.data());
+			}
+
+			Sub.DirtyBegin = UINT_MAX;
+			Sub.DirtyEnd = 0;
 		}
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 	}
 
-	virtual void
-	InitSingleMeshOpt(uint MeshIndex, const aiMesh* paiMesh)
+	// Binds the textures of the submesh and calls the callbacks for it
+	void
+	SetupSubMeshMaterial(uint i, IRenderCallbacks* pRenderCallbacks)
 	{
-		const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
+		unsigned int MaterialIndex = m_Meshes[i].MaterialIndex;
+		assert(MaterialIndex < m_Materials.size());
 
-		// printf("Mesh %d\n", MeshIndex);
-		// Populate the vertex attribute vectors
-		Vertex v;
+		if (pRenderCallbacks)
+		{
+			pRenderCallbacks->DrawStartCB(i);
+		}
 
-		std::vector<Vertex> Vertices(paiMesh->mNumVertices);
+		if (m_Materials[MaterialIndex].pDiffuse)
+		{
+			m_Materials[MaterialIndex].pDiffuse->Bind(COLOR_TEXTURE_UNIT);
+		}
 
-		for (unsigned int i = 0; i < paiMesh->mNumVertices; i++)
+		if (m_Materials[MaterialIndex].pSpecularExponent)
 		{
-			const aiVector3D& pPos = paiMesh->mVertices[i];
-			// printf("%d: ", i); Vector3f v(pPos.x, pPos.y, pPos.z); v.Print();
-			v.Position = Vector3f(pPos.x, pPos.y, pPos.z);
+			m_Materials[MaterialIndex].pSpecularExponent->Bind(SPECULAR_EXPONENT_UNIT);
 
-			if (paiMesh->mNormals)
+			if (pRenderCallbacks)
 			{
-				const aiVector3D& pNormal = paiMesh->mNormals[i];
-				v.Normal = Vector3f(pNormal.x, pNormal.y, pNormal.z);
+				pRenderCallbacks->ControlSpecularExponent(true);
 			}
-			else
+		}
+		else
+		{
+			if (pRenderCallbacks)
 			{
-				aiVector3D Normal(0.0f, 1.0f, 0.0f);
-				v.Normal = Vector3f(Normal.x, Normal.y, Normal.z);
+				pRenderCallbacks->ControlSpecularExponent(false);
 			}
-
-			const aiVector3D& pTexCoord = paiMesh->HasTextureCoords(0) ? paiMesh->mTextureCoords[0][i] : Zero3D;
-			v.TexCoords = Vector2f(pTexCoord.x, pTexCoord.y);
-
-			Vertices[i] = v;
 		}
 
-		m_Meshes[MeshIndex].BaseVertex = (uint)m_Vertices.size();
-		m_Meshes[MeshIndex].BaseIndex = (uint)m_Indices.size();
-
-		int NumIndices = paiMesh->mNumFaces * 3;
-
-		std::vector<uint> Indices;
-		Indices.resize(NumIndices);
-
-		// Populate the index buffer
-		for (unsigned int i = 0; i < paiMesh->mNumFaces; i++)
+		if (pRenderCallbacks)
 		{
-			const aiFace& Face = paiMesh->mFaces[i];
-			Indices[i * 3 + 0] = Face.mIndices[0];
-			Indices[i * 3 + 1] = Face.mIndices[1];
-			Indices[i * 3 + 2] = Face.mIndices[2];
+			if (m_Materials[MaterialIndex].pDiffuse)
+			{
+				pRenderCallbacks->SetMaterial(m_Materials[MaterialIndex]);
+			}
+			else
+			{
+				pRenderCallbacks->DisableDiffuseTexture();
+			}
 		}
-
-		OptimizeMesh(MeshIndex, Indices, Vertices);
 	}
 
-	virtual void
-	PopulateBuffers();
-	virtual void
-	PopulateBuffersNonDSA()
+	// NumInstances zero is a regular (non instanced) draw
+	void
+	DrawSubMesh(uint i, IRenderCallbacks* pRenderCallbacks, uint NumInstances = 0, uint LOD = 0)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[VERTEX_BUFFER]);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
-
-		glBufferData(GL_ARRAY_BUFFER, sizeof(m_Vertices[0]) * m_Vertices.size(), &m_Vertices[0], GL_STATIC_DRAW);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(m_Indices[0]) * m_Indices.size(), &m_Indices[0], GL_STATIC_DRAW);
-
-		size_t NumFloats = 0;
+		assert(LOD < m_Meshes[i].NumLODs);
+		const MeshLOD& Range = m_LODs[m_Meshes[i].FirstLOD + LOD];
 
-		glEnableVertexAttribArray(POSITION_LOCATION);
-		glVertexAttribPointer(
-			POSITION_LOCATION,
-			3,
-			GL_FLOAT,
-			GL_FALSE,
-			sizeof(Vertex),
-			(const void*)(NumFloats * sizeof(float)));
-		NumFloats += 3;
-
-		glEnableVertexAttribArray(TEX_COORD_LOCATION);
-		glVertexAttribPointer(
-			TEX_COORD_LOCATION,
-			2,
-			GL_FLOAT,
-			GL_FALSE,
-			sizeof(Vertex),
-			(const void*)(NumFloats * sizeof(float)));
-		NumFloats += 2;
+		SetupSubMeshMaterial(i, pRenderCallbacks);
 
-		glEnableVertexAttribArray(NORMAL_LOCATION);
-		glVertexAttribPointer(
-			NORMAL_LOCATION,
-			3,
-			GL_FLOAT,
-			GL_FALSE,
-			sizeof(Vertex),
-			(const void*)(NumFloats * sizeof(float)));
+		if (NumInstances == 0)
+		{
+			glDrawElementsBaseVertex(
+				GL_TRIANGLES,
+				Range.NumIndices,
+				m_Meshes[i].IndexType,
+				GetIndexBufferOffset(i, Range.BaseIndex),
+				m_Meshes[i].BaseVertex);
+		}
+		else
+		{
+			glDrawElementsInstancedBaseVertex(
+				GL_TRIANGLES,
+				Range.NumIndices,
+				m_Meshes[i].IndexType,
+				GetIndexBufferOffset(i, Range.BaseIndex),
+				NumInstances,
+				m_Meshes[i].BaseVertex);
+		}
 	}
-	virtual void
-	PopulateBuffersDSA()
+
+	// Replaces the arrays of a submesh with their optimized version
+	void
+	OptimizeMesh(std::vector<uint>& Indices, std::vector<Vertex>& Vertices)
 	{
-		glNamedBufferStorage(m_Buffers[VERTEX_BUFFER], sizeof(m_Vertices[0]) * m_Vertices.size(), m_Vertices.data(), 0);
-		glNamedBufferStorage(m_Buffers[INDEX_BUFFER], sizeof(m_Indices[0]) * m_Indices.size(), m_Indices.data(), 0);
+		size_t NumIndices = Indices.size();
 
-		glVertexArrayVertexBuffer(m_VAO, 0, m_Buffers[VERTEX_BUFFER], 0, sizeof(Vertex));
-		glVertexArrayElementBuffer(m_VAO, m_Buffers[INDEX_BUFFER]);
+		if (m_LoadOptions.RemoveDuplicateVertices)
+		{
+			// Create a remap table
+			std::vector<unsigned int> remap(Vertices.size());
+			size_t OptVertexCount = meshopt_generateVertexRemap(
+				remap.data(),	  // dst addr
+				Indices.data(),	  // src indices
+				NumIndices,		  // ...and size
+				Vertices.data(),  // src vertices
+				Vertices.size(),  // ...and size
+				sizeof(Vertex)); // stride
 
-		size_t NumFloats = 0;
+			std::vector<uint> OptIndices(NumIndices);
+			std::vector<Vertex> OptVertices(OptVertexCount);
 
-		glEnableVertexArrayAttrib(m_VAO, POSITION_LOCATION);
-		glVertexArrayAttribFormat(m_VAO, POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, (GLuint)(NumFloats * sizeof(float)));
-		glVertexArrayAttribBinding(m_VAO, POSITION_LOCATION, 0);
-		NumFloats += 3;
+			meshopt_remapIndexBuffer(OptIndices.data(), Indices.data(), NumIndices, remap.data());
 
-		glEnableVertexArrayAttrib(m_VAO, TEX_COORD_LOCATION);
-		glVertexArrayAttribFormat(
-			m_VAO,
-			TEX_COORD_LOCATION,
-			2,
-			GL_FLOAT,
-			GL_FALSE,
-			(GLuint)(NumFloats * sizeof(float)));
-		glVertexArrayAttribBinding(m_VAO, TEX_COORD_LOCATION, 0);
-		NumFloats += 2;
+			meshopt_remapVertexBuffer(OptVertices.data(), Vertices.data(), Vertices.size(), sizeof(Vertex), remap.data());
 
-		glEnableVertexArrayAttrib(m_VAO, NORMAL_LOCATION);
-		glVertexArrayAttribFormat(m_VAO, NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, (GLuint)(NumFloats * sizeof(float)));
-		glVertexArrayAttribBinding(m_VAO, NORMAL_LOCATION, 0);
-	}
+			Indices.swap(OptIndices);
+			Vertices.swap(OptVertices);
+		}
 
-	struct BasicMeshEntry
-	{
-		BasicMeshEntry()
+		if (Vertices.empty())
 		{
-			NumIndices = 0;
-			BaseVertex = 0;
-			BaseIndex = 0;
-			MaterialIndex = INVALID_MATERIAL;
+			return;
 		}
 
-		uint NumIndices;
-		uint BaseVertex;
-		uint BaseIndex;
-		uint MaterialIndex;
-	};
-
-	std::vector<BasicMeshEntry> m_Meshes;
-
-	const aiScene* m_pScene;
+		// Improve the locality of the vertices
+		if (m_LoadOptions.OptimizeVertexCache)
+		{
+			meshopt_optimizeVertexCache(Indices.data(), Indices.data(), NumIndices, Vertices.size());
+		}
 
-	Matrix4f m_GlobalInverseTransform;
+		// Reduce pixel overdraw
+		if (m_LoadOptions.OptimizeOverdraw)
+		{
+			meshopt_optimizeOverdraw(
+				Indices.data(),
+				Indices.data(),
+				NumIndices,
+				&Vertices[0].Position.x,
+				Vertices.size(),
+				sizeof(Vertex),
+				m_LoadOptions.OverdrawThreshold);
+		}
 
-	vector<uint> m_Indices;
+		// Optimize access to the vertex buffer
+		if (m_LoadOptions.OptimizeVertexFetch)
+		{
+			size_t NumUsedVertices = meshopt_optimizeVertexFetch(
+				Vertices.data(),
+				Indices.data(),
+				NumIndices,
+				Vertices.data(),
+				Vertices.size(),
+				sizeof(Vertex));
+
+			Vertices.resize(NumUsedVertices);
+		}
+	}
 
-	enum BUFFER_TYPE
+	//
+	// Splits the triangles of a submesh into meshlets and reorders the indices so
+	// that every meshlet is a consecutive range of them.
+	//
+	void
+	BuildMeshlets(const std::vector<Vertex>& Vertices, std::vector<uint>& Indices, std::vector<Meshlet>& Meshlets)
 	{
-		INDEX_BUFFER = 0,
-		VERTEX_BUFFER = 1,
-		WVP_MAT_BUFFER = 2,	  // required only for instancing
-		WORLD_MAT_BUFFER = 3, // required only for instancing
-		NUM_BUFFERS = 4
-	};
-
-	GLuint m_VAO = 0;
+		size_t NumIndices = Indices.size();
 
-	GLuint m_Buffers[NUM_BUFFERS] = {0};
+		if (NumIndices == 0)
+		{
+			return;
+		}
 
-private:
-	bool
-	InitFromScene(const aiScene* pScene, const std::string& Filename)
-	{
-		m_Meshes.resize(pScene->mNumMeshes);
-		m_Materials.resize(pScene->mNumMaterials);
+		size_t MaxMeshlets = meshopt_buildMeshletsBound(NumIndices, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES);
+		std::vector<meshopt_Meshlet> OptMeshlets(MaxMeshlets);
+		std::vector<uint> MeshletVertices(MaxMeshlets * MESHLET_MAX_VERTICES);
+		std::vector<u8> MeshletTriangles(MaxMeshlets * MESHLET_MAX_TRIANGLES * 3);
 
-		unsigned int NumVertices = 0;
-		unsigned int NumIndices = 0;
+		const float* pPositions = &Vertices[0].Position.x;
 
-		CountVerticesAndIndices(pScene, NumVertices, NumIndices);
+		size_t NumMeshlets = meshopt_buildMeshlets(
+			OptMeshlets.data(),
+			MeshletVertices.data(),
+			MeshletTriangles.data(),
+			Indices.data(),
+			NumIndices,
+			pPositions,
+			Vertices.size(),
+			sizeof(Vertex),
+			MESHLET_MAX_VERTICES,
+			MESHLET_MAX_TRIANGLES,
+			MESHLET_CONE_WEIGHT);
 
-		ReserveSpace(NumVertices, NumIndices);
+		Meshlets.resize(NumMeshlets);
 
-		InitAllMeshes(pScene);
+		uint NumMeshletIndices = 0;
 
-		if (!InitMaterials(pScene, Filename))
+		for (size_t i = 0; i < NumMeshlets; i++)
 		{
-			return false;
+			const meshopt_Meshlet& m = OptMeshlets[i];
+			const uint* pMeshletVertices = &MeshletVertices[m.vertex_offset];
+			const u8* pMeshletTriangles = &MeshletTriangles[m.triangle_offset];
+
+			meshopt_Bounds Bounds = meshopt_computeMeshletBounds(
+				pMeshletVertices,
+				pMeshletTriangles,
+				m.triangle_count,
+				pPositions,
+				Vertices.size(),
+				sizeof(Vertex));
+
+			Meshlets[i].BaseIndex = NumMeshletIndices;
+			Meshlets[i].NumIndices = m.triangle_count * 3;
+			Meshlets[i].Center = Vector3f(Bounds.center);
+			Meshlets[i].Radius = Bounds.radius;
+			Meshlets[i].ConeAxis = Vector3f(Bounds.cone_axis);
+			Meshlets[i].ConeCutoff = Bounds.cone_cutoff;
+
+			// Back to indices into the submesh vertices
+			for (uint j = 0; j < m.triangle_count * 3; j++)
+			{
+				Indices[NumMeshletIndices++] = pMeshletVertices[pMeshletTriangles[j]];
+			}
 		}
 
-		PopulateBuffers();
-
-		return GLCheckError();
+		Indices.resize(NumMeshletIndices);
 	}
 
+	//
+	// Appends the LODs of a submesh (see MeshLoadOptions::LODErrors) to its
+	// index buffer. They all use the same vertices. Every LOD is simplified from
+	// the full detail version so that its error is measured from it.
+	//
 	void
-	CountVerticesAndIndices(const aiScene* pScene, uint& NumVertices, uint& NumIndices)
+	GenerateLODs(const std::vector<Vertex>& Vertices, std::vector<uint>& Indices, std::vector<MeshLOD>& LODs)
 	{
-		for (unsigned int i = 0; i < m_Meshes.size(); i++)
-		{
-			m_Meshes[i].MaterialIndex = pScene->mMeshes[i]->mMaterialIndex;
-			m_Meshes[i].NumIndices = pScene->mMeshes[i]->mNumFaces * 3;
-			m_Meshes[i].BaseVertex = NumVertices;
-			m_Meshes[i].BaseIndex = NumIndices;
+		size_t NumIndices = Indices.size();
 
-			NumVertices += pScene->mMeshes[i]->mNumVertices;
-			NumIndices += m_Meshes[i].NumIndices;
-		}
-	}
+		LODs.push_back({0, (uint)NumIndices, 0.0f});
 
-	void
-	InitAllMeshes(const aiScene* pScene)
-	{
-		for (unsigned int i = 0; i < m_Meshes.size(); i++)
+		if (m_LoadOptions.LODErrors.empty() || (NumIndices == 0))
 		{
-			const aiMesh* paiMesh = pScene->mMeshes[i];
-#ifdef USE_MESH_OPTIMIZER
-			InitSingleMeshOpt(i, paiMesh);
-#else
-			InitSingleMesh(i, paiMesh);
-#endif
+			return;
 		}
-	}
 
-	void
-	OptimizeMesh(int MeshIndex, std::vector<uint>& Indices, std::vector<Vertex>& Vertices)
-	{
-		size_t NumIndices = Indices.size();
-		size_t NumVertices = Vertices.size();
-
-		// Create a remap table
-		std::vector<unsigned int> remap(NumIndices);
-		size_t OptVertexCount = meshopt_generateVertexRemap(
-			remap.data(),	 // dst addr
-			Indices.data(),	 // src indices
-			NumIndices,		 // ...and size
-			Vertices.data(), // src vertices
-			NumVertices,	 // ...and size
-			sizeof(Vertex)); // stride
-		// Allocate a local index/vertex arrays
-		std::vector<uint> OptIndices;
-		std::vector<Vertex> OptVertices;
-		OptIndices.resize(NumIndices);
-		OptVertices.resize(OptVertexCount);
-
-		// Optimization #1: remove duplicate vertices
-		meshopt_remapIndexBuffer(OptIndices.data(), Indices.data(), NumIndices, remap.data());
-
-		meshopt_remapVertexBuffer(OptVertices.data(), Vertices.data(), NumVertices, sizeof(Vertex), remap.data());
-
-		// Optimization #2: improve the locality of the vertices
-		meshopt_optimizeVertexCache(OptIndices.data(), OptIndices.data(), NumIndices, OptVertexCount);
-
-		// Optimization #3: reduce pixel overdraw
-		meshopt_optimizeOverdraw(
-			OptIndices.data(),
-			OptIndices.data(),
-			NumIndices,
-			&(OptVertices[0].Position.x),
-			OptVertexCount,
-			sizeof(Vertex),
-			1.05f);
+		const float* pPositions = &Vertices[0].Position.x;
 
-		// Optimization #4: optimize access to the vertex buffer
-		meshopt_optimizeVertexFetch(
-			OptVertices.data(),
-			OptIndices.data(),
-			NumIndices,
-			OptVertices.data(),
-			OptVertexCount,
-			sizeof(Vertex));
-
-		// Optimization #5: create a simplified version of the model
-		float Threshold = 1.0f;
-		size_t TargetIndexCount = (size_t)(NumIndices * Threshold);
-
-		float TargetError = 0.0f;
-		std::vector<unsigned int> SimplifiedIndices(OptIndices.size());
-		size_t OptIndexCount = meshopt_simplify(
-			SimplifiedIndices.data(),
-			OptIndices.data(),
-			NumIndices,
-			&OptVertices[0].Position.x,
-			OptVertexCount,
-			sizeof(Vertex),
-			TargetIndexCount,
-			TargetError);
+		// meshopt_simplify() reports the error relative to this
+		float Scale = meshopt_simplifyScale(pPositions, Vertices.size(), sizeof(Vertex));
 
-		static int num_indices = 0;
-		num_indices += (int)NumIndices;
-		static int opt_indices = 0;
-		opt_indices += (int)OptIndexCount;
-		printf("Num indices %d\n", num_indices);
-		// printf("Target num indices %d\n", TargetIndexCount);
-		printf("Optimized number of indices %d\n", opt_indices);
-		SimplifiedIndices.resize(OptIndexCount);
+		std::vector<uint> LODIndices(NumIndices);
 
-		// Concatenate the local arrays into the class attributes arrays
-		m_Indices.insert(m_Indices.end(), SimplifiedIndices.begin(), SimplifiedIndices.end());
+		for (float TargetError : m_LoadOptions.LODErrors)
+		{
+			// No target index count, the error alone decides how far it goes
+			float Error = 0.0f;
+			size_t NumLODIndices = meshopt_simplify(
+				LODIndices.data(),
+				Indices.data(),
+				NumIndices,
+				pPositions,
+				Vertices.size(),
+				sizeof(Vertex),
+				0,
+				TargetError,
+				0,
+				&Error);
+
+			if (NumLODIndices >= LODs.back().NumIndices)
+			{
+				continue;
+			}
 
-		m_Vertices.insert(m_Vertices.end(), OptVertices.begin(), OptVertices.end());
+			if (m_LoadOptions.OptimizeVertexCache)
+			{
+				meshopt_optimizeVertexCache(LODIndices.data(), LODIndices.data(), NumLODIndices, Vertices.size());
+			}
 
-		m_Meshes[MeshIndex].NumIndices = (uint)OptIndexCount;
+			LODs.push_back({(uint)Indices.size(), (uint)NumLODIndices, Error * Scale});
+			Indices.insert(Indices.end(), LODIndices.begin(), LODIndices.begin() + NumLODIndices);
+		}
 	}
 
 	bool
@@ -631,12 +2667,19 @@ private:
 
 		printf("Num materials: %d\n", pScene->mNumMaterials);
 
+		m_MaterialSources.clear();
+		m_MaterialSources.resize(pScene->mNumMaterials);
+
 		// Initialize the materials
 		for (unsigned int i = 0; i < pScene->mNumMaterials; i++)
 		{
 			const aiMaterial* pMaterial = pScene->mMaterials[i];
 
-			LoadTextures(Dir, pMaterial, i);
+			if (!LoadTextures(Dir, pMaterial, i))
+			{
+				Ret = false;
+				break;
+			}
 
 			LoadColors(pMaterial, i);
 		}
@@ -644,14 +2687,14 @@ private:
 		return Ret;
 	}
 
-	void
+	// Returns false if a texture file can't be loaded
+	bool
 	LoadTextures(const string& Dir, const aiMaterial* pMaterial, int index)
 	{
-		LoadDiffuseTexture(Dir, pMaterial, index);
-		LoadSpecularTexture(Dir, pMaterial, index);
+		return LoadDiffuseTexture(Dir, pMaterial, index) && LoadSpecularTexture(Dir, pMaterial, index);
 	}
 
-	void
+	bool
 	LoadDiffuseTexture(const string& Dir, const aiMaterial* pMaterial, int MaterialIndex)
 	{
 		m_Materials[MaterialIndex].pDiffuse = NULL;
@@ -670,10 +2713,12 @@ private:
 				}
 				else
 				{
-					LoadDiffuseTextureFromFile(Dir, Path, MaterialIndex);
+					return LoadDiffuseTextureFromFile(Dir, Path, MaterialIndex);
 				}
 			}
 		}
+
+		return true;
 	}
 
 	void
@@ -682,9 +2727,12 @@ private:
 		printf("Embeddeded diffuse texture type '%s'\n", paiTexture->achFormatHint);
 		m_Materials[MaterialIndex].pDiffuse = new Texture(GL_TEXTURE_2D);
 		int buffer_size = paiTexture->mWidth;
-		m_Materials[MaterialIndex].pDiffuse->Load(buffer_size, paiTexture->pcData);
+		m_Materials[MaterialIndex].pDiffuse->Decode(buffer_size, paiTexture->pcData);
+
+		m_MaterialSources[MaterialIndex].Diffuse.pEmbedded = paiTexture->pcData;
+		m_MaterialSources[MaterialIndex].Diffuse.EmbeddedSize = buffer_size;
 	}
-	void
+	bool
 	LoadDiffuseTextureFromFile(const string& dir, const aiString& Path, int MaterialIndex)
 	{
 		string p(Path.data);
@@ -706,18 +2754,24 @@ private:
 
 		m_Materials[MaterialIndex].pDiffuse = new Texture(GL_TEXTURE_2D, FullPath.c_str());
 
-		if (!m_Materials[MaterialIndex].pDiffuse->Load())
+		if (!m_Materials[MaterialIndex].pDiffuse->Decode())
 		{
 			printf("Error loading diffuse texture '%s'\n", FullPath.c_str());
-			exit(0);
+			delete m_Materials[MaterialIndex].pDiffuse;
+			m_Materials[MaterialIndex].pDiffuse = NULL;
+			return false;
 		}
 		else
 		{
 			printf("Loaded diffuse texture '%s' at index %d\n", FullPath.c_str(), MaterialIndex);
 		}
+
+		m_MaterialSources[MaterialIndex].Diffuse.Path = FullPath;
+
+		return true;
 	}
 
-	void
+	bool
 	LoadSpecularTexture(const string& Dir, const aiMaterial* pMaterial, int MaterialIndex)
 	{
 		m_Materials[MaterialIndex].pSpecularExponent = NULL;
@@ -736,10 +2790,12 @@ private:
 				}
 				else
 				{
-					LoadSpecularTextureFromFile(Dir, Path, MaterialIndex);
+					return LoadSpecularTextureFromFile(Dir, Path, MaterialIndex);
 				}
 			}
 		}
+
+		return true;
 	}
 	void
 	LoadSpecularTextureEmbedded(const aiTexture* paiTexture, int MaterialIndex)
@@ -747,9 +2803,12 @@ private:
 		printf("Embeddeded specular texture type '%s'\n", paiTexture->achFormatHint);
 		m_Materials[MaterialIndex].pSpecularExponent = new Texture(GL_TEXTURE_2D);
 		int buffer_size = paiTexture->mWidth;
-		m_Materials[MaterialIndex].pSpecularExponent->Load(buffer_size, paiTexture->pcData);
+		m_Materials[MaterialIndex].pSpecularExponent->Decode(buffer_size, paiTexture->pcData);
+
+		m_MaterialSources[MaterialIndex].SpecularExponent.pEmbedded = paiTexture->pcData;
+		m_MaterialSources[MaterialIndex].SpecularExponent.EmbeddedSize = buffer_size;
 	}
-	void
+	bool
 	LoadSpecularTextureFromFile(const string& dir, const aiString& Path, int MaterialIndex)
 	{
 		string p(Path.data);
@@ -767,15 +2826,21 @@ private:
 
 		m_Materials[MaterialIndex].pSpecularExponent = new Texture(GL_TEXTURE_2D, FullPath.c_str());
 
-		if (!m_Materials[MaterialIndex].pSpecularExponent->Load())
+		if (!m_Materials[MaterialIndex].pSpecularExponent->Decode())
 		{
 			printf("Error loading specular texture '%s'\n", FullPath.c_str());
-			exit(0);
+			delete m_Materials[MaterialIndex].pSpecularExponent;
+			m_Materials[MaterialIndex].pSpecularExponent = NULL;
+			return false;
 		}
 		else
 		{
 			printf("Loaded specular texture '%s'\n", FullPath.c_str());
 		}
+
+		m_MaterialSources[MaterialIndex].SpecularExponent.Path = FullPath;
+
+		return true;
 	}
 
 	void
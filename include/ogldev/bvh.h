@@ -0,0 +1,830 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+#include <vector>
+
+#include <ogldev/AABB.h>
+#include <ogldev/frustum.h>
+#include <ogldev/ray.h>
+#include <ogldev/types.h>
+
+namespace ogl
+{
+	//
+	// Bounding volume hierarchy over a set of boxes (e.g. the world space bounds
+	// of the instances in a scene, or the triangles of a mesh).
+	//
+	// The items are identified by their index in the array passed to Build(). The
+	// tree is built top down with a binned SAH. Moving items are handled by
+	// Refit(), which recomputes the node boxes bottom up and applies local tree
+	// rotations where they reduce the surface area. When the SAH cost drifts too far from the
+	// cost right after the build, Update() rebuilds the tree from scratch.
+	//
+	// Queries are read-only, except that QueryFrustum keeps the per-node plane
+	// caches of FrustumCulling, so a single BVH must not be frustum-queried from
+	// several threads at once.
+	//
+	class BVH
+	{
+	public:
+		static constexpr uint INVALID_ITEM = 0xFFFFFFFF;
+
+		BVH() {}
+
+		void
+		SetMaxLeafSize(uint MaxLeafSize)
+		{
+			m_maxLeafSize = MaxLeafSize;
+		}
+
+		// Update() rebuilds when the cost grows beyond the cost after the build times this
+		void
+		SetRebuildThreshold(float Threshold)
+		{
+			m_rebuildThreshold = Threshold;
+		}
+
+		void
+		Build(const AABB* pBoxes, uint NumItems)
+		{
+			m_nodes.clear();
+			m_items.resize(NumItems);
+			m_itemBoxes.resize(NumItems);
+			m_itemCullCache.assign(NumItems, CullingCache());
+
+			if (NumItems == 0)
+			{
+				m_cost = m_buildCost = 0.0f;
+				m_nodeCullCache.clear();
+				return;
+			}
+
+			// The items are partitioned together with their boxes so that every level
+			// of the build reads them sequentially
+			std::vector<BuildItem> Items(NumItems);
+
+			for (uint i = 0; i < NumItems; i++)
+			{
+				Items[i].Box = pBoxes[i];
+				Items[i].Centroid = pBoxes[i].GetCenter();
+				Items[i].Id = i;
+			}
+
+			m_nodes.reserve(2 * NumItems);
+			m_nodes.push_back(Node());
+
+			struct BuildTask
+			{
+				uint NodeIndex;
+				uint First;
+				uint Count;
+			};
+
+			std::vector<BuildTask> Stack;
+			Stack.push_back({0, 0, NumItems});
+
+			while (!Stack.empty())
+			{
+				BuildTask Task = Stack.back();
+				Stack.pop_back();
+
+				uint Mid = SplitItems(Items, Task.First, Task.Count);
+
+				Node& n = m_nodes[Task.NodeIndex];
+
+				if (Mid == INVALID_ITEM)
+				{
+					n.Left = Task.First;
+					n.NumItems = Task.Count;
+					continue;
+				}
+
+				uint Left = (uint)m_nodes.size();
+				n.Left = Left;
+				n.Right = Left + 1;
+				n.NumItems = 0;
+
+				m_nodes.push_back(Node());
+				m_nodes.push_back(Node());
+
+				Stack.push_back({Left + 1, Mid, Task.First + Task.Count - Mid});
+				Stack.push_back({Left, Task.First, Mid - Task.First});
+			}
+
+			for (uint i = 0; i < NumItems; i++)
+			{
+				m_items[i] = Items[i].Id;
+			}
+
+			m_nodeCullCache.assign(m_nodes.size(), CullingCache());
+
+			Refit(pBoxes, false);
+			m_buildCost = m_cost;
+		}
+
+		// Shape of a node without its box, see GetLayout()
+		struct NodeLayout
+		{
+			uint Left;	   // first item for a leaf
+			uint Right;
+			uint NumItems; // zero for internal nodes
+		};
+
+		//
+		// The tree without the boxes, which are cheap to recompute. Passing it to the
+		// Build() below restores the same tree (e.g. from a file) in linear time
+		// instead of running the SAH build again.
+		//
+		void
+		GetLayout(std::vector<NodeLayout>& Nodes, std::vector<uint>& Items) const
+		{
+			Nodes.resize(m_nodes.size());
+
+			for (uint i = 0; i < (uint)m_nodes.size(); i++)
+			{
+				Nodes[i].Left = m_nodes[i].Left;
+				Nodes[i].Right = m_nodes[i].Right;
+				Nodes[i].NumItems = m_nodes[i].NumItems;
+			}
+
+			Items = m_items;
+		}
+
+		//
+		// Returns false (and leaves the tree empty) if the layout is not a tree over
+		// NumItems items. The boxes are the same as for the regular Build().
+		//
+		bool
+		Build(const AABB* pBoxes, uint NumItems, const NodeLayout* pNodes, uint NumNodes, const uint* pItems)
+		{
+			m_nodes.clear();
+			m_items.clear();
+			m_itemBoxes.clear();
+			m_nodeCullCache.clear();
+			m_itemCullCache.clear();
+			m_cost = m_buildCost = 0.0f;
+
+			if ((NumItems == 0) || (NumNodes == 0))
+			{
+				return (NumItems == 0) && (NumNodes == 0);
+			}
+
+			// Every node except the root must have exactly one parent, which also
+			// guarantees that the traversals from the root terminate
+			std::vector<u8> HasParent(NumNodes, 0);
+
+			for (uint i = 0; i < NumNodes; i++)
+			{
+				const NodeLayout& n = pNodes[i];
+
+				if (n.NumItems > 0)
+				{
+					if ((n.Left > NumItems) || (n.NumItems > NumItems - n.Left))
+					{
+						return false;
+					}
+				}
+				else
+				{
+					if ((n.Left == 0) || (n.Left >= NumNodes) || (n.Right == 0) || (n.Right >= NumNodes) ||
+						HasParent[n.Left] || HasParent[n.Right] || (n.Left == n.Right))
+					{
+						return false;
+					}
+
+					HasParent[n.Left] = 1;
+					HasParent[n.Right] = 1;
+				}
+			}
+
+			for (uint i = 0; i < NumItems; i++)
+			{
+				if (pItems[i] >= NumItems)
+				{
+					return false;
+				}
+			}
+
+			m_nodes.resize(NumNodes);
+
+			for (uint i = 0; i < NumNodes; i++)
+			{
+				m_nodes[i].Left = pNodes[i].Left;
+				m_nodes[i].Right = pNodes[i].Right;
+				m_nodes[i].NumItems = pNodes[i].NumItems;
+			}
+
+			m_items.assign(pItems, pItems + NumItems);
+			m_itemBoxes.resize(NumItems);
+			m_itemCullCache.assign(NumItems, CullingCache());
+			m_nodeCullCache.assign(NumNodes, CullingCache());
+
+			Refit(pBoxes, false);
+			m_buildCost = m_cost;
+
+			return true;
+		}
+
+		//
+		// The items keep their indices but their boxes changed. The node boxes are
+		// recomputed bottom up and (optionally) tree rotations that reduce the
+		// surface area of a child are applied on the way.
+		//
+		void
+		Refit(const AABB* pBoxes, bool Rotate = true)
+		{
+			for (uint i = 0; i < (uint)m_items.size(); i++)
+			{
+				m_itemBoxes[i] = pBoxes[m_items[i]];
+			}
+
+			if (m_nodes.empty())
+			{
+				return;
+			}
+
+			// Post order traversal, rotations can move a child in front of its parent
+			// in the node array so the index order can't be used
+			std::vector<uint> Stack;
+			Stack.push_back(0);
+
+			while (!Stack.empty())
+			{
+				uint NodeIndex = Stack.back();
+				Node& n = m_nodes[NodeIndex];
+
+				if (n.IsLeaf())
+				{
+					n.Box = AABB();
+
+					for (uint i = 0; i < n.NumItems; i++)
+					{
+						n.Box.Add(m_itemBoxes[n.Left + i]);
+					}
+
+					Stack.pop_back();
+				}
+				else if (!n.IsVisited)
+				{
+					n.IsVisited = true;
+					Stack.push_back(n.Right);
+					Stack.push_back(n.Left);
+				}
+				else
+				{
+					n.IsVisited = false;
+
+					if (Rotate)
+					{
+						RotateNode(NodeIndex);
+					}
+
+					n.Box = m_nodes[n.Left].Box;
+					n.Box.Add(m_nodes[n.Right].Box);
+					Stack.pop_back();
+				}
+			}
+
+			m_cost = CalcCost();
+		}
+
+		//
+		// Refits the tree for the new boxes, or rebuilds it when the number of items
+		// changed or the quality of the tree degraded. Returns true if it was rebuilt.
+		//
+		bool
+		Update(const AABB* pBoxes, uint NumItems)
+		{
+			if (NumItems != GetNumItems() || m_nodes.empty())
+			{
+				Build(pBoxes, NumItems);
+				return true;
+			}
+
+			Refit(pBoxes);
+
+			if (NeedsRebuild())
+			{
+				Build(pBoxes, NumItems);
+				return true;
+			}
+
+			return false;
+		}
+
+		bool
+		NeedsRebuild() const
+		{
+			return m_cost > m_buildCost * m_rebuildThreshold;
+		}
+
+		// SAH cost of the tree relative to the root surface area
+		float
+		GetCost() const
+		{
+			return m_cost;
+		}
+
+		uint
+		GetNumItems() const
+		{
+			return (uint)m_items.size();
+		}
+
+		uint
+		GetNumNodes() const
+		{
+			return (uint)m_nodes.size();
+		}
+
+		const AABB&
+		GetBounds() const
+		{
+			static const AABB Empty;
+			return m_nodes.empty() ? Empty : m_nodes[0].Box;
+		}
+
+		//
+		// Appends the items whose box is (at least partially) inside the frustum.
+		// Subtrees that are fully inside are appended without testing their items.
+		//
+		void
+		QueryFrustum(const FrustumCulling& Frustum, std::vector<uint>& Items) const
+		{
+			if (m_nodes.empty())
+			{
+				return;
+			}
+
+			struct Entry
+			{
+				uint NodeIndex;
+				uint Mask;
+			};
+
+			std::vector<Entry> Stack;
+			Stack.push_back({0, 0});
+
+			while (!Stack.empty())
+			{
+				Entry e = Stack.back();
+				Stack.pop_back();
+
+				const Node& n = m_nodes[e.NodeIndex];
+				uint Mask = e.Mask;
+
+				if (!Frustum.IsAABBInsideViewFrustum(n.Box, m_nodeCullCache[e.NodeIndex], e.Mask, &Mask))
+				{
+					continue;
+				}
+
+				if (Mask == FrustumCulling::ALL_PLANES_MASK)
+				{
+					AppendSubtree(e.NodeIndex, Items);
+				}
+				else if (n.IsLeaf())
+				{
+					for (uint i = n.Left; i < n.Left + n.NumItems; i++)
+					{
+						if (Frustum.IsAABBInsideViewFrustum(m_itemBoxes[i], m_itemCullCache[i], Mask))
+						{
+							Items.push_back(m_items[i]);
+						}
+					}
+				}
+				else
+				{
+					Stack.push_back({n.Right, Mask});
+					Stack.push_back({n.Left, Mask});
+				}
+			}
+		}
+
+		// Appends the items whose box overlaps the given box
+		void
+		QueryAABB(const AABB& Box, std::vector<uint>& Items) const
+		{
+			if (m_nodes.empty())
+			{
+				return;
+			}
+
+			std::vector<uint> Stack;
+			Stack.push_back(0);
+
+			while (!Stack.empty())
+			{
+				const Node& n = m_nodes[Stack.back()];
+				Stack.pop_back();
+
+				if (!n.Box.Intersects(Box))
+				{
+					continue;
+				}
+
+				if (n.IsLeaf())
+				{
+					for (uint i = n.Left; i < n.Left + n.NumItems; i++)
+					{
+						if (m_itemBoxes[i].Intersects(Box))
+						{
+							Items.push_back(m_items[i]);
+						}
+					}
+				}
+				else
+				{
+					Stack.push_back(n.Right);
+					Stack.push_back(n.Left);
+				}
+			}
+		}
+
+		//
+		// Walks the nodes hit by the ray front to back and calls
+		//     bool OnItem(uint Item, float tBoxEntry, float& tMax)
+		// for every item whose box is hit before tMax (tBoxEntry is where the ray
+		// enters the box of the item). The callback does the exact
+		// test, returns true on a hit and shrinks tMax to the hit distance so that
+		// the rest of the traversal is culled against it (closest hit). Returns
+		// true if any callback reported a hit.
+		//
+		template <typename Func>
+		bool
+		QueryRay(const Ray& r, float& tMax, Func OnItem) const
+		{
+			if (m_nodes.empty())
+			{
+				return false;
+			}
+
+			struct Entry
+			{
+				uint NodeIndex;
+				float tEntry;
+			};
+
+			std::vector<Entry> Stack;
+
+			float tEntry;
+
+			if (!RayIntersectsAABB(r, m_nodes[0].Box, tMax, tEntry))
+			{
+				return false;
+			}
+
+			Stack.push_back({0, tEntry});
+			bool Hit = false;
+
+			while (!Stack.empty())
+			{
+				Entry e = Stack.back();
+				Stack.pop_back();
+
+				// tMax may have shrunk since the node was pushed
+				if (e.tEntry > tMax)
+				{
+					continue;
+				}
+
+				const Node& n = m_nodes[e.NodeIndex];
+
+				if (n.IsLeaf())
+				{
+					for (uint i = n.Left; i < n.Left + n.NumItems; i++)
+					{
+						if (RayIntersectsAABB(r, m_itemBoxes[i], tMax, tEntry))
+						{
+							Hit |= OnItem(m_items[i], tEntry, tMax);
+						}
+					}
+
+					continue;
+				}
+
+				float tLeft, tRight;
+				bool HitLeft = RayIntersectsAABB(r, m_nodes[n.Left].Box, tMax, tLeft);
+				bool HitRight = RayIntersectsAABB(r, m_nodes[n.Right].Box, tMax, tRight);
+
+				// Push the far child first so that the near one is processed next
+				if (HitLeft && HitRight)
+				{
+					if (tLeft <= tRight)
+					{
+						Stack.push_back({n.Right, tRight});
+						Stack.push_back({n.Left, tLeft});
+					}
+					else
+					{
+						Stack.push_back({n.Left, tLeft});
+						Stack.push_back({n.Right, tRight});
+					}
+				}
+				else if (HitLeft)
+				{
+					Stack.push_back({n.Left, tLeft});
+				}
+				else if (HitRight)
+				{
+					Stack.push_back({n.Right, tRight});
+				}
+			}
+
+			return Hit;
+		}
+
+		// Closest item whose box is hit by the ray (box level only), INVALID_ITEM if none
+		uint
+		Raycast(const Ray& r, float& tHit, float tMax = FLT_MAX) const
+		{
+			uint Closest = INVALID_ITEM;
+
+			QueryRay(r, tMax, [&](uint Item, float tBoxEntry, float& t) {
+				t = tBoxEntry;
+				Closest = Item;
+				return true;
+			});
+
+			tHit = tMax;
+
+			return Closest;
+		}
+
+	private:
+		struct Node
+		{
+			AABB Box;
+			uint Left = 0;		   // first item for a leaf
+			uint Right = 0;
+			uint NumItems = 0;	   // zero for internal nodes
+			bool IsVisited = false; // used by Refit()
+
+			bool
+			IsLeaf() const
+			{
+				return NumItems > 0;
+			}
+		};
+
+		struct BuildItem
+		{
+			AABB Box;
+			Vector3f Centroid;
+			uint Id;
+		};
+
+		//
+		// Partitions Items[First, First + Count) for a split and returns the index of
+		// the first item of the right half, or INVALID_ITEM when this should be a leaf.
+		// Binned SAH.
+		//
+		uint
+		SplitItems(std::vector<BuildItem>& Items, uint First, uint Count)
+		{
+			if (Count <= m_maxLeafSize)
+			{
+				return INVALID_ITEM;
+			}
+
+			AABB Bounds;
+			AABB CentroidBounds;
+
+			for (uint i = First; i < First + Count; i++)
+			{
+				Bounds.Add(Items[i].Box);
+				CentroidBounds.Add(Items[i].Centroid);
+			}
+
+			const int NUM_BINS = 16;
+
+			float BestCost = FLT_MAX;
+			int BestAxis = -1;
+			int BestBin = 0;
+
+			const float* pCentroidMin = &CentroidBounds.MinX;
+			const float* pCentroidMax = &CentroidBounds.MaxX;
+
+			// Only the axis along which the centroids are spread the most is binned.
+			// Binning all three axes gives a slightly better tree (~2% lower cost) but
+			// triples the build time.
+			int Axis = 0;
+
+			for (int a = 1; a < 3; a++)
+			{
+				if (pCentroidMax[a * 2] - pCentroidMin[a * 2] > pCentroidMax[Axis * 2] - pCentroidMin[Axis * 2])
+				{
+					Axis = a;
+				}
+			}
+
+			float Min = pCentroidMin[Axis * 2];
+			float Max = pCentroidMax[Axis * 2];
+
+			if (Max > Min)
+			{
+				AABB BinBoxes[NUM_BINS];
+				uint BinCounts[NUM_BINS] = {0};
+				float Scale = NUM_BINS / (Max - Min);
+
+				for (uint i = First; i < First + Count; i++)
+				{
+					int Bin = GetBin(Items[i].Centroid, Axis, Min, Scale, NUM_BINS);
+					BinCounts[Bin]++;
+					BinBoxes[Bin].Add(Items[i].Box);
+				}
+
+				// Sweep from the right to get the area/count of every right side
+				float RightArea[NUM_BINS];
+				uint RightCount[NUM_BINS];
+				AABB RightBox;
+				uint RightSum = 0;
+
+				for (int b = NUM_BINS - 1; b > 0; b--)
+				{
+					RightBox.Add(BinBoxes[b]);
+					RightSum += BinCounts[b];
+					RightArea[b] = RightBox.IsValid() ? RightBox.GetSurfaceArea() : 0.0f;
+					RightCount[b] = RightSum;
+				}
+
+				AABB LeftBox;
+				uint LeftSum = 0;
+
+				for (int b = 0; b < NUM_BINS - 1; b++)
+				{
+					LeftBox.Add(BinBoxes[b]);
+					LeftSum += BinCounts[b];
+
+					if ((LeftSum == 0) || (RightCount[b + 1] == 0))
+					{
+						continue;
+					}
+
+					float Cost = LeftBox.GetSurfaceArea() * LeftSum + RightArea[b + 1] * RightCount[b + 1];
+
+					if (Cost < BestCost)
+					{
+						BestCost = Cost;
+						BestAxis = Axis;
+						BestBin = b;
+					}
+				}
+			}
+
+			uint Mid;
+
+			if (BestAxis == -1)
+			{
+				// All the centroids are in the same spot, just cut the range in half
+				Mid = First + Count / 2;
+			}
+			else
+			{
+				// Splitting costs one more traversal step, keep small nodes as leaves if that's cheaper
+				float LeafCost = Bounds.GetSurfaceArea() * Count;
+
+				if ((BestCost + Bounds.GetSurfaceArea() >= LeafCost) && (Count <= m_maxLeafSize * 4))
+				{
+					return INVALID_ITEM;
+				}
+
+				float Scale = NUM_BINS / (Max - Min);
+
+				BuildItem* pFirst = &Items[First];
+				BuildItem* pMid = std::partition(pFirst, pFirst + Count, [&](const BuildItem& Item) {
+					return GetBin(Item.Centroid, BestAxis, Min, Scale, NUM_BINS) <= BestBin;
+				});
+
+				Mid = First + (uint)(pMid - pFirst);
+			}
+
+			return Mid;
+		}
+
+		static int
+		GetBin(const Vector3f& Centroid, int Axis, float Min, float Scale, int NumBins)
+		{
+			const float* p = &Centroid.x;
+			int Bin = (int)((p[Axis] - Min) * Scale);
+			return std::min(std::max(Bin, 0), NumBins - 1);
+		}
+
+		//
+		// Kopta et al. "Fast, Effective BVH Updates for Animated Scenes": try to swap
+		// the sibling of a child with one of the grandchildren on the other side and
+		// keep the swap that reduces the area of the changed child the most. The
+		// children of the node are already refitted.
+		//
+		void
+		RotateNode(uint NodeIndex)
+		{
+			Node& n = m_nodes[NodeIndex];
+
+			float BestGain = 0.0f;
+			int BestRotation = -1;
+
+			const Node& l = m_nodes[n.Left];
+			const Node& r = m_nodes[n.Right];
+
+			if (!l.IsLeaf())
+			{
+				float Area = l.Box.GetSurfaceArea();
+				TryRotation(Area, r.Box, m_nodes[l.Right].Box, 0, BestGain, BestRotation); // r <-> l.Left
+				TryRotation(Area, m_nodes[l.Left].Box, r.Box, 1, BestGain, BestRotation);  // r <-> l.Right
+			}
+
+			if (!r.IsLeaf())
+			{
+				float Area = r.Box.GetSurfaceArea();
+				TryRotation(Area, l.Box, m_nodes[r.Right].Box, 2, BestGain, BestRotation); // l <-> r.Left
+				TryRotation(Area, m_nodes[r.Left].Box, l.Box, 3, BestGain, BestRotation);  // l <-> r.Right
+			}
+
+			// Ignore tiny improvements, they just shuffle the tree around
+			if ((BestRotation == -1) || (BestGain < n.Box.GetSurfaceArea() * 0.01f))
+			{
+				return;
+			}
+
+			uint Child = (BestRotation < 2) ? n.Left : n.Right;
+			uint& Sibling = (BestRotation < 2) ? n.Right : n.Left;
+			Node& c = m_nodes[Child];
+			uint& Grandchild = (BestRotation & 1) ? c.Right : c.Left;
+
+			std::swap(Sibling, Grandchild);
+
+			c.Box = m_nodes[c.Left].Box;
+			c.Box.Add(m_nodes[c.Right].Box);
+		}
+
+		static void
+		TryRotation(float Area, const AABB& a, const AABB& b, int Rotation, float& BestGain, int& BestRotation)
+		{
+			AABB NewBox = a;
+			NewBox.Add(b);
+			float Gain = Area - NewBox.GetSurfaceArea();
+
+			if (Gain > BestGain)
+			{
+				BestGain = Gain;
+				BestRotation = Rotation;
+			}
+		}
+
+		float
+		CalcCost() const
+		{
+			float RootArea = m_nodes[0].Box.GetSurfaceArea();
+
+			if (RootArea <= 0.0f)
+			{
+				return 0.0f;
+			}
+
+			float Cost = 0.0f;
+
+			for (const Node& n : m_nodes)
+			{
+				Cost += n.Box.GetSurfaceArea() * (n.IsLeaf() ? (float)n.NumItems : 1.0f);
+			}
+
+			return Cost / RootArea;
+		}
+
+		void
+		AppendSubtree(uint NodeIndex, std::vector<uint>& Items) const
+		{
+			std::vector<uint> Stack;
+			Stack.push_back(NodeIndex);
+
+			while (!Stack.empty())
+			{
+				const Node& n = m_nodes[Stack.back()];
+				Stack.pop_back();
+
+				if (n.IsLeaf())
+				{
+					Items.insert(Items.end(), m_items.begin() + n.Left, m_items.begin() + n.Left + n.NumItems);
+				}
+				else
+				{
+					Stack.push_back(n.Right);
+					Stack.push_back(n.Left);
+				}
+			}
+		}
+
+		std::vector<Node> m_nodes;
+		std::vector<uint> m_items;	   // item indices in leaf order
+		std::vector<AABB> m_itemBoxes; // boxes of m_items
+		mutable std::vector<CullingCache> m_nodeCullCache;
+		mutable std::vector<CullingCache> m_itemCullCache;
+
+		uint m_maxLeafSize = 4;
+		float m_rebuildThreshold = 1.5f;
+		float m_cost = 0.0f;
+		float m_buildCost = 0.0f;
+	};
+}
@@ -2,6 +2,7 @@
 #include <GLFW/glfw3.h>
 #include <ogldev/frustum.h>
 #include <ogldev/mat4f.h>
+#include <ogldev/ray.h>
 #include <ogldev/vec3f.h>
 
 namespace ogl
@@ -69,6 +70,21 @@ namespace ogl
 			InitInternal();
 		}
 
+		// Keeps the field of view and updates the aspect ratio of a perspective camera
+		void
+		SetWindowSize(int WindowWidth, int WindowHeight)
+		{
+			m_windowWidth = WindowWidth;
+			m_windowHeight = WindowHeight;
+
+			if (m_persProjInfo.FOV > 0.0f)
+			{
+				m_persProjInfo.Width = (float)WindowWidth;
+				m_persProjInfo.Height = (float)WindowHeight;
+				m_projection.InitPersProjTransform(m_persProjInfo);
+			}
+		}
+
 		void
 		SetPosition(float x, float y, float z)
 		{
@@ -339,6 +355,27 @@ namespace ogl
 			return ViewProj;
 		}
 
+		//
+		// World space ray through the center of a pixel, with (0, 0) at the top left
+		// corner of the window. It starts on the near plane and reaches the far
+		// plane at t = 1.
+		//
+		Ray
+		GetPickRay(int x, int y) const
+		{
+			float NdcX = 2.0f * ((float)x + 0.5f) / (float)m_windowWidth - 1.0f;
+			float NdcY = 1.0f - 2.0f * ((float)y + 0.5f) / (float)m_windowHeight;
+
+			Matrix4f InvViewProj = GetViewProjMatrix().Inverse();
+			Vector4f Near = InvViewProj * Vector4f(NdcX, NdcY, -1.0f, 1.0f);
+			Vector4f Far = InvViewProj * Vector4f(NdcX, NdcY, 1.0f, 1.0f);
+
+			Vector3f NearPos = Near.to3f() / Near.w;
+			Vector3f FarPos = Far.to3f() / Far.w;
+
+			return Ray(NearPos, FarPos - NearPos);
+		}
+
 		Matrix4f
 		GetViewMatrix() const
 		{
@@ -488,7 +525,7 @@ namespace ogl
 
 		Vector2i m_mousePos;
 
-		PersProjInfo m_persProjInfo;
+		PersProjInfo m_persProjInfo = {}; // FOV stays zero for orthographic cameras
 		Matrix4f m_projection;
 	};
 } // namespace ogl
\ No newline at end of file
@@ -29,5 +29,7 @@
 #define SHADOW_MAP_RANDOM_OFFSET_TEXTURE_UNIT_INDEX 9
 #define DETAIL_MAP_TEXTURE_UNIT GL_TEXTURE10
 #define DETAIL_MAP_TEXTURE_UNIT_INDEX 10
+#define VISIBILITY_TEXTURE_UNIT GL_TEXTURE11
+#define VISIBILITY_TEXTURE_UNIT_INDEX 11
 
 #endif /* OGLDEV_ENGINE_COMMON_H */
\ No newline at end of file
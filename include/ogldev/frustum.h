@@ -3,6 +3,9 @@
 #include "ogldev/vec3f.h"
 #include <ogldev/AABB.h>
 #include <ogldev/mat4f.h>
+#include <ogldev/simd.h>
+#include <ogldev/transform_batch.h>
+#include <ogldev/types.h>
 
 class Frustum
 {
@@ -45,18 +48,15 @@ public:
 		FarBottomRight = Vector4f(FarX, -FarY, FarZ, 1.0f);
 	}
 
+	// The corners stay points with w = 1 so m must be affine, e.g. a view matrix or its inverse
 	void
 	Transform(const Matrix4f& m)
 	{
-		NearTopLeft = m * NearTopLeft;
-		NearBottomLeft = m * NearBottomLeft;
-		NearTopRight = m * NearTopRight;
-		NearBottomRight = m * NearBottomRight;
+		static_assert(
+			offsetof(Frustum, FarBottomRight) == 7 * sizeof(Vector4f),
+			"the corners are expected to be consecutive Vector4f");
 
-		FarTopLeft = m * FarTopLeft;
-		FarBottomLeft = m * FarBottomLeft;
-		FarTopRight = m * FarTopRight;
-		FarBottomRight = m * FarBottomRight;
+		ogl::TransformPoints(m, &NearTopLeft.x, sizeof(Vector4f), &NearTopLeft.x, sizeof(Vector4f), 8);
 	}
 
 	void
@@ -96,46 +96,453 @@ public:
 	}
 };
 
+//
+// Culling state that an object keeps from one frame to the next. When the
+// camera moves slowly an object that was culled last frame is most likely
+// culled by the same plane again, so that plane is tested first.
+//
+struct CullingCache
+{
+	u8 LastPlane = 0;
+};
+
+//
+// Culling against the six planes of a view (or light) frustum.
+//
+// The planes are extracted from the matrix passed to Update() so they live in
+// the space that the matrix transforms from: pass ViewProj to test world space
+// volumes or WVP to test the local space bounds of a single object. The planes
+// are normalized and point inwards, i.e. a point is inside when its signed
+// distance to all six planes is >= 0.
+//
+// The volume tests are conservative: a box or a sphere is only rejected when it
+// lies completely behind one of the planes.
+//
 class FrustumCulling
 {
 public:
+	enum
+	{
+		LEFT_PLANE = 0,
+		RIGHT_PLANE,
+		BOTTOM_PLANE,
+		TOP_PLANE,
+		NEAR_PLANE,
+		FAR_PLANE,
+		NUM_PLANES
+	};
+
+	// Plane masks have one bit per plane, set when the volume is entirely on the
+	// inner side of that plane. A volume with all bits set is fully inside.
+	enum
+	{
+		ALL_PLANES_MASK = (1 << NUM_PLANES) - 1
+	};
+
+	FrustumCulling() {}
+
 	FrustumCulling(const Matrix4f& ViewProj) { Update(ViewProj); }
 
 	void
 	Update(const Matrix4f& ViewProj)
 	{
-		ViewProj.CalcClipPlanes(
-			m_leftClipPlane,
-			m_rightClipPlane,
-			m_bottomClipPlane,
-			m_topClipPlane,
-			m_nearClipPlane,
-			m_farClipPlane);
+		Vector4f l, r, b, t, n, f;
+		ViewProj.CalcClipPlanes(l, r, b, t, n, f);
+
+		// CalcClipPlanes returns the right/top/far planes facing outwards
+		m_planes[LEFT_PLANE] = l;
+		m_planes[RIGHT_PLANE] = r * -1.0f;
+		m_planes[BOTTOM_PLANE] = b;
+		m_planes[TOP_PLANE] = t * -1.0f;
+		m_planes[NEAR_PLANE] = n;
+		m_planes[FAR_PLANE] = f * -1.0f;
+
+		for (int i = 0; i < NUM_PLANES; i++)
+		{
+			Vector4f& p = m_planes[i];
+			float Len = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+
+			if (Len > 0.0f)
+			{
+				p = p / Len;
+			}
+		}
+	}
+
+	const Vector4f&
+	GetPlane(int Plane) const
+	{
+		return m_planes[Plane];
 	}
 
 	bool
 	IsPointInsideViewFrustum(const Vector3f& p) const
 	{
-		Vector4f p4D(p, 1.0f);
+		for (int i = 0; i < NUM_PLANES; i++)
+		{
+			if (PlaneDistance(m_planes[i], p) < 0.0f)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool
+	IsSphereInsideViewFrustum(const Vector3f& Center, float Radius) const
+	{
+		for (int i = 0; i < NUM_PLANES; i++)
+		{
+			if (PlaneDistance(m_planes[i], Center) < -Radius)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool
+	IsSphereInsideViewFrustum(const BoundingSphere& Sphere) const
+	{
+		return IsSphereInsideViewFrustum(Sphere.Center, Sphere.Radius);
+	}
+
+	// Conservative like the box test: the triangle is only rejected when all its
+	// vertices are behind the same plane
+	bool
+	IsTriangleInsideViewFrustum(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2) const
+	{
+		for (int i = 0; i < NUM_PLANES; i++)
+		{
+			if ((PlaneDistance(m_planes[i], v0) < 0.0f) && (PlaneDistance(m_planes[i], v1) < 0.0f) &&
+				(PlaneDistance(m_planes[i], v2) < 0.0f))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// The box is behind a plane when its corner that is furthest along the plane
+	// normal is behind it. With the box as center +- extents that distance is
+	// dot(n, center) + d + dot(|n|, extents).
+	bool
+	IsAABBInsideViewFrustum(const AABB& aabb) const
+	{
+		Vector3f Center = aabb.GetCenter();
+		Vector3f Extents = aabb.GetExtents();
+
+		for (int i = 0; i < NUM_PLANES; i++)
+		{
+			const Vector4f& p = m_planes[i];
+			float Radius = fabsf(p.x) * Extents.x + fabsf(p.y) * Extents.y + fabsf(p.z) * Extents.z;
+
+			if (PlaneDistance(p, Center) < -Radius)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	//
+	// Coherent versions of the tests above for hierarchies and for objects that
+	// are culled every frame:
+	//   - the plane that rejected the volume last time (from Cache) is tested first
+	//     and updated when another plane rejects it
+	//   - the planes in ParentMask are known to fully contain the parent of the
+	//     volume, so they fully contain the volume too and are skipped
+	//   - on success pMask receives ParentMask plus the planes that fully contain
+	//     this volume, to be passed down as the ParentMask of its children. If it
+	//     is ALL_PLANES_MASK the children are visible without any test.
+	//
+	bool
+	IsAABBInsideViewFrustum(const AABB& aabb, CullingCache& Cache, uint ParentMask = 0, uint* pMask = NULL) const
+	{
+		return TestCoherent(aabb.GetCenter(), aabb.GetExtents(), 0.0f, Cache, ParentMask, pMask);
+	}
+
+	bool
+	IsSphereInsideViewFrustum(
+		const BoundingSphere& Sphere,
+		CullingCache& Cache,
+		uint ParentMask = 0,
+		uint* pMask = NULL) const
+	{
+		return TestCoherent(Sphere.Center, Vector3f(0.0f, 0.0f, 0.0f), Sphere.Radius, Cache, ParentMask, pMask);
+	}
 
-		bool Inside = (m_leftClipPlane.Dot(p4D) >= 0) && (m_rightClipPlane.Dot(p4D) <= 0) &&
-					  //   (m_topClipPlane.Dot(p4D)    <= 0) &&
-					  //   (m_bottomClipPlane.Dot(p4D) >= 0) &&
-					  (m_nearClipPlane.Dot(p4D) >= 0) && (m_farClipPlane.Dot(p4D) <= 0);
+	// Number of plane tests done by the coherent tests since the last ResetStats()
+	uint
+	GetNumPlaneTests() const
+	{
+		return m_numPlaneTests;
+	}
 
-		return Inside;
+	void
+	ResetStats()
+	{
+		m_numPlaneTests = 0;
+	}
+
+	//
+	// Tests a whole array of boxes and writes 1 (visible) or 0 (culled) per box
+	// into pVisible. Same results as IsAABBInsideViewFrustum, 4 (SSE) or 8 (AVX)
+	// boxes per iteration.
+	//
+	void
+	CullAABBs(const AABB* pBoxes, uint NumBoxes, u8* pVisible) const
+	{
+		static_assert(sizeof(AABB) == 6 * sizeof(float), "AABB is expected to be six packed floats");
+
+		uint i = 0;
+
+#if defined(OGLDEV_AVX)
+		__m256 Planes[NUM_PLANES][7];
+
+		for (int p = 0; p < NUM_PLANES; p++)
+		{
+			BroadcastPlane(m_planes[p], Planes[p]);
+		}
+
+		for (; i + 8 <= NumBoxes; i += 8)
+		{
+			const float* pSrc = &pBoxes[i].MinX;
+
+			// Boxes 0-3 in the low lanes and 4-7 in the high lanes, the rest is
+			// identical to the SSE version since the shuffles work per lane
+			__m256 v[6];
+
+			for (int k = 0; k < 6; k++)
+			{
+				v[k] = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(pSrc + k * 4)), _mm_loadu_ps(pSrc + 24 + k * 4), 1);
+			}
+
+			__m256 Min[3], Max[3];
+			DeinterleaveBoxes(v, Min, Max);
+
+			__m256 Half = _mm256_set1_ps(0.5f);
+			__m256 C[3], E[3];
+
+			for (int k = 0; k < 3; k++)
+			{
+				C[k] = _mm256_mul_ps(_mm256_add_ps(Min[k], Max[k]), Half);
+				E[k] = _mm256_mul_ps(_mm256_sub_ps(Max[k], Min[k]), Half);
+			}
+
+			__m256 Visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+			for (int p = 0; p < NUM_PLANES; p++)
+			{
+				__m256 Dist = SimdMulAdd(Planes[p][0], C[0], Planes[p][3]);
+				Dist = SimdMulAdd(Planes[p][1], C[1], Dist);
+				Dist = SimdMulAdd(Planes[p][2], C[2], Dist);
+				Dist = SimdMulAdd(Planes[p][4], E[0], Dist);
+				Dist = SimdMulAdd(Planes[p][5], E[1], Dist);
+				Dist = SimdMulAdd(Planes[p][6], E[2], Dist);
+				Visible = _mm256_and_ps(Visible, _mm256_cmp_ps(Dist, _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+
+			WriteMask(_mm256_movemask_ps(Visible), 8, pVisible + i);
+		}
+#elif defined(OGLDEV_SSE)
+		__m128 Planes[NUM_PLANES][7];
+
+		for (int p = 0; p < NUM_PLANES; p++)
+		{
+			BroadcastPlane(m_planes[p], Planes[p]);
+		}
+
+		for (; i + 4 <= NumBoxes; i += 4)
+		{
+			const float* pSrc = &pBoxes[i].MinX;
+
+			__m128 v[6];
+
+			for (int k = 0; k < 6; k++)
+			{
+				v[k] = _mm_loadu_ps(pSrc + k * 4);
+			}
+
+			__m128 Min[3], Max[3];
+			DeinterleaveBoxes(v, Min, Max);
+
+			__m128 Half = _mm_set1_ps(0.5f);
+			__m128 C[3], E[3];
+
+			for (int k = 0; k < 3; k++)
+			{
+				C[k] = _mm_mul_ps(_mm_add_ps(Min[k], Max[k]), Half);
+				E[k] = _mm_mul_ps(_mm_sub_ps(Max[k], Min[k]), Half);
+			}
+
+			__m128 Visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+			for (int p = 0; p < NUM_PLANES; p++)
+			{
+				__m128 Dist = SimdMulAdd(Planes[p][0], C[0], Planes[p][3]);
+				Dist = SimdMulAdd(Planes[p][1], C[1], Dist);
+				Dist = SimdMulAdd(Planes[p][2], C[2], Dist);
+				Dist = SimdMulAdd(Planes[p][4], E[0], Dist);
+				Dist = SimdMulAdd(Planes[p][5], E[1], Dist);
+				Dist = SimdMulAdd(Planes[p][6], E[2], Dist);
+				Visible = _mm_and_ps(Visible, _mm_cmpge_ps(Dist, _mm_setzero_ps()));
+			}
+
+			WriteMask(_mm_movemask_ps(Visible), 4, pVisible + i);
+		}
+#endif
+
+		// Leftovers (or everything in the scalar build)
+		for (; i < NumBoxes; i++)
+		{
+			pVisible[i] = IsAABBInsideViewFrustum(pBoxes[i]) ? 1 : 0;
+		}
 	}
 
 private:
-	Vector4f m_leftClipPlane;
-	Vector4f m_rightClipPlane;
-	Vector4f m_bottomClipPlane;
-	Vector4f m_topClipPlane;
-	Vector4f m_nearClipPlane;
-	Vector4f m_farClipPlane;
+	static float
+	PlaneDistance(const Vector4f& p, const Vector3f& v)
+	{
+		return p.x * v.x + p.y * v.y + p.z * v.z + p.w;
+	}
+
+	// The volume is Center +- Extents grown by Radius (i.e. a box or a sphere)
+	bool
+	TestCoherent(
+		const Vector3f& Center,
+		const Vector3f& Extents,
+		float Radius,
+		CullingCache& Cache,
+		uint ParentMask,
+		uint* pMask) const
+	{
+		uint Mask = ParentMask;
+		int Plane = Cache.LastPlane;
+
+		for (int i = 0; i < NUM_PLANES; i++)
+		{
+			if (!(Mask & (1 << Plane)))
+			{
+				const Vector4f& p = m_planes[Plane];
+				float r = fabsf(p.x) * Extents.x + fabsf(p.y) * Extents.y + fabsf(p.z) * Extents.z + Radius;
+				float d = PlaneDistance(p, Center);
+
+				m_numPlaneTests++;
+
+				if (d < -r)
+				{
+					Cache.LastPlane = (u8)Plane;
+					return false;
+				}
+
+				if (d >= r)
+				{
+					Mask |= 1 << Plane;
+				}
+			}
+
+			Plane = (Plane + 1 == NUM_PLANES) ? 0 : Plane + 1;
+		}
+
+		if (pMask)
+		{
+			*pMask = Mask;
+		}
+
+		return true;
+	}
+
+	static void
+	WriteMask(int Mask, int Count, u8* pVisible)
+	{
+		for (int k = 0; k < Count; k++)
+		{
+			pVisible[k] = (Mask >> k) & 1;
+		}
+	}
+
+#ifdef OGLDEV_SSE
+	// nx, ny, nz, d, |nx|, |ny|, |nz|
+	static void
+	BroadcastPlane(const Vector4f& p, __m128* pOut)
+	{
+		pOut[0] = _mm_set1_ps(p.x);
+		pOut[1] = _mm_set1_ps(p.y);
+		pOut[2] = _mm_set1_ps(p.z);
+		pOut[3] = _mm_set1_ps(p.w);
+		pOut[4] = _mm_set1_ps(fabsf(p.x));
+		pOut[5] = _mm_set1_ps(fabsf(p.y));
+		pOut[6] = _mm_set1_ps(fabsf(p.z));
+	}
+
+	//
+	// Four boxes are 24 consecutive floats (MinX MaxX MinY MaxY MinZ MaxZ each):
+	//   v0 = 0.MinX 0.MaxX 0.MinY 0.MaxY   v3 = 2.MinX 2.MaxX 2.MinY 2.MaxY
+	//   v1 = 0.MinZ 0.MaxZ 1.MinX 1.MaxX   v4 = 2.MinZ 2.MaxZ 3.MinX 3.MaxX
+	//   v2 = 1.MinY 1.MaxY 1.MinZ 1.MaxZ   v5 = 3.MinY 3.MaxY 3.MinZ 3.MaxZ
+	// Gather the min/max pairs of every axis and then split the even/odd elements.
+	//
+	static void
+	DeinterleaveBoxes(const __m128* v, __m128* Min, __m128* Max)
+	{
+		__m128 X01 = OGLDEV_SHUFFLE(v[0], v[1], 0, 1, 2, 3);
+		__m128 X23 = OGLDEV_SHUFFLE(v[3], v[4], 0, 1, 2, 3);
+		__m128 Y01 = OGLDEV_SHUFFLE(v[0], v[2], 2, 3, 0, 1);
+		__m128 Y23 = OGLDEV_SHUFFLE(v[3], v[5], 2, 3, 0, 1);
+		__m128 Z01 = OGLDEV_SHUFFLE(v[1], v[2], 0, 1, 2, 3);
+		__m128 Z23 = OGLDEV_SHUFFLE(v[4], v[5], 0, 1, 2, 3);
+
+		Min[0] = OGLDEV_SHUFFLE(X01, X23, 0, 2, 0, 2);
+		Max[0] = OGLDEV_SHUFFLE(X01, X23, 1, 3, 1, 3);
+		Min[1] = OGLDEV_SHUFFLE(Y01, Y23, 0, 2, 0, 2);
+		Max[1] = OGLDEV_SHUFFLE(Y01, Y23, 1, 3, 1, 3);
+		Min[2] = OGLDEV_SHUFFLE(Z01, Z23, 0, 2, 0, 2);
+		Max[2] = OGLDEV_SHUFFLE(Z01, Z23, 1, 3, 1, 3);
+	}
+#endif
+
+#ifdef OGLDEV_AVX
+	static void
+	BroadcastPlane(const Vector4f& p, __m256* pOut)
+	{
+		pOut[0] = _mm256_set1_ps(p.x);
+		pOut[1] = _mm256_set1_ps(p.y);
+		pOut[2] = _mm256_set1_ps(p.z);
+		pOut[3] = _mm256_set1_ps(p.w);
+		pOut[4] = _mm256_set1_ps(fabsf(p.x));
+		pOut[5] = _mm256_set1_ps(fabsf(p.y));
+		pOut[6] = _mm256_set1_ps(fabsf(p.z));
+	}
+
+	static void
+	DeinterleaveBoxes(const __m256* v, __m256* Min, __m256* Max)
+	{
+		__m256 X01 = OGLDEV_SHUFFLE256(v[0], v[1], 0, 1, 2, 3);
+		__m256 X23 = OGLDEV_SHUFFLE256(v[3], v[4], 0, 1, 2, 3);
+		__m256 Y01 = OGLDEV_SHUFFLE256(v[0], v[2], 2, 3, 0, 1);
+		__m256 Y23 = OGLDEV_SHUFFLE256(v[3], v[5], 2, 3, 0, 1);
+		__m256 Z01 = OGLDEV_SHUFFLE256(v[1], v[2], 0, 1, 2, 3);
+		__m256 Z23 = OGLDEV_SHUFFLE256(v[4], v[5], 0, 1, 2, 3);
+
+		Min[0] = OGLDEV_SHUFFLE256(X01, X23, 0, 2, 0, 2);
+		Max[0] = OGLDEV_SHUFFLE256(X01, X23, 1, 3, 1, 3);
+		Min[1] = OGLDEV_SHUFFLE256(Y01, Y23, 0, 2, 0, 2);
+		Max[1] = OGLDEV_SHUFFLE256(Y01, Y23, 1, 3, 1, 3);
+		Min[2] = OGLDEV_SHUFFLE256(Z01, Z23, 0, 2, 0, 2);
+		Max[2] = OGLDEV_SHUFFLE256(Z01, Z23, 1, 3, 1, 3);
+	}
+#endif
+
+	Vector4f m_planes[NUM_PLANES];
+	mutable uint m_numPlaneTests = 0;
 };
 
-void
+inline void
 CalcTightLightProjection(
 	const Matrix4f& CameraView,		  // in
 	const Vector3f& LightDir,		  // in
@@ -152,7 +559,7 @@ CalcTightLightProjection(
 	//
 	// Step #2: transform the view frustum to world space
 	//
-	Matrix4f InverseCameraView = CameraView.Inverse();
+	Matrix4f InverseCameraView = CameraView.InverseRigid();
 	frustum.Transform(InverseCameraView);
 
 	Frustum view_frustum_in_world_space = frustum; // backup for later
@@ -182,7 +589,7 @@ CalcTightLightProjection(
 	//
 	// Step #6: transform the position of the light back to world space
 	//
-	Matrix4f LightViewInv = LightView.Inverse();
+	Matrix4f LightViewInv = LightView.InverseRigid();
 	LightPosWorld4d = LightViewInv * LightPosWorld4d;
 	LightPosWorld = Vector3f(LightPosWorld4d.x, LightPosWorld4d.y, LightPosWorld4d.z);
 
@@ -200,7 +607,7 @@ CalcTightLightProjection(
 	final_aabb.UpdateOrthoInfo(orthoProjInfo);
 }
 
-bool
+inline bool
 IsPointInsideViewFrustum(const Vector3f& p, const Matrix4f& VP)
 {
 	Vector4f p4D(p, 1.0f);
@@ -110,6 +110,25 @@ namespace ogl
 		virtual bool
 		Init(int SubTech = SUBTECH_DEFAULT);
 
+		//
+		// Call before Init(). pPickingIDsShader is linked as a second fragment shader
+		// object. The main() of lighting_new.fs is renamed to LightingMain() and the
+		// new main() must call it, declare gObjectIndex/gDrawIndex and write
+		// uvec3(gObjectIndex, gDrawIndex, gl_PrimitiveID) to output location 1, so
+		// that the main pass fills the picking IDs as a second render target.
+		//
+		void
+		EnablePickingIDs(const char* pPickingIDsShader)
+		{
+			m_pPickingIDsShader = pPickingIDsShader;
+		}
+
+		void
+		SetObjectIndex(unsigned int ObjectIndex);
+
+		virtual void
+		DrawStartCB(unsigned int DrawIndex);
+
 		void
 		SetWVP(const Matrix4f& WVP);
 
@@ -240,6 +259,10 @@ namespace ogl
 		SetExpFogCommon(float FogEnd, float FogDensity);
 
 		int m_subTech = SUBTECH_DEFAULT;
+		const char* m_pPickingIDsShader = NULL; // the fragment shader that writes the picking IDs
+
+		GLuint ObjectIndexLoc = INVALID_UNIFORM_LOCATION; // required only for picking IDs
+		GLuint DrawIndexLoc = INVALID_UNIFORM_LOCATION;	  // required only for picking IDs
 
 		GLuint WVPLoc = INVALID_UNIFORM_LOCATION;
 		GLuint WorldMatrixLoc = INVALID_UNIFORM_LOCATION;
@@ -410,11 +433,25 @@ namespace ogl
 			exit(0);
 		}
 
-		if (!AddShader(GL_FRAGMENT_SHADER, "../Common/Shaders/lighting_new.fs"))
+		if (!AddShader(
+				GL_FRAGMENT_SHADER,
+				"../Common/Shaders/lighting_new.fs",
+				m_pPickingIDsShader ? "#define main LightingMain\n" : NULL))
 		{
 			return false;
 		}
 
+		if (m_pPickingIDsShader)
+		{
+			if (!AddShader(GL_FRAGMENT_SHADER, m_pPickingIDsShader))
+			{
+				return false;
+			}
+
+			// The color output of lighting_new.fs has no location of its own
+			glBindFragDataLocation(m_shaderProg, 0, "FragColor");
+		}
+
 		if (!Finalize())
 		{
 			return false;
@@ -509,6 +546,18 @@ namespace ogl
 #endif
 		}
 
+		if (m_pPickingIDsShader)
+		{
+			ObjectIndexLoc = GetUniformLocation("gObjectIndex");
+			DrawIndexLoc = GetUniformLocation("gDrawIndex");
+
+			// Not optional - without them the second render target would be garbage
+			if (ObjectIndexLoc == INVALID_UNIFORM_LOCATION || DrawIndexLoc == INVALID_UNIFORM_LOCATION)
+			{
+				return false;
+			}
+		}
+
 		if (m_subTech == SUBTECH_WIREFRAME_ON_MESH)
 		{
 			if (ViewportMatrixLoc == INVALID_UNIFORM_LOCATION || WireframeWidthLoc == INVALID_UNIFORM_LOCATION ||
@@ -814,6 +863,21 @@ namespace ogl
 		}
 	}
 
+	void
+	LightingTechnique::SetObjectIndex(unsigned int ObjectIndex)
+	{
+		glUniform1ui(ObjectIndexLoc, ObjectIndex);
+	}
+
+	void
+	LightingTechnique::DrawStartCB(unsigned int DrawIndex)
+	{
+		if (m_pPickingIDsShader)
+		{
+			glUniform1ui(DrawIndexLoc, DrawIndex);
+		}
+	}
+
 	void
 	LightingTechnique::SetColorMod(const Vector4f& Color)
 	{
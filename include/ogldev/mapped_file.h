@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ogl
+{
+	//
+	// A read only view of a whole file. The pages are brought in by the OS on
+	// first access so nothing is copied until the data is actually used, e.g.
+	// by glBufferData().
+	//
+	class MappedFile
+	{
+	public:
+		MappedFile() {}
+
+		MappedFile(const MappedFile&) = delete;
+
+		MappedFile&
+		operator=(const MappedFile&) = delete;
+
+		~MappedFile() { Close(); }
+
+		// Returns false if the file doesn't exist or can't be mapped. An empty
+		// file is mapped successfully but GetData() returns NULL.
+		bool
+		Open(const std::string& Filename)
+		{
+			Close();
+
+#ifdef _WIN32
+			m_file = CreateFileA(
+				Filename.c_str(),
+				GENERIC_READ,
+				FILE_SHARE_READ,
+				NULL,
+				OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+				NULL);
+
+			if (m_file == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+
+			LARGE_INTEGER Size;
+
+			if (!GetFileSizeEx(m_file, &Size))
+			{
+				Close();
+				return false;
+			}
+
+			m_size = (size_t)Size.QuadPart;
+
+			if (m_size == 0)
+			{
+				return true;
+			}
+
+			m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+			if (m_mapping == NULL)
+			{
+				Close();
+				return false;
+			}
+
+			m_pData = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+			m_fd = open(Filename.c_str(), O_RDONLY);
+
+			if (m_fd < 0)
+			{
+				return false;
+			}
+
+			struct stat StatBuf;
+
+			if (fstat(m_fd, &StatBuf) != 0)
+			{
+				Close();
+				return false;
+			}
+
+			m_size = (size_t)StatBuf.st_size;
+
+			if (m_size == 0)
+			{
+				return true;
+			}
+
+			m_pData = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+
+			if (m_pData == MAP_FAILED)
+			{
+				m_pData = NULL;
+			}
+			else
+			{
+				// The file is usually read front to back
+				madvise(m_pData, m_size, MADV_SEQUENTIAL);
+			}
+#endif
+
+			if (!m_pData)
+			{
+				Close();
+				return false;
+			}
+
+			return true;
+		}
+
+		void
+		Close()
+		{
+#ifdef _WIN32
+			if (m_pData)
+			{
+				UnmapViewOfFile(m_pData);
+			}
+
+			if (m_mapping != NULL)
+			{
+				CloseHandle(m_mapping);
+				m_mapping = NULL;
+			}
+
+			if (m_file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(m_file);
+				m_file = INVALID_HANDLE_VALUE;
+			}
+#else
+			if (m_pData)
+			{
+				munmap(m_pData, m_size);
+			}
+
+			if (m_fd >= 0)
+			{
+				close(m_fd);
+				m_fd = -1;
+			}
+#endif
+
+			m_pData = NULL;
+			m_size = 0;
+		}
+
+		const void*
+		GetData() const
+		{
+			return m_pData;
+		}
+
+		size_t
+		GetSize() const
+		{
+			return m_size;
+		}
+
+	private:
+		void* m_pData = NULL;
+		size_t m_size = 0;
+
+#ifdef _WIN32
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = NULL;
+#else
+		int m_fd = -1;
+#endif
+	};
+} // namespace ogl
@@ -1,5 +1,9 @@
+#pragma once
+
 #include <cstdio>
 
+#include <ogldev/mat4f.h>
+
 class Matrix3f
 {
 public:
@@ -21,6 +25,35 @@ public:
 		m[2][2] = a.m[2][2];
 	}
 
+	// Inverse transpose of the top left corner of the 4-by-4 matrix. Transforms normals
+	// correctly even when the matrix contains non-uniform scaling.
+	void
+	InitNormalMatrix(const Matrix4f& a)
+	{
+		Vector3f Row0(a.m[0][0], a.m[0][1], a.m[0][2]);
+		Vector3f Row1(a.m[1][0], a.m[1][1], a.m[1][2]);
+		Vector3f Row2(a.m[2][0], a.m[2][1], a.m[2][2]);
+
+		// Cofactor matrix
+		Vector3f C0 = Row1.Cross(Row2);
+		Vector3f C1 = Row2.Cross(Row0);
+		Vector3f C2 = Row0.Cross(Row1);
+
+		float det = Row0.Dot(C0);
+		assert(det != 0.0f);
+		float invdet = 1.0f / det;
+
+		m[0][0] = C0.x * invdet;
+		m[0][1] = C0.y * invdet;
+		m[0][2] = C0.z * invdet;
+		m[1][0] = C1.x * invdet;
+		m[1][1] = C1.y * invdet;
+		m[1][2] = C1.z * invdet;
+		m[2][0] = C2.x * invdet;
+		m[2][1] = C2.y * invdet;
+		m[2][2] = C2.z * invdet;
+	}
+
 	Vector3f
 	operator*(const Vector3f& v) const
 	{
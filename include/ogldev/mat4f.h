@@ -4,11 +4,14 @@
 #include <assimp/matrix4x4.h>
 #include <assimp/vector3.h>
 
+#include <ogldev/AABB.h>
 #include <ogldev/quat.h>
+#include <ogldev/simd.h>
 #include <ogldev/utility.h>
 #include <ogldev/vec4f.h>
 
-class Matrix4f
+// Every row is 16 byte aligned so the SIMD paths can load it with a single instruction
+class alignas(16) Matrix4f
 {
 public:
 	float m[4][4];
@@ -103,6 +106,19 @@ public:
 	{
 		Matrix4f n;
 
+#ifdef OGLDEV_SSE
+		__m128 Row0 = _mm_load_ps(m[0]);
+		__m128 Row1 = _mm_load_ps(m[1]);
+		__m128 Row2 = _mm_load_ps(m[2]);
+		__m128 Row3 = _mm_load_ps(m[3]);
+
+		_MM_TRANSPOSE4_PS(Row0, Row1, Row2, Row3);
+
+		_mm_store_ps(n.m[0], Row0);
+		_mm_store_ps(n.m[1], Row1);
+		_mm_store_ps(n.m[2], Row2);
+		_mm_store_ps(n.m[3], Row3);
+#else
 		for (unsigned int i = 0; i < 4; i++)
 		{
 			for (unsigned int j = 0; j < 4; j++)
@@ -110,6 +126,7 @@ public:
 				n.m[i][j] = m[j][i];
 			}
 		}
+#endif
 
 		return n;
 	}
@@ -140,6 +157,41 @@ public:
 	{
 		Matrix4f Ret;
 
+#if defined(OGLDEV_AVX)
+		// Two rows of the result per iteration: every row of the result is a linear
+		// combination of the rows of the right matrix
+		__m256 B0 = _mm256_broadcast_ps((const __m128*)Right.m[0]);
+		__m256 B1 = _mm256_broadcast_ps((const __m128*)Right.m[1]);
+		__m256 B2 = _mm256_broadcast_ps((const __m128*)Right.m[2]);
+		__m256 B3 = _mm256_broadcast_ps((const __m128*)Right.m[3]);
+
+		for (unsigned int i = 0; i < 4; i += 2)
+		{
+			__m256 A = _mm256_loadu_ps(m[i]);
+
+			__m256 R = _mm256_mul_ps(_mm256_shuffle_ps(A, A, 0x00), B0);
+			R = SimdMulAdd(_mm256_shuffle_ps(A, A, 0x55), B1, R);
+			R = SimdMulAdd(_mm256_shuffle_ps(A, A, 0xAA), B2, R);
+			R = SimdMulAdd(_mm256_shuffle_ps(A, A, 0xFF), B3, R);
+
+			_mm256_storeu_ps(Ret.m[i], R);
+		}
+#elif defined(OGLDEV_SSE)
+		__m128 B0 = _mm_load_ps(Right.m[0]);
+		__m128 B1 = _mm_load_ps(Right.m[1]);
+		__m128 B2 = _mm_load_ps(Right.m[2]);
+		__m128 B3 = _mm_load_ps(Right.m[3]);
+
+		for (unsigned int i = 0; i < 4; i++)
+		{
+			__m128 R = _mm_mul_ps(_mm_set1_ps(m[i][0]), B0);
+			R = SimdMulAdd(_mm_set1_ps(m[i][1]), B1, R);
+			R = SimdMulAdd(_mm_set1_ps(m[i][2]), B2, R);
+			R = SimdMulAdd(_mm_set1_ps(m[i][3]), B3, R);
+
+			_mm_store_ps(Ret.m[i], R);
+		}
+#else
 		for (unsigned int i = 0; i < 4; i++)
 		{
 			for (unsigned int j = 0; j < 4; j++)
@@ -148,6 +200,7 @@ public:
 							  m[i][3] * Right.m[3][j];
 			}
 		}
+#endif
 
 		return Ret;
 	}
@@ -157,10 +210,24 @@ public:
 	{
 		Vector4f r;
 
+#ifdef OGLDEV_SSE
+		__m128 V = _mm_loadu_ps(&v.x);
+
+		__m128 P0 = _mm_mul_ps(_mm_load_ps(m[0]), V);
+		__m128 P1 = _mm_mul_ps(_mm_load_ps(m[1]), V);
+		__m128 P2 = _mm_mul_ps(_mm_load_ps(m[2]), V);
+		__m128 P3 = _mm_mul_ps(_mm_load_ps(m[3]), V);
+
+		// After the transpose lane i of each register holds one of the products of row i
+		_MM_TRANSPOSE4_PS(P0, P1, P2, P3);
+
+		_mm_storeu_ps(&r.x, _mm_add_ps(_mm_add_ps(P0, P1), _mm_add_ps(P2, P3)));
+#else
 		r.x = m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3] * v.w;
 		r.y = m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3] * v.w;
 		r.z = m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3] * v.w;
 		r.w = m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3] * v.w;
+#endif
 
 		return r;
 	}
@@ -196,6 +263,9 @@ public:
 	Matrix4f
 	Inverse() const
 	{
+#ifdef OGLDEV_SSE
+		return InverseSSE();
+#else
 		// Compute the reciprocal determinant
 		float det = Determinant();
 
@@ -257,6 +327,115 @@ public:
 								m[0][1] * (m[1][2] * m[2][0] - m[1][0] * m[2][2]) +
 								m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]));
 		return res;
+#endif
+	}
+
+	// Inverse of a matrix whose last row is (0, 0, 0, 1), e.g. any combination of
+	// scaling, rotation and translation
+	Matrix4f
+	InverseAffine() const
+	{
+		// The rows of the inverse of the 3x3 part are the cross products of its columns
+		Vector3f Col0(m[0][0], m[1][0], m[2][0]);
+		Vector3f Col1(m[0][1], m[1][1], m[2][1]);
+		Vector3f Col2(m[0][2], m[1][2], m[2][2]);
+
+		Vector3f Row0 = Col1.Cross(Col2);
+		Vector3f Row1 = Col2.Cross(Col0);
+		Vector3f Row2 = Col0.Cross(Col1);
+
+		float det = Col0.Dot(Row0);
+
+		if (det == 0.0f)
+		{
+			assert(0);
+			return *this;
+		}
+
+		float invdet = 1.0f / det;
+
+		Row0 *= invdet;
+		Row1 *= invdet;
+		Row2 *= invdet;
+
+		Vector3f Translation(m[0][3], m[1][3], m[2][3]);
+
+		Matrix4f res(
+			Row0.x,
+			Row0.y,
+			Row0.z,
+			-Row0.Dot(Translation),
+			Row1.x,
+			Row1.y,
+			Row1.z,
+			-Row1.Dot(Translation),
+			Row2.x,
+			Row2.y,
+			Row2.z,
+			-Row2.Dot(Translation),
+			0.0f,
+			0.0f,
+			0.0f,
+			1.0f);
+
+		return res;
+	}
+
+	// Inverse of a rotation followed by a translation (e.g. a camera matrix).
+	// The rotation part must be orthonormal so its inverse is its transpose.
+	Matrix4f
+	InverseRigid() const
+	{
+		Matrix4f res(
+			m[0][0],
+			m[1][0],
+			m[2][0],
+			0.0f,
+			m[0][1],
+			m[1][1],
+			m[2][1],
+			0.0f,
+			m[0][2],
+			m[1][2],
+			m[2][2],
+			0.0f,
+			0.0f,
+			0.0f,
+			0.0f,
+			1.0f);
+
+		for (int i = 0; i < 3; i++)
+		{
+			res.m[i][3] = -(res.m[i][0] * m[0][3] + res.m[i][1] * m[1][3] + res.m[i][2] * m[2][3]);
+		}
+
+		return res;
+	}
+
+	// Bounds of the box after an affine transformation (Arvo): the center is
+	// transformed and the extents are projected on the absolute axes of the matrix
+	AABB
+	TransformAABB(const AABB& aabb) const
+	{
+		Vector3f c = aabb.GetCenter();
+		Vector3f e = aabb.GetExtents();
+
+		AABB res;
+
+		float* pMin = &res.MinX;
+		float* pMax = &res.MaxX;
+
+		for (int i = 0; i < 3; i++)
+		{
+			float Center = m[i][0] * c.x + m[i][1] * c.y + m[i][2] * c.z + m[i][3];
+			float Extent = fabsf(m[i][0]) * e.x + fabsf(m[i][1]) * e.y + fabsf(m[i][2]) * e.z;
+
+			// Min/Max of the same axis are adjacent in AABB
+			pMin[i * 2] = Center - Extent;
+			pMax[i * 2] = Center + Extent;
+		}
+
+		return res;
 	}
 
 	void
@@ -384,6 +563,24 @@ public:
 		InitTranslationTransform(Pos.x, Pos.y, Pos.z);
 	}
 
+	// Translation * Rotation * Scale built directly, without the matrix products
+	void
+	InitTransform(const Vector3f& Pos, const Quaternion& Rotation, float Scale)
+	{
+		InitRotateTransform(Rotation);
+
+		for (int i = 0; i < 3; i++)
+		{
+			m[i][0] *= Scale;
+			m[i][1] *= Scale;
+			m[i][2] *= Scale;
+		}
+
+		m[0][3] = Pos.x;
+		m[1][3] = Pos.y;
+		m[2][3] = Pos.z;
+	}
+
 	void
 	InitCameraTransform(const Vector3f& Target, const Vector3f& Up)
 	{
@@ -522,6 +719,100 @@ public:
 	}
 
 private:
+#ifdef OGLDEV_SSE
+	//
+	// Inverse using 2x2 block matrices. With M = | A B | the inverse is
+	//                                          | C D |
+	// 1/|M| * | X# Y# | where X# = |D|A - B(D#C), W# = |A|D - C(A#B),
+	//         | Z# W# |       Y# = |B|C - D(A#B)#, Z# = |C|B - A(D#C)#
+	// and # is the adjugate. Every 2x2 block lives in a single register.
+	// https://lxjk.github.io/2017/09/03/Fast-4x4-Matrix-Inverse-with-SSE-SIMD-Explained.html
+	//
+	static __m128
+	Mat2Mul(__m128 a, __m128 b)
+	{
+		return _mm_add_ps(
+			_mm_mul_ps(a, OGLDEV_SWIZZLE(b, 0, 3, 0, 3)),
+			_mm_mul_ps(OGLDEV_SWIZZLE(a, 1, 0, 3, 2), OGLDEV_SWIZZLE(b, 2, 1, 2, 1)));
+	}
+
+	// (a#) * b
+	static __m128
+	Mat2AdjMul(__m128 a, __m128 b)
+	{
+		return _mm_sub_ps(
+			_mm_mul_ps(OGLDEV_SWIZZLE(a, 3, 3, 0, 0), b),
+			_mm_mul_ps(OGLDEV_SWIZZLE(a, 1, 1, 2, 2), OGLDEV_SWIZZLE(b, 2, 3, 0, 1)));
+	}
+
+	// a * (b#)
+	static __m128
+	Mat2MulAdj(__m128 a, __m128 b)
+	{
+		return _mm_sub_ps(
+			_mm_mul_ps(a, OGLDEV_SWIZZLE(b, 3, 0, 3, 0)),
+			_mm_mul_ps(OGLDEV_SWIZZLE(a, 1, 0, 3, 2), OGLDEV_SWIZZLE(b, 2, 1, 2, 1)));
+	}
+
+	Matrix4f
+	InverseSSE() const
+	{
+		__m128 Row0 = _mm_load_ps(m[0]);
+		__m128 Row1 = _mm_load_ps(m[1]);
+		__m128 Row2 = _mm_load_ps(m[2]);
+		__m128 Row3 = _mm_load_ps(m[3]);
+
+		__m128 A = _mm_movelh_ps(Row0, Row1);
+		__m128 B = _mm_movehl_ps(Row1, Row0);
+		__m128 C = _mm_movelh_ps(Row2, Row3);
+		__m128 D = _mm_movehl_ps(Row3, Row2);
+
+		// (|A| |B| |C| |D|)
+		__m128 DetSub = _mm_sub_ps(
+			_mm_mul_ps(OGLDEV_SHUFFLE(Row0, Row2, 0, 2, 0, 2), OGLDEV_SHUFFLE(Row1, Row3, 1, 3, 1, 3)),
+			_mm_mul_ps(OGLDEV_SHUFFLE(Row0, Row2, 1, 3, 1, 3), OGLDEV_SHUFFLE(Row1, Row3, 0, 2, 0, 2)));
+		__m128 DetA = OGLDEV_SWIZZLE(DetSub, 0, 0, 0, 0);
+		__m128 DetB = OGLDEV_SWIZZLE(DetSub, 1, 1, 1, 1);
+		__m128 DetC = OGLDEV_SWIZZLE(DetSub, 2, 2, 2, 2);
+		__m128 DetD = OGLDEV_SWIZZLE(DetSub, 3, 3, 3, 3);
+
+		__m128 D_C = Mat2AdjMul(D, C);
+		__m128 A_B = Mat2AdjMul(A, B);
+
+		__m128 X_ = _mm_sub_ps(_mm_mul_ps(DetD, A), Mat2Mul(B, D_C));
+		__m128 W_ = _mm_sub_ps(_mm_mul_ps(DetA, D), Mat2Mul(C, A_B));
+		__m128 Y_ = _mm_sub_ps(_mm_mul_ps(DetB, C), Mat2MulAdj(D, A_B));
+		__m128 Z_ = _mm_sub_ps(_mm_mul_ps(DetC, B), Mat2MulAdj(A, D_C));
+
+		// |M| = |A|*|D| + |B|*|C| - tr((A#B)(D#C))
+		__m128 DetM = _mm_add_ps(_mm_mul_ps(DetA, DetD), _mm_mul_ps(DetB, DetC));
+		__m128 Trace = SimdHorizontalSum(_mm_mul_ps(A_B, OGLDEV_SWIZZLE(D_C, 0, 2, 1, 3)));
+		DetM = _mm_sub_ps(DetM, Trace);
+
+		if (_mm_cvtss_f32(DetM) == 0.0f)
+		{
+			assert(0);
+			return *this;
+		}
+
+		__m128 RcpDetM = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), DetM);
+
+		X_ = _mm_mul_ps(X_, RcpDetM);
+		Y_ = _mm_mul_ps(Y_, RcpDetM);
+		Z_ = _mm_mul_ps(Z_, RcpDetM);
+		W_ = _mm_mul_ps(W_, RcpDetM);
+
+		// The adjugate of every block is folded into the shuffles that store the result
+		Matrix4f res;
+		_mm_store_ps(res.m[0], OGLDEV_SHUFFLE(X_, Y_, 3, 1, 3, 1));
+		_mm_store_ps(res.m[1], OGLDEV_SHUFFLE(X_, Y_, 2, 0, 2, 0));
+		_mm_store_ps(res.m[2], OGLDEV_SHUFFLE(Z_, W_, 3, 1, 3, 1));
+		_mm_store_ps(res.m[3], OGLDEV_SHUFFLE(Z_, W_, 2, 0, 2, 0));
+
+		return res;
+	}
+#endif
+
 	//
 	// The following rotation matrices are for a left handed coordinate system.
 	// https://butterflyofdream.wordpress.com/2016/07/05/converting-rotation-matrices-of-left-handed-coordinate-system/
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+#include <ogldev/mapped_file.h>
+#include <ogldev/types.h>
+#include <ogldev/vec3f.h>
+
+//
+// On disk format of the BasicMesh cache, see BasicMesh::LoadMesh(). The file holds
+// the final output of the import so a reload doesn't need Assimp at all:
+//
+//   MeshCacheHeader
+//   BasicMeshEntry    x NumMeshes
+//   AABB              x NumMeshes    submesh bounds
+//   BoundingSphere    x NumMeshes
+//   Vertex            x NumVertices  the interleaved vertex buffer
+//   uint              x NumIndices   the index buffer, including the LODs
+//   MeshLOD           x NumLODs      index ranges of the LODs of every submesh
+//   Meshlet           x NumMeshlets  index ranges and culling bounds of the meshlets
+//   MeshCacheMaterial x NumMaterials
+//   BVH::NodeLayout   x NumBVHNodes  the triangle BVH...
+//   uint              x NumBVHItems  ...and its items
+//   texture paths and embedded (compressed) images, see MeshCacheTexture
+//
+// Everything is in the native byte order and every section starts at a 16 byte
+// aligned offset so it can be used in place from the mapped file. The cache is
+// only valid for the source file it was built from, which is checked using the
+// size and hash of the source. Files referenced by the source (e.g. the .mtl of
+// an .obj) are not part of the hash.
+//
+
+#define MESH_CACHE_VERSION 4
+#define MESH_CACHE_EXTENSION ".oglmesh"
+#define MESH_CACHE_ALIGNMENT 16
+
+namespace ogl
+{
+	static const char MESH_CACHE_MAGIC[8] = {'O', 'G', 'L', 'M', 'E', 'S', 'H', '\0'};
+
+	enum MESH_CACHE_TEXTURE_TYPE
+	{
+		MESH_CACHE_TEXTURE_NONE = 0,
+		MESH_CACHE_TEXTURE_FILE = 1,	 // the data is the full path
+		MESH_CACHE_TEXTURE_EMBEDDED = 2, // the data is the compressed image
+	};
+
+	struct MeshCacheTexture
+	{
+		u32 Type = MESH_CACHE_TEXTURE_NONE;
+		u32 Size = 0;	// bytes
+		u64 Offset = 0; // from the start of the file
+	};
+
+	struct MeshCacheMaterial
+	{
+		Vector3f AmbientColor;
+		Vector3f DiffuseColor;
+		Vector3f SpecularColor;
+		u32 Pad = 0;
+		MeshCacheTexture Diffuse;
+		MeshCacheTexture SpecularExponent;
+	};
+
+	struct MeshCacheHeader
+	{
+		char Magic[8];
+		u32 Version;
+		u32 VertexSize;	 // sizeof(Vertex), catches layout changes
+		u32 ImportFlags; // Assimp post processing flags
+		u32 NumMeshes;
+		u32 NumMaterials;
+		u32 NumVertices;
+		u32 NumIndices;
+		u32 Options; // BasicMesh options that change the output, e.g. the mesh optimizer
+		u32 NumBVHNodes;
+		u32 NumBVHItems; // triangles
+		u32 NumLODs;
+		u32 NumMeshlets;
+		u64 SourceSize;
+		u64 SourceHash;
+		float GlobalInverseTransform[16];
+
+		// Offsets of the sections from the start of the file
+		u64 MeshesOffset;
+		u64 AABBsOffset;
+		u64 SpheresOffset;
+		u64 VerticesOffset;
+		u64 IndicesOffset;
+		u64 LODsOffset;
+		u64 MeshletsOffset;
+		u64 MaterialsOffset;
+		u64 BVHNodesOffset;
+		u64 BVHItemsOffset;
+		u64 FileSize;
+	};
+
+	inline std::string
+	GetMeshCacheFilename(const std::string& SourceFilename)
+	{
+		return SourceFilename + MESH_CACHE_EXTENSION;
+	}
+
+	inline u64
+	AlignMeshCacheOffset(u64 Offset)
+	{
+		return (Offset + MESH_CACHE_ALIGNMENT - 1) & ~(u64)(MESH_CACHE_ALIGNMENT - 1);
+	}
+
+	// True if [Offset, Offset + Size) is inside the file
+	inline bool
+	IsMeshCacheRangeValid(const MeshCacheHeader& Header, u64 Offset, u64 Size)
+	{
+		return (Offset <= Header.FileSize) && (Size <= Header.FileSize - Offset);
+	}
+
+	// True if every index of the range points at a vertex, the range itself must be valid
+	inline bool
+	AreMeshCacheIndicesValid(const u32* pIndices, u32 BaseIndex, u32 NumIndices, u32 BaseVertex, u32 NumVertices)
+	{
+		if (BaseVertex > NumVertices)
+		{
+			return false;
+		}
+
+		u32 MaxIndex = 0;
+
+		for (u32 i = BaseIndex; i < BaseIndex + NumIndices; i++)
+		{
+			MaxIndex = (pIndices[i] > MaxIndex) ? pIndices[i] : MaxIndex;
+		}
+
+		return (NumIndices == 0) || (MaxIndex < NumVertices - BaseVertex);
+	}
+
+	//
+	// FNV-1a over 8 byte words (and the leftover bytes one at a time). This is
+	// only used to detect a changed source file, not against tampering, and
+	// working on whole words keeps it well above disk speed.
+	//
+	inline u64
+	HashMemory(const void* pData, size_t Size)
+	{
+		const u64 FNV_PRIME = 0x100000001b3ULL;
+		u64 Hash = 0xcbf29ce484222325ULL;
+
+		const u8* p = (const u8*)pData;
+		size_t i = 0;
+
+		for (; i + 8 <= Size; i += 8)
+		{
+			u64 Word;
+			memcpy(&Word, p + i, sizeof(Word));
+			Hash = (Hash ^ Word) * FNV_PRIME;
+		}
+
+		for (; i < Size; i++)
+		{
+			Hash = (Hash ^ p[i]) * FNV_PRIME;
+		}
+
+		return Hash;
+	}
+
+	inline bool
+	HashFile(const std::string& Filename, u64& Size, u64& Hash)
+	{
+		MappedFile File;
+
+		if (!File.Open(Filename))
+		{
+			return false;
+		}
+
+		Size = File.GetSize();
+		Hash = HashMemory(File.GetData(), File.GetSize());
+
+		return true;
+	}
+} // namespace ogl
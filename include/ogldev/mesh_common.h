@@ -57,8 +57,8 @@ public:
 		return m_worldTransform;
 	}
 
-	Matrix4f
-	GetWorldMatrix()
+	const Matrix4f&
+	GetWorldMatrix() const
 	{
 		return m_worldTransform.GetMatrix();
 	}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ogldev/basic_mesh.h>
+#include <ogldev/types.h>
+
+namespace ogl
+{
+	//
+	// A BasicMesh that is loaded in the background by MeshLoader. Get() returns
+	// NULL until the mesh can be drawn and from then on it is used like any other
+	// mesh, on the GL thread. The handle owns the mesh.
+	//
+	class AsyncMesh
+	{
+	public:
+		enum STATE
+		{
+			QUEUED,	   // waiting for a loader thread
+			IMPORTING, // ImportMesh() on a loader thread
+			UPLOADING, // imported, waiting for MeshLoader::Update()
+			READY,
+			FAILED
+		};
+
+		BasicMesh*
+		Get() const
+		{
+			return IsReady() ? m_pMesh.get() : NULL;
+		}
+
+		STATE
+		GetState() const
+		{
+			return m_state.load(std::memory_order_acquire);
+		}
+
+		bool
+		IsReady() const
+		{
+			return GetState() == READY;
+		}
+
+		bool
+		HasFailed() const
+		{
+			return GetState() == FAILED;
+		}
+
+		const std::string&
+		GetFilename() const
+		{
+			return m_filename;
+		}
+
+	private:
+		friend class MeshLoader;
+
+		std::string m_filename;
+		MeshLoadOptions m_options;
+		std::unique_ptr<BasicMesh> m_pMesh;
+		std::atomic<STATE> m_state{QUEUED};
+	};
+
+	//
+	// Loads meshes without blocking the GL thread. The loader threads run
+	// BasicMesh::ImportMesh(), i.e. the import (or the mesh cache), the optimizer
+	// and the texture decoding, while the app keeps rendering. Update() is called
+	// once per frame on the GL thread and creates the GL objects of the imported
+	// meshes a part at a time (see BasicMesh::UploadNextPart()) until the time
+	// budget is used up, so a large mesh is spread over several frames instead
+	// of causing a hitch. The meshes are uploaded in the order their import
+	// finished.
+	//
+	// MeshLoadOptions::pThreadPool may be shared with the app, its ParallelFor()
+	// calls are serialized. The loader must be destroyed on the GL thread and
+	// before that thread pool.
+	//
+	class MeshLoader
+	{
+	public:
+		explicit MeshLoader(uint NumThreads = 1)
+		{
+			for (uint i = 0; i < std::max(NumThreads, 1u); i++)
+			{
+				m_workers.emplace_back([this]() { WorkerMain(); });
+			}
+		}
+
+		MeshLoader(const MeshLoader&) = delete;
+
+		MeshLoader&
+		operator=(const MeshLoader&) = delete;
+
+		// The imports that didn't start are dropped, the running ones are waited for
+		~MeshLoader()
+		{
+			{
+				std::lock_guard<std::mutex> Lock(m_mutex);
+				m_isQuitting = true;
+			}
+
+			m_wakeCV.notify_all();
+
+			for (std::thread& Worker : m_workers)
+			{
+				Worker.join();
+			}
+		}
+
+		std::shared_ptr<AsyncMesh>
+		LoadMeshAsync(const std::string& Filename, const MeshLoadOptions& Options = MeshLoadOptions())
+		{
+			std::shared_ptr<AsyncMesh> pAsyncMesh = std::make_shared<AsyncMesh>();
+			pAsyncMesh->m_filename = Filename;
+			pAsyncMesh->m_options = Options;
+			pAsyncMesh->m_pMesh.reset(new BasicMesh());
+
+			{
+				std::lock_guard<std::mutex> Lock(m_mutex);
+				m_importQueue.push_back(pAsyncMesh);
+			}
+
+			m_wakeCV.notify_one();
+
+			return pAsyncMesh;
+		}
+
+		//
+		// Uploads the imported meshes for about BudgetMs milliseconds. At least one
+		// part is uploaded if there is any so the loading always moves on. Returns
+		// the number of meshes that became ready.
+		//
+		uint
+		Update(float BudgetMs)
+		{
+			std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+			std::chrono::duration<float, std::milli> Budget(BudgetMs);
+			uint NumReady = 0;
+
+			for (;;)
+			{
+				std::shared_ptr<AsyncMesh> pAsyncMesh;
+
+				{
+					std::lock_guard<std::mutex> Lock(m_mutex);
+
+					if (m_uploadQueue.empty())
+					{
+						break;
+					}
+
+					pAsyncMesh = m_uploadQueue.front();
+				}
+
+				// Only this thread takes meshes off the upload queue
+				if (pAsyncMesh->m_pMesh->UploadNextPart())
+				{
+					{
+						std::lock_guard<std::mutex> Lock(m_mutex);
+						m_uploadQueue.pop_front();
+					}
+
+					pAsyncMesh->m_state.store(AsyncMesh::READY, std::memory_order_release);
+					NumReady++;
+				}
+
+				if (std::chrono::steady_clock::now() - Start >= Budget)
+				{
+					break;
+				}
+			}
+
+			return NumReady;
+		}
+
+		// Nothing is queued, importing or waiting for Update()
+		bool
+		IsIdle() const
+		{
+			std::lock_guard<std::mutex> Lock(m_mutex);
+			return m_importQueue.empty() && m_uploadQueue.empty() && (m_numImporting == 0);
+		}
+
+	private:
+		void
+		WorkerMain()
+		{
+			for (;;)
+			{
+				std::shared_ptr<AsyncMesh> pAsyncMesh;
+
+				{
+					std::unique_lock<std::mutex> Lock(m_mutex);
+					m_wakeCV.wait(Lock, [this]() { return m_isQuitting || !m_importQueue.empty(); });
+
+					if (m_isQuitting)
+					{
+						return;
+					}
+
+					pAsyncMesh = m_importQueue.front();
+					m_importQueue.pop_front();
+					m_numImporting++;
+				}
+
+				pAsyncMesh->m_state.store(AsyncMesh::IMPORTING, std::memory_order_release);
+
+				bool IsImported = pAsyncMesh->m_pMesh->ImportMesh(pAsyncMesh->m_filename, pAsyncMesh->m_options);
+
+				if (!IsImported)
+				{
+					printf("Error loading mesh '%s' in the background\n", pAsyncMesh->m_filename.c_str());
+				}
+
+				{
+					std::lock_guard<std::mutex> Lock(m_mutex);
+					m_numImporting--;
+
+					if (IsImported)
+					{
+						pAsyncMesh->m_state.store(AsyncMesh::UPLOADING, std::memory_order_release);
+						m_uploadQueue.push_back(pAsyncMesh);
+					}
+					else
+					{
+						pAsyncMesh->m_state.store(AsyncMesh::FAILED, std::memory_order_release);
+					}
+				}
+			}
+		}
+
+		std::vector<std::thread> m_workers;
+		mutable std::mutex m_mutex;
+		std::condition_variable m_wakeCV;
+
+		// Protected by m_mutex
+		std::deque<std::shared_ptr<AsyncMesh>> m_importQueue;
+		std::deque<std::shared_ptr<AsyncMesh>> m_uploadQueue; // imported, the front one may be partly uploaded
+		uint m_numImporting = 0;
+		bool m_isQuitting = false;
+	};
+} // namespace ogl
@@ -90,6 +90,19 @@ operator*(const Quaternion& q, const Vector3f& v)
 	return ret;
 }
 
+// Euler angles in degrees to the quaternion that Matrix4f::InitRotateTransform(const Quaternion&)
+// turns into the same matrix as Matrix4f::InitRotateTransform(x, y, z), i.e. Z * Y * X.
+// The quaternion to matrix conversion is left handed so the order is reversed here.
+inline Quaternion
+QuaternionFromEuler(float RotateX, float RotateY, float RotateZ)
+{
+	Quaternion RotationX(RotateX, Vector3f(1.0f, 0.0f, 0.0f));
+	Quaternion RotationY(RotateY, Vector3f(0.0f, 1.0f, 0.0f));
+	Quaternion RotationZ(RotateZ, Vector3f(0.0f, 0.0f, 1.0f));
+
+	return RotationX * RotationY * RotationZ;
+}
+
 void
 Rotate(Vector3f& vector, float Angle, const Vector3f& Axis)
 {
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <float.h>
+#include <math.h>
+
+#include <ogldev/AABB.h>
+#include <ogldev/mat4f.h>
+#include <ogldev/vec3f.h>
+
+//
+// A ray with a precomputed reciprocal direction for the slab tests. The
+// direction doesn't have to be normalized, the hit distances are in units of
+// its length.
+//
+struct Ray
+{
+	Vector3f Origin;
+	Vector3f Dir;
+	Vector3f InvDir;
+
+	Ray() {}
+
+	Ray(const Vector3f& _Origin, const Vector3f& _Dir)
+	{
+		Origin = _Origin;
+		Dir = _Dir;
+		InvDir = Vector3f(1.0f / Dir.x, 1.0f / Dir.y, 1.0f / Dir.z);
+	}
+
+	Vector3f
+	GetPoint(float t) const
+	{
+		return Origin + Dir * t;
+	}
+};
+
+//
+// Slab test. Returns true if the ray hits the box inside [0, tMax] and the
+// distance at which it enters it (0 when the origin is inside the box).
+// Zero direction components give infinite reciprocals which the min/max
+// ordering handles.
+//
+inline bool
+RayIntersectsAABB(const Ray& r, const AABB& aabb, float tMax, float& tEntry)
+{
+	float tx1 = (aabb.MinX - r.Origin.x) * r.InvDir.x;
+	float tx2 = (aabb.MaxX - r.Origin.x) * r.InvDir.x;
+	float tNear = fminf(tx1, tx2);
+	float tFar = fmaxf(tx1, tx2);
+
+	float ty1 = (aabb.MinY - r.Origin.y) * r.InvDir.y;
+	float ty2 = (aabb.MaxY - r.Origin.y) * r.InvDir.y;
+	tNear = fmaxf(tNear, fminf(ty1, ty2));
+	tFar = fminf(tFar, fmaxf(ty1, ty2));
+
+	float tz1 = (aabb.MinZ - r.Origin.z) * r.InvDir.z;
+	float tz2 = (aabb.MaxZ - r.Origin.z) * r.InvDir.z;
+	tNear = fmaxf(tNear, fminf(tz1, tz2));
+	tFar = fminf(tFar, fmaxf(tz1, tz2));
+
+	tEntry = fmaxf(tNear, 0.0f);
+
+	return (tFar >= tEntry) && (tNear <= tMax);
+}
+
+//
+// Moves the ray into another space, e.g. from world space into the local space
+// of an object using the inverse of its world matrix. The direction is not
+// normalized so the hit distances are the same in both spaces.
+//
+inline Ray
+TransformRay(const Matrix4f& m, const Ray& r)
+{
+	Vector4f Origin = m * Vector4f(r.Origin, 1.0f);
+	Vector4f Dir = m * Vector4f(r.Dir, 0.0f);
+
+	return Ray(Origin.to3f(), Dir.to3f());
+}
+
+//
+// Moller-Trumbore ray/triangle test, both sides of the triangle count. On a hit
+// inside [0, tMax] returns the distance and the barycentrics of the hit point:
+// p = (1 - u - v) * v0 + u * v1 + v * v2.
+//
+inline bool
+RayIntersectsTriangle(
+	const Ray& r,
+	const Vector3f& v0,
+	const Vector3f& v1,
+	const Vector3f& v2,
+	float tMax,
+	float& t,
+	float& u,
+	float& v)
+{
+	Vector3f Edge1 = v1 - v0;
+	Vector3f Edge2 = v2 - v0;
+	Vector3f P = r.Dir.Cross(Edge2);
+	float det = Edge1.Dot(P);
+
+	// Parallel to the plane of the triangle (or a degenerate triangle)
+	if (det == 0.0f)
+	{
+		return false;
+	}
+
+	float InvDet = 1.0f / det;
+	Vector3f T = r.Origin - v0;
+
+	u = T.Dot(P) * InvDet;
+
+	if ((u < 0.0f) || (u > 1.0f))
+	{
+		return false;
+	}
+
+	Vector3f Q = T.Cross(Edge1);
+
+	v = r.Dir.Dot(Q) * InvDet;
+
+	if ((v < 0.0f) || (u + v > 1.0f))
+	{
+		return false;
+	}
+
+	t = Edge2.Dot(Q) * InvDet;
+
+	return (t >= 0.0f) && (t <= tMax);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+//
+// SIMD backend selection for the math headers.
+//
+// The widest instruction set that the compiler targets is picked up
+// automatically (SSE2 is always available on x86-64, AVX/FMA require
+// -mavx2 -mfma or /arch:AVX2, see OGLDEV_USE_AVX in CMakeLists.txt).
+// Define OGLDEV_NO_SIMD before including any ogldev header to force the
+// scalar code paths.
+//
+
+#ifndef OGLDEV_NO_SIMD
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define OGLDEV_SSE
+#endif
+
+#if defined(OGLDEV_SSE) && defined(__AVX__)
+#define OGLDEV_AVX
+#endif
+
+#if defined(OGLDEV_AVX) && defined(__FMA__)
+#define OGLDEV_FMA
+#endif
+
+#endif // OGLDEV_NO_SIMD
+
+#if defined(OGLDEV_AVX)
+#include <immintrin.h>
+#elif defined(OGLDEV_SSE)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+#ifdef OGLDEV_SSE
+
+#define OGLDEV_SHUFFLE_MASK(x, y, z, w) ((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
+#define OGLDEV_SWIZZLE(v, x, y, z, w) _mm_shuffle_ps((v), (v), OGLDEV_SHUFFLE_MASK(x, y, z, w))
+#define OGLDEV_SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps((a), (b), OGLDEV_SHUFFLE_MASK(x, y, z, w))
+
+// a * b + c
+inline __m128
+SimdMulAdd(__m128 a, __m128 b, __m128 c)
+{
+#ifdef OGLDEV_FMA
+	return _mm_fmadd_ps(a, b, c);
+#else
+	return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+
+// Returns the sum of the four lanes in every lane
+inline __m128
+SimdHorizontalSum(__m128 v)
+{
+	__m128 t = _mm_add_ps(v, OGLDEV_SWIZZLE(v, 1, 0, 3, 2));
+	return _mm_add_ps(t, OGLDEV_SWIZZLE(t, 2, 3, 0, 1));
+}
+
+#endif // OGLDEV_SSE
+
+#ifdef OGLDEV_AVX
+
+// Same as OGLDEV_SHUFFLE, applied to both 128 bit lanes independently
+#define OGLDEV_SHUFFLE256(a, b, x, y, z, w) _mm256_shuffle_ps((a), (b), OGLDEV_SHUFFLE_MASK(x, y, z, w))
+
+inline __m256
+SimdMulAdd(__m256 a, __m256 b, __m256 c)
+{
+#ifdef OGLDEV_FMA
+	return _mm256_fmadd_ps(a, b, c);
+#else
+	return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+#endif // OGLDEV_AVX
@@ -0,0 +1,653 @@
+#pragma once
+
+#include <assert.h>
+#include <math.h>
+#include <vector>
+
+#include <ogldev/AABB.h>
+#include <ogldev/frustum.h>
+#include <ogldev/types.h>
+#include <ogldev/world_transform.h>
+
+namespace ogl
+{
+	//
+	// Loose uniform grid stored in a hash table, for objects that move a lot or
+	// are created and destroyed every frame (particles, projectiles, crowds).
+	//
+	// Every object lives in exactly one cell, the one that contains the center of
+	// its box. The cells are "loose": a cell is treated as if it were grown by half
+	// a cell on every side, so an object whose half extents are at most half a
+	// cell always fits inside the loose cell. Larger objects are kept in a
+	// separate list and tested one by one. Only the cells that contain objects
+	// are stored, so the world has no bounds.
+	//
+	// Insert, Remove and Move are O(1). Objects come from a pool with a free list
+	// and the cells are linked lists threaded through the pool. The memory only
+	// grows until the largest object count seen so far is reached, after which
+	// nothing is allocated any more (Reserve() does it up front).
+	//
+	// The queries append the user data of the objects they find. QueryFrustum
+	// keeps per cell and per object plane caches, so a single grid must not be
+	// frustum-queried from several threads at once.
+	//
+	class SpatialHashGrid
+	{
+	public:
+		static constexpr uint INVALID_HANDLE = 0xFFFFFFFF;
+
+		SpatialHashGrid(float CellSize = 1.0f) { SetCellSize(CellSize); }
+
+		// Only allowed while the grid is empty. A few times the size of a typical
+		// object works well: smaller cells mean more cells to visit in QueryFrustum,
+		// larger ones more objects per cell to test.
+		void
+		SetCellSize(float CellSize)
+		{
+			assert(m_numObjects == 0);
+			assert(CellSize > 0.0f);
+			m_cellSize = CellSize;
+			m_invCellSize = 1.0f / CellSize;
+		}
+
+		float
+		GetCellSize() const
+		{
+			return m_cellSize;
+		}
+
+		void
+		Reserve(uint NumObjects)
+		{
+			m_objects.reserve(NumObjects);
+			m_occupied.reserve(NumObjects);
+			m_oversized.reserve(NumObjects);
+
+			uint Capacity = 16;
+
+			while (Capacity < NumObjects * 2)
+			{
+				Capacity *= 2;
+			}
+
+			if (Capacity > m_cells.size())
+			{
+				Rehash(Capacity);
+			}
+		}
+
+		// Returns a handle for Move()/Remove()
+		uint
+		Insert(const AABB& WorldBox, uint UserData)
+		{
+			uint Handle;
+
+			if (m_freeHead != INVALID_HANDLE)
+			{
+				Handle = m_freeHead;
+				m_freeHead = m_objects[Handle].Next;
+			}
+			else
+			{
+				Handle = (uint)m_objects.size();
+				m_objects.push_back(Object());
+			}
+
+			Object& o = m_objects[Handle];
+			o.Box = WorldBox;
+			o.UserData = UserData;
+			o.IsAlive = true;
+			o.Cache = CullingCache();
+
+			Link(Handle);
+
+			m_numObjects++;
+
+			return Handle;
+		}
+
+		// Bounds of a mesh placed in the world by a WorldTrans
+		uint
+		Insert(const WorldTrans& Trans, const AABB& LocalBox, uint UserData)
+		{
+			return Insert(Trans.GetMatrix().TransformAABB(LocalBox), UserData);
+		}
+
+		void
+		Remove(uint Handle)
+		{
+			assert(IsValid(Handle));
+
+			Unlink(Handle);
+
+			Object& o = m_objects[Handle];
+			o.IsAlive = false;
+			o.Next = m_freeHead;
+			m_freeHead = Handle;
+
+			m_numObjects--;
+		}
+
+		void
+		Move(uint Handle, const AABB& WorldBox)
+		{
+			assert(IsValid(Handle));
+
+			Object& o = m_objects[Handle];
+			bool IsSameCell = IsOversizedBox(WorldBox);
+
+			if (IsSameCell)
+			{
+				IsSameCell = o.IsOversized;
+			}
+			else if (!o.IsOversized)
+			{
+				int x, y, z;
+				CalcCellCoords(WorldBox, x, y, z);
+				IsSameCell = (x == o.CellX) && (y == o.CellY) && (z == o.CellZ);
+			}
+
+			// Most moves stay inside the same loose cell and only update the box
+			if (IsSameCell)
+			{
+				o.Box = WorldBox;
+			}
+			else
+			{
+				Unlink(Handle);
+				o.Box = WorldBox;
+				Link(Handle);
+			}
+		}
+
+		void
+		Move(uint Handle, const WorldTrans& Trans, const AABB& LocalBox)
+		{
+			Move(Handle, Trans.GetMatrix().TransformAABB(LocalBox));
+		}
+
+		void
+		Clear()
+		{
+			for (uint i = 0; i < (uint)m_cells.size(); i++)
+			{
+				m_cells[i].Head = INVALID_HANDLE;
+			}
+
+			m_objects.clear();
+			m_occupied.clear();
+			m_oversized.clear();
+			m_freeHead = INVALID_HANDLE;
+			m_numObjects = 0;
+		}
+
+		bool
+		IsValid(uint Handle) const
+		{
+			return (Handle < m_objects.size()) && m_objects[Handle].IsAlive;
+		}
+
+		const AABB&
+		GetBox(uint Handle) const
+		{
+			return m_objects[Handle].Box;
+		}
+
+		uint
+		GetUserData(uint Handle) const
+		{
+			return m_objects[Handle].UserData;
+		}
+
+		uint
+		GetNumObjects() const
+		{
+			return m_numObjects;
+		}
+
+		uint
+		GetNumOccupiedCells() const
+		{
+			return (uint)m_occupied.size();
+		}
+
+		void
+		QueryFrustum(const FrustumCulling& Frustum, std::vector<uint>& UserData) const
+		{
+			for (uint i = 0; i < (uint)m_occupied.size(); i++)
+			{
+				Cell& c = m_cells[m_occupied[i]];
+				uint Mask = 0;
+
+				if (!Frustum.IsAABBInsideViewFrustum(GetLooseCellBox(c), c.Cache, 0, &Mask))
+				{
+					continue;
+				}
+
+				for (uint h = c.Head; h != INVALID_HANDLE; h = m_objects[h].Next)
+				{
+					Object& o = m_objects[h];
+
+					if ((Mask == FrustumCulling::ALL_PLANES_MASK) || Frustum.IsAABBInsideViewFrustum(o.Box, o.Cache, Mask))
+					{
+						UserData.push_back(o.UserData);
+					}
+				}
+			}
+
+			for (uint h : m_oversized)
+			{
+				Object& o = m_objects[h];
+
+				if (Frustum.IsAABBInsideViewFrustum(o.Box, o.Cache))
+				{
+					UserData.push_back(o.UserData);
+				}
+			}
+		}
+
+		void
+		QuerySphere(const Vector3f& Center, float Radius, std::vector<uint>& UserData) const
+		{
+			AABB SphereBox;
+			SphereBox.MinX = Center.x - Radius;
+			SphereBox.MaxX = Center.x + Radius;
+			SphereBox.MinY = Center.y - Radius;
+			SphereBox.MaxY = Center.y + Radius;
+			SphereBox.MinZ = Center.z - Radius;
+			SphereBox.MaxZ = Center.z + Radius;
+
+			float RadiusSq = Radius * Radius;
+
+			ForEachCandidate(SphereBox, [&](const Object& o) {
+				if (SqDistanceToBox(Center, o.Box) <= RadiusSq)
+				{
+					UserData.push_back(o.UserData);
+				}
+			});
+		}
+
+		void
+		QuerySphere(const BoundingSphere& Sphere, std::vector<uint>& UserData) const
+		{
+			QuerySphere(Sphere.Center, Sphere.Radius, UserData);
+		}
+
+		void
+		QueryAABB(const AABB& Box, std::vector<uint>& UserData) const
+		{
+			ForEachCandidate(Box, [&](const Object& o) {
+				if (o.Box.Intersects(Box))
+				{
+					UserData.push_back(o.UserData);
+				}
+			});
+		}
+
+	private:
+		struct Object
+		{
+			AABB Box;
+			uint UserData = 0;
+			uint Next = INVALID_HANDLE; // Next object in the cell or in the free list
+			uint Prev = INVALID_HANDLE;
+			int CellX = 0;
+			int CellY = 0;
+			int CellZ = 0;
+			uint CellSlot = 0;	// Slot of the cell in m_cells
+			uint ListIndex = 0; // Index in m_oversized
+			bool IsAlive = false;
+			bool IsOversized = false;
+			CullingCache Cache;
+		};
+
+		struct Cell
+		{
+			int x = 0;
+			int y = 0;
+			int z = 0;
+			uint Head = INVALID_HANDLE; // INVALID_HANDLE marks an empty slot
+			uint Count = 0;
+			uint OccupiedIndex = 0; // Index in m_occupied
+			CullingCache Cache;
+		};
+
+		bool
+		IsOversizedBox(const AABB& Box) const
+		{
+			float MaxSize = std::max(Box.MaxX - Box.MinX, std::max(Box.MaxY - Box.MinY, Box.MaxZ - Box.MinZ));
+			return MaxSize > m_cellSize;
+		}
+
+		void
+		CalcCellCoords(const AABB& Box, int& x, int& y, int& z) const
+		{
+			x = (int)floorf((Box.MinX + Box.MaxX) * 0.5f * m_invCellSize);
+			y = (int)floorf((Box.MinY + Box.MaxY) * 0.5f * m_invCellSize);
+			z = (int)floorf((Box.MinZ + Box.MaxZ) * 0.5f * m_invCellSize);
+		}
+
+		static uint
+		HashCell(int x, int y, int z)
+		{
+			uint h = ((uint)x * 73856093u) ^ ((uint)y * 19349663u) ^ ((uint)z * 83492791u);
+			h ^= h >> 16;
+			h *= 0x7FEB352Du;
+			h ^= h >> 15;
+			return h;
+		}
+
+		// The cell grown by half a cell on every side
+		AABB
+		GetLooseCellBox(const Cell& c) const
+		{
+			AABB Box;
+			Box.MinX = ((float)c.x - 0.5f) * m_cellSize;
+			Box.MaxX = ((float)c.x + 1.5f) * m_cellSize;
+			Box.MinY = ((float)c.y - 0.5f) * m_cellSize;
+			Box.MaxY = ((float)c.y + 1.5f) * m_cellSize;
+			Box.MinZ = ((float)c.z - 0.5f) * m_cellSize;
+			Box.MaxZ = ((float)c.z + 1.5f) * m_cellSize;
+			return Box;
+		}
+
+		static float
+		SqDistanceToBox(const Vector3f& p, const AABB& Box)
+		{
+			float dx = std::max(std::max(Box.MinX - p.x, p.x - Box.MaxX), 0.0f);
+			float dy = std::max(std::max(Box.MinY - p.y, p.y - Box.MaxY), 0.0f);
+			float dz = std::max(std::max(Box.MinZ - p.z, p.z - Box.MaxZ), 0.0f);
+			return dx * dx + dy * dy + dz * dz;
+		}
+
+		// Slot of the cell or INVALID_HANDLE
+		uint
+		FindCell(int x, int y, int z) const
+		{
+			if (m_cells.empty())
+			{
+				return INVALID_HANDLE;
+			}
+
+			uint Mask = (uint)m_cells.size() - 1;
+
+			for (uint Slot = HashCell(x, y, z) & Mask;; Slot = (Slot + 1) & Mask)
+			{
+				const Cell& c = m_cells[Slot];
+
+				if (c.Head == INVALID_HANDLE)
+				{
+					return INVALID_HANDLE;
+				}
+
+				if ((c.x == x) && (c.y == y) && (c.z == z))
+				{
+					return Slot;
+				}
+			}
+		}
+
+		uint
+		FindOrAddCell(int x, int y, int z)
+		{
+			// Keep the load factor under 1/2
+			if ((m_occupied.size() + 1) * 2 > m_cells.size())
+			{
+				Rehash(m_cells.empty() ? 16 : (uint)m_cells.size() * 2);
+			}
+
+			uint Mask = (uint)m_cells.size() - 1;
+			uint Slot = HashCell(x, y, z) & Mask;
+
+			while (m_cells[Slot].Head != INVALID_HANDLE)
+			{
+				const Cell& c = m_cells[Slot];
+
+				if ((c.x == x) && (c.y == y) && (c.z == z))
+				{
+					return Slot;
+				}
+
+				Slot = (Slot + 1) & Mask;
+			}
+
+			// The caller links an object right away so the slot becomes occupied
+			Cell& c = m_cells[Slot];
+			c.x = x;
+			c.y = y;
+			c.z = z;
+			c.Count = 0;
+			c.Cache = CullingCache();
+			c.OccupiedIndex = (uint)m_occupied.size();
+			m_occupied.push_back(Slot);
+
+			return Slot;
+		}
+
+		// Backward shift deletion keeps the probe sequences intact without tombstones
+		void
+		RemoveCell(uint Slot)
+		{
+			uint Mask = (uint)m_cells.size() - 1;
+
+			RemoveFromOccupied(m_cells[Slot].OccupiedIndex);
+			m_cells[Slot].Head = INVALID_HANDLE;
+
+			uint Hole = Slot;
+
+			for (uint i = (Slot + 1) & Mask; m_cells[i].Head != INVALID_HANDLE; i = (i + 1) & Mask)
+			{
+				uint Home = HashCell(m_cells[i].x, m_cells[i].y, m_cells[i].z) & Mask;
+
+				// Move the cell into the hole unless its home slot is cyclically in (Hole, i]
+				bool IsHomeBetween = (Hole <= i) ? ((Home > Hole) && (Home <= i)) : ((Home > Hole) || (Home <= i));
+
+				if (!IsHomeBetween)
+				{
+					m_cells[Hole] = m_cells[i];
+					m_cells[i].Head = INVALID_HANDLE;
+					OnCellMoved(Hole);
+					Hole = i;
+				}
+			}
+		}
+
+		void
+		RemoveFromOccupied(uint Index)
+		{
+			uint LastSlot = m_occupied.back();
+			m_occupied[Index] = LastSlot;
+			m_cells[LastSlot].OccupiedIndex = Index;
+			m_occupied.pop_back();
+		}
+
+		void
+		Rehash(uint Capacity)
+		{
+			std::vector<Cell> OldCells;
+			OldCells.swap(m_cells);
+			m_cells.resize(Capacity);
+			m_occupied.clear();
+
+			uint Mask = Capacity - 1;
+
+			for (const Cell& c : OldCells)
+			{
+				if (c.Head == INVALID_HANDLE)
+				{
+					continue;
+				}
+
+				uint Slot = HashCell(c.x, c.y, c.z) & Mask;
+
+				while (m_cells[Slot].Head != INVALID_HANDLE)
+				{
+					Slot = (Slot + 1) & Mask;
+				}
+
+				m_cells[Slot] = c;
+				m_cells[Slot].OccupiedIndex = (uint)m_occupied.size();
+				m_occupied.push_back(0);
+				OnCellMoved(Slot);
+			}
+		}
+
+		// The objects keep the slot of their cell so that unlinking doesn't need a lookup
+		void
+		OnCellMoved(uint Slot)
+		{
+			const Cell& c = m_cells[Slot];
+			m_occupied[c.OccupiedIndex] = Slot;
+
+			for (uint h = c.Head; h != INVALID_HANDLE; h = m_objects[h].Next)
+			{
+				m_objects[h].CellSlot = Slot;
+			}
+		}
+
+		void
+		Link(uint Handle)
+		{
+			Object& o = m_objects[Handle];
+			o.Prev = INVALID_HANDLE;
+			o.IsOversized = IsOversizedBox(o.Box);
+
+			if (o.IsOversized)
+			{
+				o.ListIndex = (uint)m_oversized.size();
+				o.Next = INVALID_HANDLE;
+				m_oversized.push_back(Handle);
+				return;
+			}
+
+			CalcCellCoords(o.Box, o.CellX, o.CellY, o.CellZ);
+
+			uint Slot = FindOrAddCell(o.CellX, o.CellY, o.CellZ);
+			Cell& c = m_cells[Slot];
+
+			o.CellSlot = Slot;
+			o.Next = c.Head;
+
+			if (c.Head != INVALID_HANDLE)
+			{
+				m_objects[c.Head].Prev = Handle;
+			}
+
+			c.Head = Handle;
+			c.Count++;
+		}
+
+		void
+		Unlink(uint Handle)
+		{
+			Object& o = m_objects[Handle];
+
+			if (o.IsOversized)
+			{
+				uint Last = m_oversized.back();
+				m_oversized[o.ListIndex] = Last;
+				m_objects[Last].ListIndex = o.ListIndex;
+				m_oversized.pop_back();
+				return;
+			}
+
+			uint Slot = o.CellSlot;
+			Cell& c = m_cells[Slot];
+			assert((c.x == o.CellX) && (c.y == o.CellY) && (c.z == o.CellZ));
+
+			if (o.Prev != INVALID_HANDLE)
+			{
+				m_objects[o.Prev].Next = o.Next;
+			}
+			else
+			{
+				c.Head = o.Next;
+			}
+
+			if (o.Next != INVALID_HANDLE)
+			{
+				m_objects[o.Next].Prev = o.Prev;
+			}
+
+			c.Count--;
+
+			if (c.Count == 0)
+			{
+				RemoveCell(Slot);
+			}
+		}
+
+		// Calls f for every object whose loose cell overlaps Box, then for the oversized ones
+		template <typename Func>
+		void
+		ForEachCandidate(const AABB& Box, Func f) const
+		{
+			// An object's center is at most half a cell outside of Box if the object overlaps it
+			float Half = 0.5f * m_cellSize;
+			int x0 = (int)floorf((Box.MinX - Half) * m_invCellSize);
+			int y0 = (int)floorf((Box.MinY - Half) * m_invCellSize);
+			int z0 = (int)floorf((Box.MinZ - Half) * m_invCellSize);
+			int x1 = (int)floorf((Box.MaxX + Half) * m_invCellSize);
+			int y1 = (int)floorf((Box.MaxY + Half) * m_invCellSize);
+			int z1 = (int)floorf((Box.MaxZ + Half) * m_invCellSize);
+
+			double NumRangeCells = (double)(x1 - x0 + 1) * (double)(y1 - y0 + 1) * (double)(z1 - z0 + 1);
+
+			if (NumRangeCells <= (double)m_occupied.size())
+			{
+				// Small query - probe the hash table for every cell in range
+				for (int z = z0; z <= z1; z++)
+				{
+					for (int y = y0; y <= y1; y++)
+					{
+						for (int x = x0; x <= x1; x++)
+						{
+							uint Slot = FindCell(x, y, z);
+
+							if (Slot != INVALID_HANDLE)
+							{
+								for (uint h = m_cells[Slot].Head; h != INVALID_HANDLE; h = m_objects[h].Next)
+								{
+									f(m_objects[h]);
+								}
+							}
+						}
+					}
+				}
+			}
+			else
+			{
+				// Large query - cheaper to walk the occupied cells
+				for (uint Slot : m_occupied)
+				{
+					const Cell& c = m_cells[Slot];
+
+					if ((c.x < x0) || (c.x > x1) || (c.y < y0) || (c.y > y1) || (c.z < z0) || (c.z > z1))
+					{
+						continue;
+					}
+
+					for (uint h = c.Head; h != INVALID_HANDLE; h = m_objects[h].Next)
+					{
+						f(m_objects[h]);
+					}
+				}
+			}
+
+			for (uint h : m_oversized)
+			{
+				f(m_objects[h]);
+			}
+		}
+
+		float m_cellSize = 1.0f;
+		float m_invCellSize = 1.0f;
+
+		mutable std::vector<Object> m_objects;
+		mutable std::vector<Cell> m_cells; // Open addressing, power of two size
+		std::vector<uint> m_occupied;	   // Slots of the non empty cells
+		std::vector<uint> m_oversized;	   // Objects larger than a cell
+		uint m_freeHead = INVALID_HANDLE;
+		uint m_numObjects = 0;
+	};
+}
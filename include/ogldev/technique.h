@@ -26,7 +26,7 @@ public:
 
 protected:
 	bool
-	AddShader(GLenum ShaderType, const char* pFilename);
+	AddShader(GLenum ShaderType, const char* pFilename, const char* pDefines = NULL);
 
 	bool
 	Finalize();
@@ -75,9 +75,10 @@ Technique::Init()
 }
 
 // Use this method to add shaders to the program. When finished - call
-// finalize()
+// finalize(). pDefines (e.g. "#define FOO\n") is inserted right after the
+// #version line to compile variants of the same file.
 bool
-Technique::AddShader(GLenum ShaderType, const char* pFilename)
+Technique::AddShader(GLenum ShaderType, const char* pFilename, const char* pDefines)
 {
 	string s;
 
@@ -86,6 +87,20 @@ Technique::AddShader(GLenum ShaderType, const char* pFilename)
 		return false;
 	}
 
+	if (pDefines)
+	{
+		size_t InsertPos = 0;
+		size_t VersionPos = s.find("#version");
+
+		if (VersionPos != string::npos)
+		{
+			size_t LineEnd = s.find('\n', VersionPos);
+			InsertPos = (LineEnd == string::npos) ? s.size() : LineEnd + 1;
+		}
+
+		s.insert(InsertPos, pDefines);
+	}
+
 	GLuint ShaderObj = glCreateShader(ShaderType);
 
 	if (ShaderObj == 0)
@@ -21,36 +21,95 @@ public:
 
 	Texture(GLenum TextureTarget) { m_textureTarget = TextureTarget; }
 
+	~Texture()
+	{
+		if (m_pImageData)
+		{
+			stbi_image_free(m_pImageData);
+		}
+	}
+
 	// Should be called once to load the texture
 	bool
 	Load()
 	{
-		stbi_set_flip_vertically_on_load(1);
+		if (!Decode())
+		{
+			exit(0);
+		}
 
-		unsigned char* pImageData = stbi_load(m_fileName.c_str(), &m_imageWidth, &m_imageHeight, &m_imageBPP, 0);
+		Upload();
+
+		return true;
+	}
 
-		if (!pImageData)
+	void
+	Load(unsigned int BufferSize, const void* pData)
+	{
+		if (Decode(BufferSize, pData))
+		{
+			Upload();
+		}
+	}
+
+	//
+	// Load() in two steps for loading on a background thread. Decode() reads the
+	// image into memory without any GL call, Upload() then creates the texture on
+	// the GL thread and releases the memory. The stb_image flip flag and failure
+	// reason are per thread so several threads can decode at the same time.
+	//
+	bool
+	Decode()
+	{
+		stbi_set_flip_vertically_on_load_thread(1);
+
+		m_pImageData = stbi_load(m_fileName.c_str(), &m_imageWidth, &m_imageHeight, &m_imageBPP, 0);
+
+		if (!m_pImageData)
 		{
 			printf("Can't load texture from '%s' - %s\n", m_fileName.c_str(), stbi_failure_reason());
-			exit(0);
+			return false;
 		}
 
 		printf("Width %d, height %d, bpp %d\n", m_imageWidth, m_imageHeight, m_imageBPP);
 
-		LoadInternal(pImageData);
+		return true;
+	}
+
+	// From a compressed image in memory
+	bool
+	Decode(unsigned int BufferSize, const void* pData)
+	{
+		stbi_set_flip_vertically_on_load_thread(1);
+
+		m_pImageData =
+			stbi_load_from_memory((const stbi_uc*)pData, BufferSize, &m_imageWidth, &m_imageHeight, &m_imageBPP, 0);
+
+		if (!m_pImageData)
+		{
+			printf("Can't decode texture - %s\n", stbi_failure_reason());
+			return false;
+		}
 
 		return true;
 	}
 
 	void
-	Load(unsigned int BufferSize, void* pData)
+	Upload()
 	{
-		void* pImageData =
-			stbi_load_from_memory((const stbi_uc*)pData, BufferSize, &m_imageWidth, &m_imageHeight, &m_imageBPP, 0);
+		assert(m_pImageData);
 
-		LoadInternal(pImageData);
+		LoadInternal(m_pImageData);
 
-		stbi_image_free(pImageData);
+		stbi_image_free(m_pImageData);
+		m_pImageData = NULL;
+	}
+
+	// Decoded and waiting for Upload()
+	bool
+	IsDecoded() const
+	{
+		return m_pImageData != NULL;
 	}
 
 	void
@@ -299,7 +358,8 @@ private:
 
 	std::string m_fileName;
 	GLenum m_textureTarget;
-	GLuint m_textureObj;
+	GLuint m_textureObj = 0;
+	unsigned char* m_pImageData = NULL; // between Decode() and Upload()
 	int m_imageWidth = 0;
 	int m_imageHeight = 0;
 	int m_imageBPP = 0;
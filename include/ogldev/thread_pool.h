@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ogldev/types.h>
+
+namespace ogl
+{
+	//
+	// A fixed set of worker threads for data parallel loops. ParallelFor() hands
+	// out the indices one at a time from a shared counter, so items of very
+	// different cost (e.g. the submeshes of a model) balance out by themselves.
+	// The calling thread works on the loop too and returns when every index was
+	// processed.
+	//
+	// Calls from different threads are serialized. The loop body must not call
+	// ParallelFor() on the same pool.
+	//
+	class ThreadPool
+	{
+	public:
+		// Zero uses one thread per hardware thread (including the caller)
+		explicit ThreadPool(uint NumThreads = 0)
+		{
+			if (NumThreads == 0)
+			{
+				NumThreads = std::max(std::thread::hardware_concurrency(), 1u);
+			}
+
+			for (uint i = 0; i < NumThreads - 1; i++)
+			{
+				m_workers.emplace_back([this]() { WorkerMain(); });
+			}
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+
+		ThreadPool&
+		operator=(const ThreadPool&) = delete;
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> Lock(m_mutex);
+				m_isQuitting = true;
+			}
+
+			m_wakeCV.notify_all();
+
+			for (std::thread& Worker : m_workers)
+			{
+				Worker.join();
+			}
+		}
+
+		// Including the thread that calls ParallelFor()
+		uint
+		GetNumThreads() const
+		{
+			return (uint)m_workers.size() + 1;
+		}
+
+		// Calls Func(i) for every i in [0, Count)
+		void
+		ParallelFor(uint Count, const std::function<void(uint)>& Func)
+		{
+			if (m_workers.empty() || (Count <= 1))
+			{
+				for (uint i = 0; i < Count; i++)
+				{
+					Func(i);
+				}
+
+				return;
+			}
+
+			std::lock_guard<std::mutex> CallLock(m_callMutex);
+
+			{
+				std::lock_guard<std::mutex> Lock(m_mutex);
+				m_pFunc = &Func;
+				m_count = Count;
+				m_next = 0;
+				m_numBusy = (uint)m_workers.size();
+				m_generation++;
+			}
+
+			m_wakeCV.notify_all();
+
+			RunLoop();
+
+			std::unique_lock<std::mutex> Lock(m_mutex);
+			m_doneCV.wait(Lock, [this]() { return m_numBusy == 0; });
+			m_pFunc = NULL;
+		}
+
+	private:
+		void
+		WorkerMain()
+		{
+			u64 Generation = 0;
+
+			for (;;)
+			{
+				{
+					std::unique_lock<std::mutex> Lock(m_mutex);
+					m_wakeCV.wait(Lock, [&]() { return m_isQuitting || (m_generation != Generation); });
+
+					if (m_isQuitting)
+					{
+						return;
+					}
+
+					Generation = m_generation;
+				}
+
+				RunLoop();
+
+				{
+					std::lock_guard<std::mutex> Lock(m_mutex);
+					m_numBusy--;
+				}
+
+				m_doneCV.notify_one();
+			}
+		}
+
+		void
+		RunLoop()
+		{
+			for (;;)
+			{
+				uint i = m_next.fetch_add(1);
+
+				if (i >= m_count)
+				{
+					return;
+				}
+
+				(*m_pFunc)(i);
+			}
+		}
+
+		std::vector<std::thread> m_workers;
+		std::mutex m_callMutex;
+		std::mutex m_mutex;
+		std::condition_variable m_wakeCV;
+		std::condition_variable m_doneCV;
+
+		// The current loop, protected by m_mutex except for m_next
+		const std::function<void(uint)>* m_pFunc = NULL;
+		uint m_count = 0;
+		std::atomic<uint> m_next{0};
+		uint m_numBusy = 0;
+		u64 m_generation = 0;
+		bool m_isQuitting = false;
+	};
+} // namespace ogl
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <cstddef>
+
+#include <ogldev/mat4f.h>
+#include <ogldev/simd.h>
+#include <ogldev/vec3f.h>
+#include <ogldev/vec4f.h>
+
+//
+// Transform a whole stream of points/directions by a single matrix.
+//
+// Points are transformed with an implicit w = 1, directions with w = 0. The
+// result is not divided by w so these are meant for affine matrices (world,
+// view, skinning, etc). The output may alias the input.
+//
+// Two layouts are supported:
+//   - packed (array of structures) with an arbitrary byte stride, e.g. the
+//     position inside an interleaved vertex
+//   - structure of arrays (separate x/y/z streams) which processes 4 (SSE) or
+//     8 (AVX) elements per iteration
+//
+
+namespace ogl
+{
+	namespace detail
+	{
+		inline const float*
+		StreamAt(const void* p, size_t Stride, size_t i)
+		{
+			return (const float*)((const char*)p + Stride * i);
+		}
+
+		inline float*
+		StreamAt(void* p, size_t Stride, size_t i)
+		{
+			return (float*)((char*)p + Stride * i);
+		}
+
+		template <bool IsPoint>
+		void
+		TransformPacked(const Matrix4f& m, const void* pIn, size_t InStride, void* pOut, size_t OutStride, size_t Count)
+		{
+#ifdef OGLDEV_SSE
+			// Work with the columns so that every element costs three broadcasts and three multiply-adds
+			__m128 C0 = _mm_load_ps(m.m[0]);
+			__m128 C1 = _mm_load_ps(m.m[1]);
+			__m128 C2 = _mm_load_ps(m.m[2]);
+			__m128 C3 = _mm_load_ps(m.m[3]);
+			_MM_TRANSPOSE4_PS(C0, C1, C2, C3);
+
+			for (size_t i = 0; i < Count; i++)
+			{
+				const float* pSrc = StreamAt(pIn, InStride, i);
+				float* pDst = StreamAt(pOut, OutStride, i);
+
+				__m128 R = IsPoint ? SimdMulAdd(C0, _mm_set1_ps(pSrc[0]), C3) : _mm_mul_ps(C0, _mm_set1_ps(pSrc[0]));
+				R = SimdMulAdd(C1, _mm_set1_ps(pSrc[1]), R);
+				R = SimdMulAdd(C2, _mm_set1_ps(pSrc[2]), R);
+
+				_mm_storel_pi((__m64*)pDst, R);
+				_mm_store_ss(pDst + 2, _mm_movehl_ps(R, R));
+			}
+#else
+			const float w = IsPoint ? 1.0f : 0.0f;
+
+			for (size_t i = 0; i < Count; i++)
+			{
+				const float* pSrc = StreamAt(pIn, InStride, i);
+				float* pDst = StreamAt(pOut, OutStride, i);
+
+				float x = pSrc[0];
+				float y = pSrc[1];
+				float z = pSrc[2];
+
+				pDst[0] = m.m[0][0] * x + m.m[0][1] * y + m.m[0][2] * z + m.m[0][3] * w;
+				pDst[1] = m.m[1][0] * x + m.m[1][1] * y + m.m[1][2] * z + m.m[1][3] * w;
+				pDst[2] = m.m[2][0] * x + m.m[2][1] * y + m.m[2][2] * z + m.m[2][3] * w;
+			}
+#endif
+		}
+
+		template <bool IsPoint>
+		void
+		TransformSoA(
+			const Matrix4f& m,
+			const float* pX,
+			const float* pY,
+			const float* pZ,
+			float* pOutX,
+			float* pOutY,
+			float* pOutZ,
+			size_t Count)
+		{
+			size_t i = 0;
+
+#if defined(OGLDEV_AVX)
+			__m256 M[3][4];
+
+			for (int r = 0; r < 3; r++)
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					M[r][c] = _mm256_set1_ps(IsPoint || (c < 3) ? m.m[r][c] : 0.0f);
+				}
+			}
+
+			for (; i + 8 <= Count; i += 8)
+			{
+				__m256 X = _mm256_loadu_ps(pX + i);
+				__m256 Y = _mm256_loadu_ps(pY + i);
+				__m256 Z = _mm256_loadu_ps(pZ + i);
+
+				__m256 R[3];
+
+				for (int r = 0; r < 3; r++)
+				{
+					R[r] = SimdMulAdd(M[r][0], X, M[r][3]);
+					R[r] = SimdMulAdd(M[r][1], Y, R[r]);
+					R[r] = SimdMulAdd(M[r][2], Z, R[r]);
+				}
+
+				_mm256_storeu_ps(pOutX + i, R[0]);
+				_mm256_storeu_ps(pOutY + i, R[1]);
+				_mm256_storeu_ps(pOutZ + i, R[2]);
+			}
+#elif defined(OGLDEV_SSE)
+			__m128 M[3][4];
+
+			for (int r = 0; r < 3; r++)
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					M[r][c] = _mm_set1_ps(IsPoint || (c < 3) ? m.m[r][c] : 0.0f);
+				}
+			}
+
+			for (; i + 4 <= Count; i += 4)
+			{
+				__m128 X = _mm_loadu_ps(pX + i);
+				__m128 Y = _mm_loadu_ps(pY + i);
+				__m128 Z = _mm_loadu_ps(pZ + i);
+
+				__m128 R[3];
+
+				for (int r = 0; r < 3; r++)
+				{
+					R[r] = SimdMulAdd(M[r][0], X, M[r][3]);
+					R[r] = SimdMulAdd(M[r][1], Y, R[r]);
+					R[r] = SimdMulAdd(M[r][2], Z, R[r]);
+				}
+
+				_mm_storeu_ps(pOutX + i, R[0]);
+				_mm_storeu_ps(pOutY + i, R[1]);
+				_mm_storeu_ps(pOutZ + i, R[2]);
+			}
+#endif
+
+			// Leftovers (or everything in the scalar build)
+			const float w = IsPoint ? 1.0f : 0.0f;
+
+			for (; i < Count; i++)
+			{
+				float x = pX[i];
+				float y = pY[i];
+				float z = pZ[i];
+
+				pOutX[i] = m.m[0][0] * x + m.m[0][1] * y + m.m[0][2] * z + m.m[0][3] * w;
+				pOutY[i] = m.m[1][0] * x + m.m[1][1] * y + m.m[1][2] * z + m.m[1][3] * w;
+				pOutZ[i] = m.m[2][0] * x + m.m[2][1] * y + m.m[2][2] * z + m.m[2][3] * w;
+			}
+		}
+	} // namespace detail
+
+	//
+	// Packed streams. The strides are in bytes and only the first three floats of every element are touched.
+	//
+	inline void
+	TransformPoints(const Matrix4f& m, const float* pIn, size_t InStride, float* pOut, size_t OutStride, size_t Count)
+	{
+		detail::TransformPacked<true>(m, pIn, InStride, pOut, OutStride, Count);
+	}
+
+	inline void
+	TransformDirections(
+		const Matrix4f& m,
+		const float* pIn,
+		size_t InStride,
+		float* pOut,
+		size_t OutStride,
+		size_t Count)
+	{
+		detail::TransformPacked<false>(m, pIn, InStride, pOut, OutStride, Count);
+	}
+
+	inline void
+	TransformPoints(const Matrix4f& m, const Vector3f* pIn, Vector3f* pOut, size_t Count)
+	{
+		TransformPoints(m, &pIn->x, sizeof(Vector3f), &pOut->x, sizeof(Vector3f), Count);
+	}
+
+	inline void
+	TransformDirections(const Matrix4f& m, const Vector3f* pIn, Vector3f* pOut, size_t Count)
+	{
+		TransformDirections(m, &pIn->x, sizeof(Vector3f), &pOut->x, sizeof(Vector3f), Count);
+	}
+
+	// Full 4x4 transform of homogeneous vectors
+	inline void
+	TransformVectors(const Matrix4f& m, const Vector4f* pIn, Vector4f* pOut, size_t Count)
+	{
+#ifdef OGLDEV_SSE
+		__m128 C0 = _mm_load_ps(m.m[0]);
+		__m128 C1 = _mm_load_ps(m.m[1]);
+		__m128 C2 = _mm_load_ps(m.m[2]);
+		__m128 C3 = _mm_load_ps(m.m[3]);
+		_MM_TRANSPOSE4_PS(C0, C1, C2, C3);
+
+		for (size_t i = 0; i < Count; i++)
+		{
+			__m128 V = _mm_loadu_ps(&pIn[i].x);
+
+			__m128 R = _mm_mul_ps(C0, OGLDEV_SWIZZLE(V, 0, 0, 0, 0));
+			R = SimdMulAdd(C1, OGLDEV_SWIZZLE(V, 1, 1, 1, 1), R);
+			R = SimdMulAdd(C2, OGLDEV_SWIZZLE(V, 2, 2, 2, 2), R);
+			R = SimdMulAdd(C3, OGLDEV_SWIZZLE(V, 3, 3, 3, 3), R);
+
+			_mm_storeu_ps(&pOut[i].x, R);
+		}
+#else
+		for (size_t i = 0; i < Count; i++)
+		{
+			pOut[i] = m * pIn[i];
+		}
+#endif
+	}
+
+	//
+	// Structure of arrays streams
+	//
+	inline void
+	TransformPointsSoA(
+		const Matrix4f& m,
+		const float* pX,
+		const float* pY,
+		const float* pZ,
+		float* pOutX,
+		float* pOutY,
+		float* pOutZ,
+		size_t Count)
+	{
+		detail::TransformSoA<true>(m, pX, pY, pZ, pOutX, pOutY, pOutZ, Count);
+	}
+
+	inline void
+	TransformDirectionsSoA(
+		const Matrix4f& m,
+		const float* pX,
+		const float* pY,
+		const float* pZ,
+		float* pOutX,
+		float* pOutY,
+		float* pOutZ,
+		size_t Count)
+	{
+		detail::TransformSoA<false>(m, pX, pY, pZ, pOutX, pOutY, pOutZ, Count);
+	}
+} // namespace ogl
@@ -0,0 +1,533 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <vector>
+
+#include <ogldev/mat4f.h>
+#include <ogldev/quat.h>
+#include <ogldev/types.h>
+
+namespace ogl
+{
+	//
+	// Parent/child hierarchy of transforms.
+	//
+	// The nodes live in flat arrays sorted in depth first pre-order, so a
+	// parent always comes before its children and the whole subtree of a node
+	// is the contiguous range [index, index + subtree size). Update() walks the
+	// sorted list of dirty nodes and recomputes only their subtree ranges in one
+	// linear pass. The cost per frame depends on the number of changed nodes
+	// (and their descendants), not on the size of the graph.
+	//
+	// Nodes are referred to by a NodeId which stays valid until the node is
+	// destroyed. Creating or re-parenting nodes just appends/patches the arrays
+	// and the pre-order is restored lazily in the next Update().
+	//
+	class TransformGraph
+	{
+	public:
+		typedef uint NodeId;
+
+		static constexpr NodeId INVALID_NODE = 0xFFFFFFFF;
+
+		TransformGraph() {}
+
+		void
+		Reserve(uint NumNodes)
+		{
+			m_parent.reserve(NumNodes);
+			m_subtreeSize.reserve(NumNodes);
+			m_indexToId.reserve(NumNodes);
+			m_localPos.reserve(NumNodes);
+			m_localRot.reserve(NumNodes);
+			m_localScale.reserve(NumNodes);
+			m_local.reserve(NumNodes);
+			m_world.reserve(NumNodes);
+			m_isDirty.reserve(NumNodes);
+			m_idToIndex.reserve(NumNodes);
+		}
+
+		NodeId
+		CreateNode(NodeId Parent = INVALID_NODE)
+		{
+			assert((Parent == INVALID_NODE) || IsValid(Parent));
+
+			NodeId Id;
+
+			if (m_freeIds.empty())
+			{
+				Id = (NodeId)m_idToIndex.size();
+				m_idToIndex.push_back(0);
+			}
+			else
+			{
+				Id = m_freeIds.back();
+				m_freeIds.pop_back();
+			}
+
+			uint Index = (uint)m_parent.size();
+			m_idToIndex[Id] = Index;
+
+			Matrix4f Identity;
+			Identity.InitIdentity();
+
+			m_parent.push_back((Parent == INVALID_NODE) ? INVALID_INDEX : m_idToIndex[Parent]);
+			m_subtreeSize.push_back(1);
+			m_indexToId.push_back(Id);
+			m_localPos.push_back(Vector3f(0.0f, 0.0f, 0.0f));
+			m_localRot.push_back(Quaternion(0.0f, 0.0f, 0.0f, 1.0f));
+			m_localScale.push_back(1.0f);
+			m_local.push_back(Identity);
+			m_world.push_back(Identity);
+			m_isDirty.push_back(0);
+
+			MarkDirty(Index);
+
+			// A new root at the end doesn't break the pre-order, a new child does
+			// (unless its parent is the last node, which is the usual case when
+			// a hierarchy is built top down)
+			if ((Parent != INVALID_NODE) && !IsLastSubtree(m_parent[Index], Index))
+			{
+				m_isOrderDirty = true;
+			}
+			else if (Parent != INVALID_NODE)
+			{
+				GrowAncestors(m_parent[Index], 1);
+			}
+
+			return Id;
+		}
+
+		// Destroys the node together with all of its descendants
+		void
+		DestroyNode(NodeId Node)
+		{
+			assert(IsValid(Node));
+
+			SortNodes();
+
+			uint Begin = m_idToIndex[Node];
+			uint Count = m_subtreeSize[Begin];
+			uint End = Begin + Count;
+
+			for (uint i = Begin; i < End; i++)
+			{
+				m_idToIndex[m_indexToId[i]] = INVALID_INDEX;
+				m_freeIds.push_back(m_indexToId[i]);
+			}
+
+			if (m_parent[Begin] != INVALID_INDEX)
+			{
+				GrowAncestors(m_parent[Begin], -(int)Count);
+			}
+
+			EraseRange(m_parent, Begin, End);
+			EraseRange(m_subtreeSize, Begin, End);
+			EraseRange(m_indexToId, Begin, End);
+			EraseRange(m_localPos, Begin, End);
+			EraseRange(m_localRot, Begin, End);
+			EraseRange(m_localScale, Begin, End);
+			EraseRange(m_local, Begin, End);
+			EraseRange(m_world, Begin, End);
+			EraseRange(m_isDirty, Begin, End);
+
+			// Removing a whole subtree keeps the pre-order, only the indices behind it move
+			for (uint i = Begin; i < (uint)m_parent.size(); i++)
+			{
+				if ((m_parent[i] != INVALID_INDEX) && (m_parent[i] >= End))
+				{
+					m_parent[i] -= Count;
+				}
+
+				m_idToIndex[m_indexToId[i]] = i;
+			}
+
+			// The pending dirty indices may point into or behind the erased range
+			m_dirtyList.clear();
+
+			for (uint i = 0; i < (uint)m_isDirty.size(); i++)
+			{
+				if (m_isDirty[i])
+				{
+					m_dirtyList.push_back(i);
+				}
+			}
+		}
+
+		void
+		SetParent(NodeId Node, NodeId Parent)
+		{
+			assert(IsValid(Node));
+			assert((Parent == INVALID_NODE) || IsValid(Parent));
+
+			uint Index = m_idToIndex[Node];
+			uint ParentIndex = (Parent == INVALID_NODE) ? INVALID_INDEX : m_idToIndex[Parent];
+
+			// The new parent must not be inside the subtree of the node
+			for (uint i = ParentIndex; i != INVALID_INDEX; i = m_parent[i])
+			{
+				assert(i != Index);
+			}
+
+			m_parent[Index] = ParentIndex;
+			m_isOrderDirty = true;
+			MarkDirty(Index);
+		}
+
+		NodeId
+		GetParent(NodeId Node) const
+		{
+			assert(IsValid(Node));
+			uint ParentIndex = m_parent[m_idToIndex[Node]];
+			return (ParentIndex == INVALID_INDEX) ? INVALID_NODE : m_indexToId[ParentIndex];
+		}
+
+		void
+		SetLocalPosition(NodeId Node, const Vector3f& Pos)
+		{
+			uint Index = GetIndex(Node);
+			m_localPos[Index] = Pos;
+			MarkDirty(Index);
+		}
+
+		void
+		SetLocalRotation(NodeId Node, const Quaternion& Rotation)
+		{
+			uint Index = GetIndex(Node);
+			m_localRot[Index] = Rotation;
+			MarkDirty(Index);
+		}
+
+		// Euler angles in degrees, same convention as WorldTrans::SetRotation
+		void
+		SetLocalRotation(NodeId Node, float x, float y, float z)
+		{
+			SetLocalRotation(Node, QuaternionFromEuler(x, y, z));
+		}
+
+		void
+		SetLocalScale(NodeId Node, float Scale)
+		{
+			uint Index = GetIndex(Node);
+			m_localScale[Index] = Scale;
+			MarkDirty(Index);
+		}
+
+		const Vector3f&
+		GetLocalPosition(NodeId Node) const
+		{
+			return m_localPos[GetIndex(Node)];
+		}
+
+		const Quaternion&
+		GetLocalRotation(NodeId Node) const
+		{
+			return m_localRot[GetIndex(Node)];
+		}
+
+		float
+		GetLocalScale(NodeId Node) const
+		{
+			return m_localScale[GetIndex(Node)];
+		}
+
+		const Matrix4f&
+		GetLocalMatrix(NodeId Node) const
+		{
+			return m_local[GetIndex(Node)];
+		}
+
+		// Valid after the last Update()
+		const Matrix4f&
+		GetWorldMatrix(NodeId Node) const
+		{
+			return m_world[GetIndex(Node)];
+		}
+
+		bool
+		IsValid(NodeId Node) const
+		{
+			return (Node < (NodeId)m_idToIndex.size()) && (m_idToIndex[Node] != INVALID_INDEX);
+		}
+
+		uint
+		GetNumNodes() const
+		{
+			return (uint)m_parent.size();
+		}
+
+		// Number of world matrices recomputed by the last Update()
+		uint
+		GetNumUpdatedNodes() const
+		{
+			return m_numUpdatedNodes;
+		}
+
+		void
+		Update()
+		{
+			m_numUpdatedNodes = 0;
+
+			// The dirty list is remapped to the new order so only the moved subtrees
+			// (which were marked dirty by SetParent/CreateNode) are recomputed
+			SortNodes();
+
+			if (m_dirtyList.empty())
+			{
+				return;
+			}
+
+			// When a large part of the graph changed a plain linear pass is cheaper than sorting
+			uint NumNodes = (uint)m_parent.size();
+
+			if (m_dirtyList.size() > NumNodes / 8)
+			{
+				UpdateRange(0, NumNodes);
+				m_dirtyList.clear();
+				return;
+			}
+
+			std::sort(m_dirtyList.begin(), m_dirtyList.end());
+
+			// Subtrees are contiguous, so a dirty node inside the range that was just
+			// processed is already up to date
+			uint End = 0;
+
+			for (uint Index : m_dirtyList)
+			{
+				if (Index < End)
+				{
+					continue;
+				}
+
+				End = Index + m_subtreeSize[Index];
+				UpdateRange(Index, End);
+			}
+
+			m_dirtyList.clear();
+		}
+
+	private:
+		static constexpr uint INVALID_INDEX = 0xFFFFFFFF;
+
+		uint
+		GetIndex(NodeId Node) const
+		{
+			assert(IsValid(Node));
+			return m_idToIndex[Node];
+		}
+
+		void
+		MarkDirty(uint Index)
+		{
+			if (!m_isDirty[Index])
+			{
+				m_isDirty[Index] = 1;
+				m_dirtyList.push_back(Index);
+			}
+		}
+
+		// Recomputes the world matrices of [Begin, End). The parents of every node in
+		// the range are either in front of it inside the range or already up to date.
+		void
+		UpdateRange(uint Begin, uint End)
+		{
+			for (uint i = Begin; i < End; i++)
+			{
+				if (m_isDirty[i])
+				{
+					m_local[i].InitTransform(m_localPos[i], m_localRot[i], m_localScale[i]);
+					m_isDirty[i] = 0;
+				}
+
+				uint Parent = m_parent[i];
+
+				if (Parent == INVALID_INDEX)
+				{
+					m_world[i] = m_local[i];
+				}
+				else
+				{
+					m_world[i] = m_world[Parent] * m_local[i];
+				}
+			}
+
+			m_numUpdatedNodes += End - Begin;
+		}
+
+		// True if 'Index' (just appended) directly follows the subtree of 'Parent'
+		bool
+		IsLastSubtree(uint Parent, uint Index) const
+		{
+			return !m_isOrderDirty && (Parent + m_subtreeSize[Parent] == Index);
+		}
+
+		void
+		GrowAncestors(uint Index, int Count)
+		{
+			for (uint i = Index; i != INVALID_INDEX; i = m_parent[i])
+			{
+				m_subtreeSize[i] += Count;
+			}
+		}
+
+		template <typename T>
+		static void
+		EraseRange(std::vector<T>& v, uint Begin, uint End)
+		{
+			v.erase(v.begin() + Begin, v.begin() + End);
+		}
+
+		template <typename T>
+		static void
+		Permute(std::vector<T>& v, const std::vector<uint>& NewToOld)
+		{
+			std::vector<T> Sorted;
+			Sorted.reserve(v.size());
+
+			for (uint Old : NewToOld)
+			{
+				Sorted.push_back(v[Old]);
+			}
+
+			v.swap(Sorted);
+		}
+
+		// Restores the depth first pre-order and the subtree sizes
+		void
+		SortNodes()
+		{
+			if (!m_isOrderDirty)
+			{
+				return;
+			}
+
+			uint NumNodes = (uint)m_parent.size();
+
+			// Children lists in compressed form: the children of node i are
+			// Children[FirstChild[i]] ... Children[FirstChild[i + 1] - 1]
+			std::vector<uint> FirstChild(NumNodes + 1, 0);
+
+			for (uint i = 0; i < NumNodes; i++)
+			{
+				if (m_parent[i] != INVALID_INDEX)
+				{
+					FirstChild[m_parent[i] + 1]++;
+				}
+			}
+
+			for (uint i = 0; i < NumNodes; i++)
+			{
+				FirstChild[i + 1] += FirstChild[i];
+			}
+
+			std::vector<uint> Children(FirstChild[NumNodes]);
+			std::vector<uint> Fill(FirstChild.begin(), FirstChild.end() - 1);
+
+			for (uint i = 0; i < NumNodes; i++)
+			{
+				if (m_parent[i] != INVALID_INDEX)
+				{
+					Children[Fill[m_parent[i]]++] = i;
+				}
+			}
+
+			std::vector<uint> NewToOld;
+			NewToOld.reserve(NumNodes);
+			std::vector<uint> Stack;
+
+			for (uint Root = 0; Root < NumNodes; Root++)
+			{
+				if (m_parent[Root] != INVALID_INDEX)
+				{
+					continue;
+				}
+
+				Stack.push_back(Root);
+
+				while (!Stack.empty())
+				{
+					uint Node = Stack.back();
+					Stack.pop_back();
+					NewToOld.push_back(Node);
+
+					// Reversed so that the children keep their relative order
+					for (uint c = FirstChild[Node + 1]; c > FirstChild[Node]; c--)
+					{
+						Stack.push_back(Children[c - 1]);
+					}
+				}
+			}
+
+			assert(NewToOld.size() == NumNodes);
+
+			std::vector<uint> OldToNew(NumNodes);
+
+			for (uint i = 0; i < NumNodes; i++)
+			{
+				OldToNew[NewToOld[i]] = i;
+			}
+
+			std::vector<uint> Parent(NumNodes);
+
+			for (uint i = 0; i < NumNodes; i++)
+			{
+				uint OldParent = m_parent[NewToOld[i]];
+				Parent[i] = (OldParent == INVALID_INDEX) ? INVALID_INDEX : OldToNew[OldParent];
+			}
+
+			m_parent.swap(Parent);
+
+			Permute(m_indexToId, NewToOld);
+			Permute(m_localPos, NewToOld);
+			Permute(m_localRot, NewToOld);
+			Permute(m_localScale, NewToOld);
+			Permute(m_local, NewToOld);
+			Permute(m_world, NewToOld);
+			Permute(m_isDirty, NewToOld);
+
+			for (uint i = 0; i < NumNodes; i++)
+			{
+				m_idToIndex[m_indexToId[i]] = i;
+			}
+
+			// Children come after their parents so a backward pass accumulates the sizes
+			std::fill(m_subtreeSize.begin(), m_subtreeSize.end(), 1);
+
+			for (uint i = NumNodes; i-- > 0;)
+			{
+				if (m_parent[i] != INVALID_INDEX)
+				{
+					m_subtreeSize[m_parent[i]] += m_subtreeSize[i];
+				}
+			}
+
+			for (uint& Index : m_dirtyList)
+			{
+				Index = OldToNew[Index];
+			}
+
+			m_isOrderDirty = false;
+		}
+
+		// Per node, indexed in pre-order
+		std::vector<uint> m_parent;
+		std::vector<uint> m_subtreeSize;
+		std::vector<NodeId> m_indexToId;
+		std::vector<Vector3f> m_localPos;
+		std::vector<Quaternion> m_localRot;
+		std::vector<float> m_localScale;
+		std::vector<Matrix4f> m_local;
+		std::vector<Matrix4f> m_world;
+		std::vector<unsigned char> m_isDirty;
+
+		// Per id
+		std::vector<uint> m_idToIndex;
+		std::vector<NodeId> m_freeIds;
+
+		std::vector<uint> m_dirtyList;
+		bool m_isOrderDirty = false;
+		uint m_numUpdatedNodes = 0;
+	};
+}
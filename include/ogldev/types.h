@@ -15,4 +15,5 @@ typedef char i8;
 typedef unsigned short u16;
 typedef short i16;
 typedef int32_t i32;
-typedef uint32_t u32;
\ No newline at end of file
+typedef uint32_t u32;
+typedef uint64_t u64;
\ No newline at end of file
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <math.h>
+#include <string.h>
+
+#include <ogldev/types.h>
+
+//
+// Conversions to the compact attribute formats that the vertex fetch decodes by
+// itself, so a shader reads them as plain floats:
+//
+//   half float        GL_HALF_FLOAT, 1 sign, 5 exponent and 10 mantissa bits
+//   snorm 10:10:10:2  GL_INT_2_10_10_10_REV with normalized = GL_TRUE, a unit
+//                     vector in 32 bits (w is always zero)
+//
+// The unpack functions give exactly what the GPU reads and are meant for tools
+// and tests that need the stored values on the CPU.
+//
+
+namespace ogl
+{
+	// Round to nearest even, out of range values become infinity
+	inline u16
+	FloatToHalf(float f)
+	{
+		const u32 F32_INFINITY = 255u << 23;
+		const u32 F16_OVERFLOW = (127u + 16u) << 23; // 2^16, the first value that rounds to infinity or above
+		const u32 F16_MIN_NORMAL = 113u << 23;		   // 2^-14
+		const u32 DENORMAL_MAGIC = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+		u32 x;
+		memcpy(&x, &f, sizeof(x));
+
+		u32 Sign = x & 0x80000000u;
+		x ^= Sign;
+
+		u16 Half;
+
+		if (x >= F16_OVERFLOW)
+		{
+			Half = (x > F32_INFINITY) ? 0x7e00 : 0x7c00; // NaN stays NaN
+		}
+		else if (x < F16_MIN_NORMAL)
+		{
+			// Denormal, let the float adder do the rounding
+			float Magic;
+			memcpy(&Magic, &DENORMAL_MAGIC, sizeof(Magic));
+
+			float Abs;
+			memcpy(&Abs, &x, sizeof(Abs));
+			Abs += Magic;
+
+			memcpy(&x, &Abs, sizeof(x));
+			Half = (u16)(x - DENORMAL_MAGIC);
+		}
+		else
+		{
+			u32 MantissaOdd = (x >> 13) & 1;
+			x += ((15u - 127u) << 23) + 0xfff; // rebias the exponent and round
+			x += MantissaOdd;
+			Half = (u16)(x >> 13);
+		}
+
+		return Half | (u16)(Sign >> 16);
+	}
+
+	inline float
+	HalfToFloat(u16 Half)
+	{
+		const u32 SHIFTED_EXPONENT = 0x7c00u << 13;
+		const u32 MAGIC = 113u << 23;
+
+		u32 x = (u32)(Half & 0x7fff) << 13;
+		u32 Exponent = x & SHIFTED_EXPONENT;
+		x += (127u - 15u) << 23;
+
+		float f;
+
+		if (Exponent == SHIFTED_EXPONENT)
+		{
+			x += (128u - 16u) << 23; // infinity or NaN
+			memcpy(&f, &x, sizeof(f));
+		}
+		else if (Exponent == 0)
+		{
+			// Zero or denormal, renormalize
+			x += 1u << 23;
+			float Magic;
+			memcpy(&Magic, &MAGIC, sizeof(Magic));
+			memcpy(&f, &x, sizeof(f));
+			f -= Magic;
+		}
+		else
+		{
+			memcpy(&f, &x, sizeof(f));
+		}
+
+		return (Half & 0x8000) ? -f : f;
+	}
+
+	// x, y and z in [-1, 1]
+	inline u32
+	PackSnorm1010102(float x, float y, float z)
+	{
+		auto Pack = [](float v) {
+			v = fminf(fmaxf(v, -1.0f), 1.0f);
+			return (u32)(i32)lrintf(v * 511.0f) & 0x3ff;
+		};
+
+		return Pack(x) | (Pack(y) << 10) | (Pack(z) << 20);
+	}
+
+	inline void
+	UnpackSnorm1010102(u32 Packed, float& x, float& y, float& z)
+	{
+		auto Unpack = [](u32 Bits) {
+			i32 v = (i32)(Bits << 22) >> 22; // sign extend the 10 bits
+			return fmaxf((float)v / 511.0f, -1.0f);
+		};
+
+		x = Unpack(Packed);
+		y = Unpack(Packed >> 10);
+		z = Unpack(Packed >> 20);
+	}
+} // namespace ogl
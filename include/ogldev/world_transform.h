@@ -1,10 +1,15 @@
 #pragma once
 
-#include <ogldev/mat3f.h>
 #include <ogldev/mat4f.h>
+#include <ogldev/mat3f.h>
 
 namespace ogl
 {
+	//
+	// Scale, rotation and position of an object. The world matrix and its inverse
+	// are cached and only rebuilt after one of the setters was called so static
+	// objects don't pay for any matrix math when they are rendered.
+	//
 	class WorldTrans
 	{
 	public:
@@ -14,6 +19,7 @@ namespace ogl
 		SetScale(float scale)
 		{
 			m_scale = scale;
+			Invalidate();
 		}
 
 		void
@@ -22,11 +28,13 @@ namespace ogl
 			m_rotation.x = x;
 			m_rotation.y = y;
 			m_rotation.z = z;
+			UpdateRotationQuat();
 		}
 
 		void
-		SetRotation(const Vector3f&)
+		SetRotation(const Vector3f& Rotation)
 		{
+			SetRotation(Rotation.x, Rotation.y, Rotation.z);
 		}
 
 		void
@@ -35,11 +43,13 @@ namespace ogl
 			m_pos.x = x;
 			m_pos.y = y;
 			m_pos.z = z;
+			Invalidate();
 		}
 		void
 		SetPosition(const Vector3f& WorldPos)
 		{
 			m_pos = WorldPos;
+			Invalidate();
 		}
 
 		void
@@ -48,49 +58,92 @@ namespace ogl
 			m_rotation.x += x;
 			m_rotation.y += y;
 			m_rotation.z += z;
+			UpdateRotationQuat();
 		}
 
-		Matrix4f
+		// Translation * Rotation * Scale
+		const Matrix4f&
 		GetMatrix() const
 		{
-			Matrix4f Scale;
-			Scale.InitScaleTransform(m_scale, m_scale, m_scale);
+			if (m_isWorldDirty)
+			{
+				m_world.InitTransform(m_pos, m_rotationQ, m_scale);
 
-			Matrix4f Rotation;
-			Rotation.InitRotateTransform(m_rotation.x, m_rotation.y, m_rotation.z);
+				m_isWorldDirty = false;
+			}
 
-			Matrix4f Translation;
-			Translation.InitTranslationTransform(m_pos.x, m_pos.y, m_pos.z);
+			return m_world;
+		}
 
-			Matrix4f WorldTransformation = Translation * Rotation * Scale;
+		// Inverse of GetMatrix() built directly from the components:
+		// (T * R * S)^-1 = S^-1 * R^T * T^-1
+		const Matrix4f&
+		GetInverseMatrix() const
+		{
+			if (m_isInverseDirty)
+			{
+				Matrix4f Rotation;
+				Rotation.InitRotateTransform(m_rotationQ);
+
+				float InvScale = 1.0f / m_scale;
+
+				for (int i = 0; i < 3; i++)
+				{
+					m_inverseWorld.m[i][0] = Rotation.m[0][i] * InvScale;
+					m_inverseWorld.m[i][1] = Rotation.m[1][i] * InvScale;
+					m_inverseWorld.m[i][2] = Rotation.m[2][i] * InvScale;
+					m_inverseWorld.m[i][3] =
+						-(m_inverseWorld.m[i][0] * m_pos.x + m_inverseWorld.m[i][1] * m_pos.y +
+						  m_inverseWorld.m[i][2] * m_pos.z);
+				}
+
+				m_inverseWorld.m[3][0] = 0.0f;
+				m_inverseWorld.m[3][1] = 0.0f;
+				m_inverseWorld.m[3][2] = 0.0f;
+				m_inverseWorld.m[3][3] = 1.0f;
+
+				m_isInverseDirty = false;
+			}
+
+			return m_inverseWorld;
+		}
 
-			return WorldTransformation;
+		// Transforms local normals to world space. The scaling is uniform so the inverse
+		// transpose of the world matrix is simply the rotation divided by the scale.
+		Matrix3f
+		GetNormalMatrix() const
+		{
+			Matrix3f NormalMatrix(GetMatrix());
+			float InvScaleSq = 1.0f / (m_scale * m_scale);
+
+			for (int i = 0; i < 3; i++)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					NormalMatrix.m[i][j] *= InvScaleSq;
+				}
+			}
+
+			return NormalMatrix;
 		}
 
 		Vector3f
 		WorldPosToLocalPos(const Vector3f& WorldPos) const
 		{
-			Matrix4f WorldToLocalTranslation = GetReversedTranslationMatrix();
-			Matrix4f WorldToLocalRotation = GetReversedRotationMatrix();
-			Matrix4f WorldToLocalTransformation = WorldToLocalRotation * WorldToLocalTranslation;
+			const Matrix4f& WorldToLocalTransformation = GetInverseMatrix();
 			Vector4f WorldPos4f = Vector4f(WorldPos, 1.0f);
 			Vector4f LocalPos4f = WorldToLocalTransformation * WorldPos4f;
-			Vector3f LocalPos3f(LocalPos4f);
-			return LocalPos3f;
+			return LocalPos4f.to3f();
 		}
 
 		Vector3f
 		WorldDirToLocalDir(const Vector3f& WorldDir) const
 		{
-			Matrix3f World3f(GetMatrix()); // Initialize using the top left corner
-
-			// Inverse local-to-world transformation using transpose
-			// (assuming uniform scaling)
-			Matrix3f WorldToLocal = World3f.Transpose();
+			Matrix3f WorldToLocal(GetInverseMatrix()); // Initialize using the top left corner
 
-			Vector3f LocalDirection = WorldToLocal * WorldDirection;
+			Vector3f LocalDirection = WorldToLocal * WorldDir;
 
-			LocalDirection = LocalDirection.Normalize();
+			LocalDirection.Normalize();
 
 			return LocalDirection;
 		}
@@ -107,7 +160,7 @@ namespace ogl
 		GetReversedRotationMatrix() const
 		{
 			Matrix4f ReversedRotation;
-			ReversedRotation.InitRotateTransformZYX(-m_rotation.x, -m_rotation.y, -m_rotation.z);
+			ReversedRotation.InitRotateTransform(m_rotationQ.Conjugate());
 			return ReversedRotation;
 		}
 
@@ -126,10 +179,35 @@ namespace ogl
 		{
 			return m_rotation;
 		}
+		const Quaternion&
+		GetRotationQuat() const
+		{
+			return m_rotationQ;
+		}
 
 	private:
+		void
+		Invalidate()
+		{
+			m_isWorldDirty = true;
+			m_isInverseDirty = true;
+		}
+
+		void
+		UpdateRotationQuat()
+		{
+			m_rotationQ = QuaternionFromEuler(m_rotation.x, m_rotation.y, m_rotation.z);
+			Invalidate();
+		}
+
 		float m_scale = 1.0f;
-		Vector3f m_rotation = Vector3f(0.0f, 0.0f, 0.0f);
+		Vector3f m_rotation = Vector3f(0.0f, 0.0f, 0.0f); // Euler angles in degrees, as set by the user
+		Quaternion m_rotationQ = Quaternion(0.0f, 0.0f, 0.0f, 1.0f);
 		Vector3f m_pos = Vector3f(0.0f, 0.0f, 0.0f);
+
+		mutable Matrix4f m_world;
+		mutable Matrix4f m_inverseWorld;
+		mutable bool m_isWorldDirty = true;
+		mutable bool m_isInverseDirty = true;
 	};
-}
\ No newline at end of file
+}
@@ -1,7 +1,11 @@
 #include "picking_texture.h"
 
+#include <algorithm>
+#include <climits>
+
 #include <ogldev/camera.h>
 #include <ogldev/engine_common.h>
+#include <ogldev/frustum.h>
 #include <ogldev/glfw_window.h>
 #include <ogldev/math3d.h>
 #include <ogldev/utility.h>
@@ -17,9 +21,15 @@ Picking3d::Picking3d()
 	m_directionalLight.WorldDirection = Vector3f(-1.0f, 0.0, 0.0);
 
 	// the same mesh will rendered  all the following location;
-	m_worldPos[0] = Vector3f(-10.0f, 0.0f, 5.0f);
-	m_worldPos[1] = Vector3f(10.0f, 0.0f, 5.0f);
-	m_worldPos[2] = Vector3f(0.0f, 2.0f, 20.0f);
+	m_worldTransforms[0].SetPosition(-10.0f, 0.0f, 5.0f);
+	m_worldTransforms[1].SetPosition(10.0f, 0.0f, 5.0f);
+	m_worldTransforms[2].SetPosition(0.0f, 2.0f, 20.0f);
+
+	for (ogl::WorldTrans& wt : m_worldTransforms)
+	{
+		wt.SetScale(0.1f);
+		wt.SetRotation(0.0f, 90.0f, 0.0f);
+	}
 
 	// window size
 	width = 1920;
@@ -29,7 +39,6 @@ Picking3d::Picking3d()
 Picking3d::~Picking3d()
 {
 	SAFE_DELETE(m_pGameCamera);
-	SAFE_DELETE(pMesh);
 }
 
 void
@@ -54,16 +63,90 @@ Picking3d::InitCallBacks()
 	glfwSetKeyCallback(window, KeyCallback);
 	glfwSetMouseButtonCallback(window, MouseButtonCallback);
 	glfwSetCursorPosCallback(window, CursorPosCallback);
+	glfwSetFramebufferSizeCallback(window, FramebufferSizeCallback);
 }
 
 void
 Picking3d::InitMesh()
 {
-	pMesh = new BasicMesh();
-	pMesh->LoadMesh("../Resources/spider.obj");
-	ogl::WorldTrans& world_transform = pMesh->GetWorldTransform();
-	world_transform.SetScale(0.1f);
-	world_transform.SetRotation(0.0f, 90.f, 0.0f);
+	MeshLoadOptions Options;
+	Options.pThreadPool = &m_threadPool;
+	Options.RemoveDuplicateVertices = true;
+	Options.OptimizeVertexCache = true;
+	Options.OptimizeOverdraw = true;
+	Options.OptimizeVertexFetch = true;
+	Options.LODErrors = {0.005f, 0.02f, 0.08f};
+	Options.PackVertices = true;
+	Options.BuildMeshlets = true;
+
+	// The window shows up right away and the mesh appears once UpdateMeshLoading() has uploaded it
+	m_pAsyncMesh = m_meshLoader.LoadMeshAsync("../Resources/spider.obj", Options);
+}
+
+// Returns true once pMesh can be used
+bool
+Picking3d::UpdateMeshLoading()
+{
+	if (pMesh)
+	{
+		return true;
+	}
+
+	m_meshLoader.Update(MESH_UPLOAD_BUDGET_MS);
+
+	if (m_pAsyncMesh->HasFailed())
+	{
+		printf("Error loading '%s'\n", m_pAsyncMesh->GetFilename().c_str());
+		exit(1);
+	}
+
+	pMesh = m_pAsyncMesh->Get();
+
+	if (!pMesh)
+	{
+		return false;
+	}
+
+	for (TriangleHighlight& Highlight : m_selectionHighlights)
+	{
+		pMesh->InitHighlight(Highlight);
+	}
+
+	InitSceneBVH();
+
+	// The material comes with the mesh, the rest of the lighting setup is in InitShaders()
+	m_lightingEffect.Enable();
+	m_lightingEffect.SetMaterial(pMesh->GetMaterial());
+
+	if (m_isMRTPickingSupported)
+	{
+		m_lightingPickingEffect.Enable();
+		m_lightingPickingEffect.SetMaterial(pMesh->GetMaterial());
+	}
+
+	return true;
+}
+
+void
+Picking3d::InitSceneBVH()
+{
+	AABB WorldBounds[ARRAY_SIZE_IN_ELEMENTS(m_worldTransforms)];
+
+	for (uint i = 0; i < ARRAY_SIZE_IN_ELEMENTS(m_worldTransforms); i++)
+	{
+		WorldBounds[i] = m_worldTransforms[i].GetMatrix().TransformAABB(pMesh->GetAABB());
+	}
+
+	m_sceneBVH.Build(WorldBounds, ARRAY_SIZE_IN_ELEMENTS(m_worldTransforms));
+}
+
+void
+Picking3d::UpdateVisibleInstances()
+{
+	FrustumCulling ViewFrustum(m_pGameCamera->GetViewProjMatrix());
+
+	m_visibleInstances.clear();
+	m_sceneBVH.QueryFrustum(ViewFrustum, m_visibleInstances);
 }
 
 void
@@ -84,6 +167,15 @@ Picking3d::InitCamera()
 		printf("Error Initializing The Lighting Technique ");
 		exit(1);
 	}
+
+	m_lightingPickingEffect.EnablePickingIDs("lighting_picking_ids.fs");
+
+	if (!m_lightingPickingEffect.Init())
+	{
+		printf("The lighting shader can't write the picking IDs, using a separate picking pass\n");
+		m_isMRTPicking = false;
+		m_isMRTPickingSupported = false;
+	}
 }
 
 void
@@ -91,7 +183,21 @@ Picking3d::RenderSceneCB()
 {
 	m_pGameCamera->OnRender();
 
-	if (m_leftMouseButton.IsPressed)
+	if (!UpdateMeshLoading())
+	{
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		return;
+	}
+
+	UpdateVisibleInstances();
+
+	if (m_isVisibilityBuffer)
+	{
+		VisibilityPhase();
+		return;
+	}
+
+	if (m_leftMouseButton.IsPressed && !m_isCPUPicking && !m_isMRTPicking)
 		PickingPhase();
 
 	RenderPhase();
@@ -100,23 +206,61 @@ Picking3d::RenderSceneCB()
 void
 Picking3d::PickingPhase()
 {
-	m_pickingTexture.enable_writing();
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	m_pickingEffect.Enable();
+	// Only the pixels around the cursor are rendered. The region transform makes
+	// them fill the (small) picking target. In the per object pass it also narrows
+	// the frustum culling to the instances and submeshes under the cursor.
+	int CursorX = m_leftMouseButton.x;
+	int CursorY = (int)height - m_leftMouseButton.y - 1;
+	m_pickingTexture.begin_region(
+		CursorX - PICK_REGION_SIZE / 2,
+		CursorY - PICK_REGION_SIZE / 2,
+		PICK_REGION_SIZE,
+		PICK_REGION_SIZE);
+
+	Matrix4f RegionViewProj = m_pickingTexture.get_region_transform() * m_pGameCamera->GetViewProjMatrix();
+
+	RenderPickingPass(RegionViewProj);
+
+	// Picked up by PickGPU() in a later frame, once the GPU is done with it
+	m_pickingTexture.request_pixel(CursorX, CursorY);
+
+	m_pickingTexture.disable_writing();
+}
 
-	ogl::WorldTrans& world_transform = pMesh->GetWorldTransform();
-	Matrix4f view = m_pGameCamera->GetViewMatrix();
-	Matrix4f Projection = m_pGameCamera->GetViewProjMatrix();
-	for (int i = 0; i < ARRAY_SIZE_IN_ELEMENTS(m_worldPos); ++i)
+// Renders the IDs into the current picking region
+void
+Picking3d::RenderPickingPass(const Matrix4f& RegionViewProj)
+{
+	if (m_isInstancedPicking)
 	{
-		world_transform.SetPosition(m_worldPos[i]);
+		// All the objects are drawn (the rasterizer clips them to the region) so that
+		// gl_InstanceID is the object index
+		uint NumObjects = ARRAY_SIZE_IN_ELEMENTS(m_worldTransforms);
+		m_pickWVPs.resize(NumObjects);
 
-		// Background is zero the real objects  start 1
-		m_pickingEffect.SetObjectIndex(i + 1);
-		Matrix4f world = world_transform.GetMatrix();
-		Matrix4f WVP = Projection * view * world;
-		m_pickingEffect.SetWVP(WVP);
-		pMesh->Render(&m_pickingEffect);
+		for (uint i = 0; i < NumObjects; i++)
+		{
+			m_pickWVPs[i] = RegionViewProj * m_worldTransforms[i].GetMatrix();
+		}
+
+		m_instancedPickingEffect.Enable();
+		pMesh->Render(NumObjects, m_pickWVPs.data(), NULL, &m_instancedPickingEffect);
+	}
+	else
+	{
+		m_pickingEffect.Enable();
+
+		m_pickInstances.clear();
+		m_sceneBVH.QueryFrustum(FrustumCulling(RegionViewProj), m_pickInstances);
+
+		for (uint i : m_pickInstances)
+		{
+			// Background is zero the real objects  start 1
+			m_pickingEffect.SetObjectIndex(i + 1);
+			Matrix4f WVP = RegionViewProj * m_worldTransforms[i].GetMatrix();
+			m_pickingEffect.SetWVP(WVP);
+			pMesh->Render(FrustumCulling(WVP), &m_pickingEffect, &m_cullingCache[i]);
+		}
 	}
 }
 
@@ -126,13 +270,35 @@ Picking3d::InitShaders()
 	m_lightingEffect.Enable();
 	m_lightingEffect.SetTextureUnit(COLOR_TEXTURE_UNIT_INDEX);
 	m_lightingEffect.SetSpecularExponentTextureUnit(SPECULAR_EXPONENT_UNIT_INDEX);
-	m_lightingEffect.SetMaterial(pMesh->GetMaterial());
+
+	if (m_isMRTPickingSupported)
+	{
+		m_lightingPickingEffect.Enable();
+		m_lightingPickingEffect.SetTextureUnit(COLOR_TEXTURE_UNIT_INDEX);
+		m_lightingPickingEffect.SetSpecularExponentTextureUnit(SPECULAR_EXPONENT_UNIT_INDEX);
+	}
+
 	m_pickingTexture.init(width, height);
 
 	if (!m_pickingEffect.Init())
 		exit(1);
+	if (!m_instancedPickingEffect.Init())
+		exit(1);
 	if (!m_simpleColorEffect.Init())
 		exit(1);
+
+	// Requires storage buffers (OpenGL 4.3)
+	if (m_visibilityShadingEffect.Init())
+	{
+		m_visibilityShadingEffect.Enable();
+		m_visibilityShadingEffect.SetIDTextureUnit(VISIBILITY_TEXTURE_UNIT_INDEX);
+		m_visibilityShadingEffect.SetTextureUnit(COLOR_TEXTURE_UNIT_INDEX);
+	}
+	else
+	{
+		printf("Visibility buffer shading is not supported\n");
+		m_isVisibilityBufferSupported = false;
+	}
 }
 
 void
@@ -152,78 +318,539 @@ Picking3d::KeyboardCB(uint key, int state)
 	case 'x':
 		m_directionalLight.DiffuseIntensity -= 0.05f;
 		break;
+	case GLFW_KEY_P:
+		if (state == GLFW_PRESS)
+		{
+			m_isCPUPicking = !m_isCPUPicking;
+			printf("%s picking\n", m_isCPUPicking ? "CPU" : "GPU");
+		}
+		break;
+	case GLFW_KEY_I:
+		if (state == GLFW_PRESS)
+		{
+			m_isInstancedPicking = !m_isInstancedPicking;
+			printf("%s GPU picking pass\n", m_isInstancedPicking ? "Instanced" : "Per object");
+		}
+		break;
+	case GLFW_KEY_M:
+		if ((state == GLFW_PRESS) && m_isMRTPickingSupported)
+		{
+			m_isMRTPicking = !m_isMRTPicking;
+			m_pickingTexture.cancel_requests();
+			printf("GPU picking IDs from the %s\n", m_isMRTPicking ? "main pass" : "picking pass");
+		}
+		break;
+	case GLFW_KEY_C:
+		if ((state == GLFW_PRESS) && pMesh)
+		{
+			// The stats are from the previous frame
+			const MeshletStats& Stats = pMesh->GetMeshletStats();
+			m_isMeshletCulling = !m_isMeshletCulling;
+			printf("%s in the forward pass\n", m_isMeshletCulling ? "Meshlet culling" : "LODs");
+			printf("Meshlets: %u tested, %u outside the frustum, %u back facing, %u triangles in %u draws\n",
+				   Stats.NumMeshlets,
+				   Stats.NumFrustumCulled,
+				   Stats.NumConeCulled,
+				   Stats.NumTriangles,
+				   Stats.NumDraws);
+		}
+		break;
+	case GLFW_KEY_V:
+		if ((state == GLFW_PRESS) && m_isVisibilityBufferSupported)
+		{
+			m_isVisibilityBuffer = !m_isVisibilityBuffer;
+			m_pickingTexture.cancel_requests();
+			printf("%s rendering\n", m_isVisibilityBuffer ? "Visibility buffer" : "Forward");
+		}
+		break;
 	default:
 		m_pGameCamera->OnKeyboard(key);
 	}
 }
 
+void
+Picking3d::ResizeCB(int Width, int Height)
+{
+	if ((Width <= 0) || (Height <= 0))
+	{
+		return; // minimized
+	}
+
+	width = (uint)Width;
+	height = (uint)Height;
+
+	glViewport(0, 0, Width, Height);
+	m_pGameCamera->SetWindowSize(Width, Height);
+	m_pickingTexture.resize(width, height);
+}
+
 void
 Picking3d::PassiveMouseCB(int x, int y)
 {
+	if (m_selectionDrag.IsActive)
+	{
+		m_selectionDrag.EndX = x;
+		m_selectionDrag.EndY = y;
+
+		// Skip the points that are too close to add anything to the polygon
+		if (m_selectionDrag.IsLasso)
+		{
+			const Vector2f& Last = m_selectionDrag.Lasso.back();
+
+			if (fabsf((float)x - Last.x) + fabsf((float)y - Last.y) >= 2.0f)
+			{
+				m_selectionDrag.Lasso.push_back(Vector2f((float)x, (float)y));
+			}
+		}
+
+		return;
+	}
+
 	m_pGameCamera->OnMouse(x, y);
 }
 
 void
-Picking3d ::MouseCB(int button, int action, int x, int y)
+Picking3d ::MouseCB(int button, int action, int mods, int x, int y)
 {
+	if ((button == GLFW_MOUSE_BUTTON_LEFT) && (action == GLFW_PRESS) && (mods & (GLFW_MOD_SHIFT | GLFW_MOD_CONTROL)))
+	{
+		m_selectionDrag.IsActive = true;
+		m_selectionDrag.IsLasso = (mods & GLFW_MOD_CONTROL) != 0;
+		m_selectionDrag.StartX = m_selectionDrag.EndX = x;
+		m_selectionDrag.StartY = m_selectionDrag.EndY = y;
+		m_selectionDrag.Lasso.clear();
+		m_selectionDrag.Lasso.push_back(Vector2f((float)x, (float)y));
+		return;
+	}
+
+	if ((button == GLFW_MOUSE_BUTTON_LEFT) && (action == GLFW_RELEASE) && m_selectionDrag.IsActive)
+	{
+		m_selectionDrag.EndX = x;
+		m_selectionDrag.EndY = y;
+		m_selectionDrag.IsActive = false;
+		FinishSelection();
+		return;
+	}
+
 	if (button == GLFW_MOUSE_BUTTON_LEFT)
 	{
 		m_leftMouseButton.IsPressed = (action == GLFW_PRESS);
 		m_leftMouseButton.x = x;
 		m_leftMouseButton.y = y;
+
+		if (!m_leftMouseButton.IsPressed)
+		{
+			m_pickingTexture.cancel_requests();
+			m_lastGPUPick = Pixel_Info();
+		}
 	}
 }
 
 void
 Picking3d::RenderPhase()
 {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	ogl::WorldTrans& wt = pMesh->GetWorldTransform();
-	Matrix4f view = m_pGameCamera->GetViewMatrix();
-	Matrix4f projection = m_pGameCamera->GetProjectionMat();
+	// The main pass renders the picking IDs too, straight out of the lighting shader
+	bool IsMainPassPicking = m_leftMouseButton.IsPressed && !m_isCPUPicking && m_isMRTPicking;
+	ogl::LightingTechnique* pLighting = IsMainPassPicking ? &m_lightingPickingEffect : &m_lightingEffect;
+
+	if (IsMainPassPicking)
+	{
+		m_pickingTexture.begin_main_pass();
+	}
+	else
+	{
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+
+	Matrix4f ViewProj = m_pGameCamera->GetViewProjMatrix();
 
 	// If the left mouse button is clicked check if it hit triangle and color it red
-	int clicked_object_id = -1;
+	PickResult Pick;
+	bool IsHit = false;
 	if (m_leftMouseButton.IsPressed)
 	{
-		Pixel_Info px = m_pickingTexture.read_pixel(m_leftMouseButton.x, height - m_leftMouseButton.y - 1);
-		if (px.object_id != 0)
-		{
-			// Compensate for the SetObjectindex call in the picking phase
-			clicked_object_id = px.object_id - 1;
-			assert(clicked_object_id < ARRAY_SIZE_IN_ELEMENTS(m_worldPos));
-			m_simpleColorEffect.Enable();
-			wt.SetPosition(m_worldPos[clicked_object_id]);
-			Matrix4f world = wt.GetMatrix();
-			Matrix4f WVP = projection * view * world;
-			m_simpleColorEffect.SetWVP(WVP);
-			pMesh->Render(px.draw_id, px.prim_id);
-		}
+		IsHit = m_isCPUPicking ? PickCPU(m_leftMouseButton.x, m_leftMouseButton.y, Pick) : PickGPU(Pick);
+	}
+
+	// With the IDs in the main pass the highlights go on top of the objects, see below
+	if (!IsMainPassPicking)
+	{
+		RenderHighlights(ViewProj, IsHit ? &Pick : NULL);
 	}
 
 	// Render the objects as usual
-	m_lightingEffect.Enable();
-	for (unsigned int i = 0; i < ARRAY_SIZE_IN_ELEMENTS(m_worldPos); i++)
+	pLighting->Enable();
+	pMesh->ResetMeshletStats();
+
+	for (uint i : m_visibleInstances)
 	{
-		wt.SetPosition(m_worldPos[i]);
-		Matrix4f World = wt.GetMatrix();
-		Matrix4f WVP = projection * view * World;
-		m_lightingEffect.SetWVP(WVP);
+		const ogl::WorldTrans& wt = m_worldTransforms[i];
+		Matrix4f WVP = ViewProj * wt.GetMatrix();
+		pLighting->SetWVP(WVP);
 		Vector3f CameraLocalPos3f = wt.WorldPosToLocalPos(m_pGameCamera->GetPos());
-		m_lightingEffect.SetCameraLocalPos(CameraLocalPos3f);
+		pLighting->SetCameraLocalPos(CameraLocalPos3f);
 		m_directionalLight.CalcLocalDirection(wt);
-		m_lightingEffect.SetDirectionalLight(m_directionalLight);
+		pLighting->SetDirectionalLight(m_directionalLight);
+
+		if ((int)i == Pick.ObjectIndex)
+		{
+			pLighting->SetColorMod(Vector4f(0.0f, 1.0, 0.0, 1.0f));
+		}
+		else
+		{
+			pLighting->SetColorMod(Vector4f(1.0f, 1.0, 1.0, 1.0f));
+		}
 
-		if (i == clicked_object_id)
+		if (IsMainPassPicking)
 		{
-			m_lightingEffect.SetColorMod(Vector4f(0.0f, 1.0, 0.0, 1.0f));
+			// Background is zero the real objects start 1, same as the picking pass
+			pLighting->SetObjectIndex(i + 1);
+			pMesh->Render(FrustumCulling(WVP), pLighting, &m_cullingCache[i]);
 		}
 		else
 		{
-			m_lightingEffect.SetColorMod(Vector4f(1.0f, 1.0, 1.0, 1.0f));
+			// The LODs and meshlets change the triangle order so the passes that use the PrimID stay on Render()
+			if (m_isMeshletCulling)
+			{
+				pMesh->RenderMeshlets(FrustumCulling(WVP), CameraLocalPos3f, NULL, &m_cullingCache[i]);
+			}
+			else
+			{
+				float PixelsPerUnit = pMesh->CalcPixelsPerUnit(WVP, (float)height);
+				pMesh->RenderLOD(FrustumCulling(WVP), PixelsPerUnit, 1.0f, NULL, &m_cullingCache[i]);
+			}
+		}
+	}
+
+	if (IsMainPassPicking)
+	{
+		// Drawn first the highlighted triangles would fail the depth test of the
+		// lit triangles under them and take their IDs out of the picking target
+		m_pickingTexture.set_id_output(false);
+		glDepthFunc(GL_LEQUAL);
+		RenderHighlights(ViewProj, IsHit ? &Pick : NULL);
+		glDepthFunc(GL_LESS);
+
+		int CursorX = m_leftMouseButton.x;
+		int CursorY = (int)height - m_leftMouseButton.y - 1;
+		m_pickingTexture.request_pixel(CursorX, CursorY);
+
+		m_pickingTexture.end_main_pass();
+	}
+}
+
+// The picked triangle (pPick may be NULL) and the selected triangles, one draw
+// per submesh of every instance that has any
+void
+Picking3d::RenderHighlights(const Matrix4f& ViewProj, const PickResult* pPick)
+{
+	m_simpleColorEffect.Enable();
+
+	if (pPick)
+	{
+		m_simpleColorEffect.SetWVP(ViewProj * m_worldTransforms[pPick->ObjectIndex].GetMatrix());
+		pMesh->Render(pPick->DrawIndex, pPick->PrimID);
+	}
+
+	for (uint i = 0; i < ARRAY_SIZE_IN_ELEMENTS(m_selectionHighlights); i++)
+	{
+		if (m_selectionHighlights[i].GetNumTriangles() == 0)
+		{
+			continue;
+		}
+
+		m_simpleColorEffect.SetWVP(ViewProj * m_worldTransforms[i].GetMatrix());
+		pMesh->RenderHighlight(m_selectionHighlights[i]);
+	}
+}
+
+//
+// The IDs pass is the full window picking pass, so GPU picking simply reads
+// back from it. The shading pass then reconstructs the triangle under every
+// pixel, see VisibilityShadingTechnique.
+//
+void
+Picking3d::VisibilityPhase()
+{
+	Matrix4f ViewProj = m_pGameCamera->GetViewProjMatrix();
+
+	m_pickingTexture.enable_writing();
+	m_pickingEffect.Enable();
+
+	for (uint i : m_visibleInstances)
+	{
+		// Background is zero the real objects start 1
+		m_pickingEffect.SetObjectIndex(i + 1);
+		Matrix4f WVP = ViewProj * m_worldTransforms[i].GetMatrix();
+		m_pickingEffect.SetWVP(WVP);
+		pMesh->Render(FrustumCulling(WVP), &m_pickingEffect, &m_cullingCache[i]);
+	}
+
+	if (m_leftMouseButton.IsPressed && !m_isCPUPicking)
+	{
+		m_pickingTexture.request_pixel(m_leftMouseButton.x, (int)height - m_leftMouseButton.y - 1);
+	}
+
+	m_pickingTexture.disable_writing();
+
+	PickResult Pick;
+	if (m_leftMouseButton.IsPressed)
+	{
+		if (m_isCPUPicking)
+		{
+			PickCPU(m_leftMouseButton.x, m_leftMouseButton.y, Pick);
+		}
+		else
+		{
+			PickGPU(Pick);
+		}
+	}
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	uint NumObjects = ARRAY_SIZE_IN_ELEMENTS(m_worldTransforms);
+	m_visWVPs.resize(NumObjects);
+	m_visWorlds.resize(NumObjects);
+
+	for (uint i = 0; i < NumObjects; i++)
+	{
+		m_visWorlds[i] = m_worldTransforms[i].GetMatrix();
+		m_visWVPs[i] = ViewProj * m_visWorlds[i];
+	}
+
+	m_visibilityShadingEffect.Enable();
+	m_visibilityShadingEffect.SetScreenSize(width, height);
+	m_visibilityShadingEffect.SetDirectionalLight(m_directionalLight);
+	m_visibilityShadingEffect.SetObjects(m_visWVPs.data(), m_visWorlds.data(), NumObjects);
+	m_visibilityShadingEffect.SetPickedIDs(Pick.ObjectIndex + 1, Pick.DrawIndex, Pick.PrimID);
+	m_visibilityShadingEffect.SetPackedVertices(pMesh->HasPackedVertices());
+	m_pickingTexture.bind_id_texture(VISIBILITY_TEXTURE_UNIT);
+	pMesh->BindStorageBuffers(VIS_MESH_FIRST_BINDING);
+
+	for (uint i = 0; i < pMesh->GetNumMaterials(); i++)
+	{
+		const Material& Mat = pMesh->GetMaterial(i);
+
+		if (Mat.pDiffuse)
+		{
+			Mat.pDiffuse->Bind(COLOR_TEXTURE_UNIT);
+		}
+
+		m_visibilityShadingEffect.SetMaterial(Mat);
+		m_visibilityShadingEffect.DrawMaterialPass(i);
+	}
+}
+
+// Doesn't stall on the GPU: uses the newest completed read back and keeps the
+// previous result (if any) while the requests of the last frames are in flight
+bool
+Picking3d::PickGPU(PickResult& Result)
+{
+	m_pickingTexture.poll_pixel(m_lastGPUPick);
+
+	if (m_lastGPUPick.object_id == 0)
+	{
+		return false;
+	}
+
+	// Compensate for the SetObjectindex call in the picking phase
+	Result.ObjectIndex = (int)m_lastGPUPick.object_id - 1;
+	assert(Result.ObjectIndex < ARRAY_SIZE_IN_ELEMENTS(m_worldTransforms));
+	Result.DrawIndex = m_lastGPUPick.draw_id;
+	Result.PrimID = m_lastGPUPick.prim_id;
+
+	return true;
+}
+
+// Cast the cursor ray through the instance BVH and then through the triangle BVH
+// of every instance whose bounds it hits. The ray is moved into the local space
+// of each instance, which keeps the hit distances comparable between them.
+bool
+Picking3d::PickCPU(int x, int y, PickResult& Result)
+{
+	Ray WorldRay = m_pGameCamera->GetPickRay(x, y);
+	float tMax = 1.0f; // far plane
+
+	bool IsHit = m_sceneBVH.QueryRay(WorldRay, tMax, [&](uint Instance, float, float& t) {
+		Ray LocalRay = TransformRay(m_worldTransforms[Instance].GetInverseMatrix(), WorldRay);
+		MeshRayHit Hit;
+
+		if (!pMesh->RayCast(LocalRay, Hit, t))
+		{
+			return false;
+		}
+
+		t = Hit.t;
+		Result.ObjectIndex = (int)Instance;
+		Result.DrawIndex = Hit.DrawIndex;
+		Result.PrimID = Hit.PrimID;
+		Result.u = Hit.u;
+		Result.v = Hit.v;
+
+		return true;
+	});
+
+	if (IsHit)
+	{
+		Result.WorldPos = WorldRay.GetPoint(tMax);
+	}
+
+	return IsHit;
+}
+
+//
+// Selects what is inside the dragged rectangle or lasso. The GPU path reads
+// the visible triangles back from the picking texture, the CPU path returns
+// every triangle that is inside, hidden or not.
+//
+void
+Picking3d::FinishSelection()
+{
+	if (!pMesh)
+	{
+		return; // still loading
+	}
+
+	// Window coordinates with the bottom left origin of the picking texture
+	int MinX = std::min(m_selectionDrag.StartX, m_selectionDrag.EndX);
+	int MaxX = std::max(m_selectionDrag.StartX, m_selectionDrag.EndX);
+	int MinY = std::min(m_selectionDrag.StartY, m_selectionDrag.EndY);
+	int MaxY = std::max(m_selectionDrag.StartY, m_selectionDrag.EndY);
+
+	const Vector2f* pLasso = NULL;
+	uint NumLassoPoints = 0;
+
+	if (m_selectionDrag.IsLasso)
+	{
+		m_selectLasso.clear();
+		MinX = MinY = INT_MAX;
+		MaxX = MaxY = INT_MIN;
+
+		// The centers of the cursor pixels, in the rows of the picking texture (height - y - 1)
+		for (const Vector2f& p : m_selectionDrag.Lasso)
+		{
+			m_selectLasso.push_back(Vector2f(p.x + 0.5f, (float)height - p.y - 0.5f));
+			MinX = std::min(MinX, (int)p.x);
+			MaxX = std::max(MaxX, (int)p.x);
+			MinY = std::min(MinY, (int)p.y);
+			MaxY = std::max(MaxY, (int)p.y);
+		}
+
+		if (m_selectLasso.size() < 3)
+		{
+			return;
 		}
 
-		pMesh->Render(NULL);
+		pLasso = m_selectLasso.data();
+		NumLassoPoints = (uint)m_selectLasso.size();
+	}
+
+	int x = MinX;
+	int y = (int)height - MaxY - 1;
+	uint w = (uint)(MaxX - MinX + 1);
+	uint h = (uint)(MaxY - MinY + 1);
+
+	m_selection.clear();
+
+	if (m_isCPUPicking)
+	{
+		SelectCPU(x, y, w, h, pLasso, NumLassoPoints);
+	}
+	else
+	{
+		SelectGPU(x, y, w, h, pLasso, NumLassoPoints);
+	}
+
+	uint NumPixels = 0;
+
+	for (TriangleHighlight& Highlight : m_selectionHighlights)
+	{
+		Highlight.Clear();
+	}
+
+	for (const Pixel_Count& Entry : m_selection)
+	{
+		m_selectionHighlights[Entry.pixel.object_id - 1].Add(Entry.pixel.draw_id, Entry.pixel.prim_id);
+		NumPixels += Entry.count;
+	}
+
+	printf("Selected %d triangles (%d pixels)\n", (int)m_selection.size(), NumPixels);
+}
+
+void
+Picking3d::SelectGPU(int x, int y, uint w, uint h, const Vector2f* pLasso, uint NumLassoPoints)
+{
+	// Only the selection rectangle is rendered
+	m_pickingTexture.begin_region(x, y, w, h);
+
+	RenderPickingPass(m_pickingTexture.get_region_transform() * m_pGameCamera->GetViewProjMatrix());
+
+	m_pickingTexture.read_histogram(x, y, w, h, m_selectionHistogram, pLasso, NumLassoPoints);
+	m_pickingTexture.disable_writing();
+
+	m_selection = m_selectionHistogram.get_entries();
+}
+
+// The frustum of the selection rectangle is tested against the instance BVH,
+// then against the triangle BVHs of the instances and then against the vertices
+// of every triangle. That test is conservative, a large triangle that passes
+// just outside a corner of the rectangle is kept. With a lasso the triangles
+// are kept if their projected centers are inside it.
+void
+Picking3d::SelectCPU(int x, int y, uint w, uint h, const Vector2f* pLasso, uint NumLassoPoints)
+{
+	Matrix4f ViewProj = m_pGameCamera->GetViewProjMatrix();
+	Matrix4f RegionViewProj = Picking_Texture::calc_region_transform(x, y, w, h, width, height) * ViewProj;
+
+	m_selectInstances.clear();
+	m_sceneBVH.QueryFrustum(FrustumCulling(RegionViewProj), m_selectInstances);
+
+	for (uint i : m_selectInstances)
+	{
+		const Matrix4f& World = m_worldTransforms[i].GetMatrix();
+
+		FrustumCulling LocalFrustum(RegionViewProj * World);
+
+		m_selectTriangles.clear();
+		pMesh->QueryFrustum(LocalFrustum, m_selectTriangles);
+
+		Matrix4f WVP = ViewProj * World;
+
+		for (const MeshTriangleID& Triangle : m_selectTriangles)
+		{
+			// The BVH returns every triangle of the leaves that overlap the frustum
+			Vector3f v0, v1, v2;
+			pMesh->GetTrianglePositions(Triangle.DrawIndex, Triangle.PrimID, v0, v1, v2);
+
+			if (!LocalFrustum.IsTriangleInsideViewFrustum(v0, v1, v2))
+			{
+				continue;
+			}
+
+			if (pLasso)
+			{
+				Vector4f Clip = WVP * Vector4f((v0 + v1 + v2) / 3.0f, 1.0f);
+
+				if (Clip.w <= 0.0f)
+				{
+					continue;
+				}
+
+				float WindowX = (Clip.x / Clip.w * 0.5f + 0.5f) * (float)width;
+				float WindowY = (Clip.y / Clip.w * 0.5f + 0.5f) * (float)height;
+
+				if (!point_in_polygon(pLasso, NumLassoPoints, WindowX, WindowY))
+				{
+					continue;
+				}
+			}
+
+			Pixel_Count Entry;
+			Entry.pixel.object_id = i + 1;
+			Entry.pixel.draw_id = Triangle.DrawIndex;
+			Entry.pixel.prim_id = Triangle.PrimID;
+			m_selection.push_back(Entry);
+		}
 	}
 }
 
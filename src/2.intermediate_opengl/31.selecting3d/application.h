@@ -1,13 +1,19 @@
 #pragma once
 
 #include <ogldev/basic_mesh.h>
+#include <ogldev/bvh.h>
 #include <ogldev/camera.h>
 #include <ogldev/glfw_window.h>
 #include <ogldev/lighting2.h>
+#include <ogldev/mesh_loader.h>
+#include <ogldev/thread_pool.h>
 
+#include "id_histogram.h"
+#include "picking_instanced_technique.h"
 #include "picking_technique.h"
 #include "picking_texture.h"
 #include "simple_color_technique.h"
+#include "visibility_shading_technique.h"
 
 // Callbacks
 void
@@ -19,6 +25,15 @@ CursorPosCallback(GLFWwindow* window, double x, double y);
 void
 MouseButtonCallback(GLFWwindow* window, int Button, int Action, int Mode);
 
+void
+FramebufferSizeCallback(GLFWwindow* window, int Width, int Height);
+
+// Time per frame for creating the GL objects of the streamed in mesh
+#define MESH_UPLOAD_BUDGET_MS 2.0f
+
+// Size in pixels of the window region rendered by the picking pass
+#define PICK_REGION_SIZE 1
+
 struct MouseButton
 {
 	bool IsPressed = false;
@@ -26,19 +41,70 @@ struct MouseButton
 	int y;
 };
 
+// Marquee (shift + drag) or lasso (control + drag) selection in progress
+struct SelectionDrag
+{
+	bool IsActive = false;
+	bool IsLasso = false;
+	int StartX = 0;
+	int StartY = 0;
+	int EndX = 0;
+	int EndY = 0;
+	std::vector<Vector2f> Lasso; // window coordinates, top left origin like the cursor
+};
+
+// What is under the cursor
+struct PickResult
+{
+	int ObjectIndex = -1; // -1 if nothing was hit
+	uint DrawIndex = 0;
+	uint PrimID = 0;
+	float u = 0.0f; // barycentrics inside the triangle (CPU picking only)
+	float v = 0.0f;
+	Vector3f WorldPos = Vector3f(0.0f, 0.0f, 0.0f); // CPU picking only
+};
+
 class Picking3d
 {
 private:
 	GLFWwindow* window = NULL;
 	ogl::LightingTechnique m_lightingEffect;
+	ogl::LightingTechnique m_lightingPickingEffect; // also writes the picking IDs as a second render target
 	PickingTechnique m_pickingEffect;
+	InstancedPickingTechnique m_instancedPickingEffect;
 	SimpleColorTechnique m_simpleColorEffect;
+	VisibilityShadingTechnique m_visibilityShadingEffect;
 	ogl::BasicCamera* m_pGameCamera = NULL;
 	ogl::DirectionalLight m_directionalLight;
-	BasicMesh* pMesh = NULL;
+	BasicMesh* pMesh = NULL; // owned by m_pAsyncMesh, NULL until it is loaded
+	ogl::ThreadPool m_threadPool; // for loading
+	ogl::MeshLoader m_meshLoader; // after m_threadPool so it stops first
+	std::shared_ptr<ogl::AsyncMesh> m_pAsyncMesh;
 	Picking_Texture m_pickingTexture;
-	Vector3f m_worldPos[3];
+	ogl::WorldTrans m_worldTransforms[3]; // one per instance so the cached matrices stay valid
+	CullingCache m_cullingCache[3];
+	ogl::BVH m_sceneBVH; // world space bounds of the instances
+	std::vector<uint> m_visibleInstances;
+	std::vector<uint> m_pickInstances; // instances that overlap the picking region
+	std::vector<Matrix4f> m_pickWVPs;  // per instance matrices of the instanced picking pass
 	MouseButton m_leftMouseButton;
+	bool m_isCPUPicking = true; // ray cast against the triangle BVHs instead of rendering into m_pickingTexture
+	Pixel_Info m_lastGPUPick;	// latest asynchronous read back from m_pickingTexture
+	bool m_isInstancedPicking = true; // one draw per submesh for all the objects in the GPU picking pass
+	bool m_isMRTPicking = true;		  // GPU picking IDs come from the main pass instead of a separate pass
+	bool m_isMRTPickingSupported = true; // the lighting technique links with lighting_picking_ids.fs
+	bool m_isVisibilityBuffer = false;	 // rasterize IDs only and shade every pixel once in a full screen pass
+	bool m_isVisibilityBufferSupported = true;
+	bool m_isMeshletCulling = false; // cull meshlets by frustum and normal cone instead of drawing LODs
+	std::vector<Matrix4f> m_visWVPs;
+	std::vector<Matrix4f> m_visWorlds;
+	SelectionDrag m_selectionDrag;
+	ID_Histogram m_selectionHistogram;
+	std::vector<Pixel_Count> m_selection; // selected triangles, the pixel counts are zero for CPU selection
+	TriangleHighlight m_selectionHighlights[3]; // the selected triangles of every instance
+	std::vector<uint> m_selectInstances;
+	std::vector<MeshTriangleID> m_selectTriangles;
+	std::vector<Vector2f> m_selectLasso; // bottom left origin
 	uint width;
 	uint height;
 
@@ -58,17 +124,29 @@ public:
 	void
 	PickingPhase();
 
+	void
+	RenderPickingPass(const Matrix4f& RegionViewProj);
+
 	void
 	RenderPhase();
 
+	void
+	RenderHighlights(const Matrix4f& ViewProj, const PickResult* pPick);
+
+	void
+	VisibilityPhase();
+
 	void
 	KeyboardCB(uint key, int state);
 
+	void
+	ResizeCB(int Width, int Height);
+
 	void
 	PassiveMouseCB(int x, int y);
 
 	void
-	MouseCB(int button, int action, int x, int y);
+	MouseCB(int button, int action, int mods, int x, int y);
 
 private:
 	void
@@ -85,4 +163,28 @@ private:
 
 	void
 	InitMesh();
+
+	bool
+	UpdateMeshLoading();
+
+	void
+	InitSceneBVH();
+
+	void
+	UpdateVisibleInstances();
+
+	bool
+	PickGPU(PickResult& Result);
+
+	bool
+	PickCPU(int x, int y, PickResult& Result);
+
+	void
+	FinishSelection();
+
+	void
+	SelectGPU(int x, int y, uint w, uint h, const Vector2f* pLasso, uint NumLassoPoints);
+
+	void
+	SelectCPU(int x, int y, uint w, uint h, const Vector2f* pLasso, uint NumLassoPoints);
 };
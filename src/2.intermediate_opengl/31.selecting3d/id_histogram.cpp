@@ -0,0 +1,226 @@
+#include "id_histogram.h"
+
+#include <algorithm>
+
+#include <ogldev/simd.h>
+
+static unsigned int
+hash_ids(const unsigned int* ids)
+{
+	unsigned int h = ids[0] * 0x9E3779B1u;
+	h ^= ids[1] * 0x85EBCA77u;
+	h ^= ids[2] * 0xC2B2AE3Du;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 13;
+	return h;
+}
+
+void ID_Histogram::clear()
+{
+	// Scattered writes are only worth it while few slots were used
+	if (m_used_slots.size() * 8 < m_table.size())
+	{
+		for (unsigned int slot : m_used_slots)
+		{
+			m_table[slot] = Pixel_Count();
+		}
+	}
+	else
+	{
+		std::fill(m_table.begin(), m_table.end(), Pixel_Count());
+	}
+
+	m_used_slots.clear();
+	m_entries.clear();
+}
+
+const std::vector<Pixel_Count>& ID_Histogram::get_entries()
+{
+	m_entries.resize(m_used_slots.size());
+
+	for (size_t i = 0; i < m_used_slots.size(); i++)
+	{
+		m_entries[i] = m_table[m_used_slots[i]];
+	}
+
+	return m_entries;
+}
+
+void ID_Histogram::add_span(const unsigned int* rgba, unsigned int num_pixels)
+{
+	if (num_pixels == 0)
+	{
+		return;
+	}
+
+	const unsigned int* run = rgba;
+	unsigned int count = 1;
+
+#ifdef OGLDEV_SSE
+	// Only the RGB lanes take part in the comparison
+	const int rgb_mask = 0x0FFF;
+	__m128i run_ids = _mm_loadu_si128((const __m128i*)run);
+	unsigned int i = 1;
+
+	while (i < num_pixels)
+	{
+		// Inside a run: four pixels per test
+		if (i + 4 <= num_pixels)
+		{
+			const __m128i* p = (const __m128i*)(rgba + i * 4);
+			__m128i eq01 = _mm_and_si128(
+				_mm_cmpeq_epi32(_mm_loadu_si128(p), run_ids),
+				_mm_cmpeq_epi32(_mm_loadu_si128(p + 1), run_ids));
+			__m128i eq23 = _mm_and_si128(
+				_mm_cmpeq_epi32(_mm_loadu_si128(p + 2), run_ids),
+				_mm_cmpeq_epi32(_mm_loadu_si128(p + 3), run_ids));
+
+			if ((_mm_movemask_epi8(_mm_and_si128(eq01, eq23)) & rgb_mask) == rgb_mask)
+			{
+				count += 4;
+				i += 4;
+				continue;
+			}
+		}
+
+		__m128i ids = _mm_loadu_si128((const __m128i*)(rgba + i * 4));
+
+		if ((_mm_movemask_epi8(_mm_cmpeq_epi32(ids, run_ids)) & rgb_mask) == rgb_mask)
+		{
+			count++;
+		}
+		else
+		{
+			add_run(run, count);
+			run = rgba + i * 4;
+			run_ids = ids;
+			count = 1;
+		}
+
+		i++;
+	}
+#else
+	for (unsigned int i = 1; i < num_pixels; i++)
+	{
+		const unsigned int* p = rgba + i * 4;
+
+		if ((p[0] == run[0]) && (p[1] == run[1]) && (p[2] == run[2]))
+		{
+			count++;
+			continue;
+		}
+
+		add_run(run, count);
+		run = p;
+		count = 1;
+	}
+#endif
+
+	add_run(run, count);
+}
+
+void ID_Histogram::add_run(const unsigned int* rgba, unsigned int count)
+{
+	// background
+	if (rgba[0] == 0)
+	{
+		return;
+	}
+
+	// Keep the load factor under 1/2
+	if ((m_used_slots.size() + 1) * 2 > m_table.size())
+	{
+		grow();
+	}
+
+	unsigned int mask = (unsigned int)m_table.size() - 1;
+	unsigned int slot = hash_ids(rgba) & mask;
+
+	for (;;)
+	{
+		Pixel_Count& entry = m_table[slot];
+
+		if (entry.pixel.object_id == 0)
+		{
+			entry.pixel.object_id = rgba[0];
+			entry.pixel.draw_id = rgba[1];
+			entry.pixel.prim_id = rgba[2];
+			entry.count = count;
+			m_used_slots.push_back(slot);
+			return;
+		}
+
+		if ((entry.pixel.object_id == rgba[0]) && (entry.pixel.draw_id == rgba[1]) && (entry.pixel.prim_id == rgba[2]))
+		{
+			entry.count += count;
+			return;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+}
+
+void ID_Histogram::grow()
+{
+	std::vector<Pixel_Count> old_table;
+	old_table.swap(m_table);
+
+	size_t num_slots = old_table.empty() ? 1024 : old_table.size() * 2;
+	m_table.assign(num_slots, Pixel_Count());
+
+	unsigned int mask = (unsigned int)num_slots - 1;
+
+	for (unsigned int& used_slot : m_used_slots)
+	{
+		const Pixel_Count& entry = old_table[used_slot];
+		unsigned int slot = hash_ids(&entry.pixel.object_id) & mask;
+
+		while (m_table[slot].pixel.object_id != 0)
+		{
+			slot = (slot + 1) & mask;
+		}
+
+		m_table[slot] = entry;
+		used_slot = slot;
+	}
+}
+
+bool
+point_in_polygon(const Vector2f* points, unsigned int num_points, float x, float y)
+{
+	bool is_inside = false;
+
+	for (unsigned int i = 0, j = num_points - 1; i < num_points; j = i++)
+	{
+		const Vector2f& a = points[i];
+		const Vector2f& b = points[j];
+
+		if (((a.y > y) != (b.y > y)) && (x < a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y)))
+		{
+			is_inside = !is_inside;
+		}
+	}
+
+	return is_inside;
+}
+
+void
+polygon_row_crossings(const Vector2f* points, unsigned int num_points, float y, std::vector<float>& crossings)
+{
+	crossings.clear();
+
+	for (unsigned int i = 0, j = num_points - 1; i < num_points; j = i++)
+	{
+		const Vector2f& a = points[i];
+		const Vector2f& b = points[j];
+
+		// Half open in y so a vertex on the line is counted once
+		if ((a.y > y) != (b.y > y))
+		{
+			crossings.push_back(a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y));
+		}
+	}
+
+	std::sort(crossings.begin(), crossings.end());
+}
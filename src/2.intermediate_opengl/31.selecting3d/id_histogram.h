@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+
+#include <ogldev/vec2f.h>
+
+#include "picking_texture.h"
+
+// Number of pixels covered by a (object, draw, primitive) triple
+struct Pixel_Count
+{
+	Pixel_Info pixel;
+	unsigned int count = 0;
+};
+
+//
+// Reduces rows of picking IDs to the set of distinct IDs and their pixel
+// counts. The rows are RGBA (the picking texture read as GL_RGBA_INTEGER, so
+// that every pixel is 16 bytes and can be compared in one SSE register; the
+// alpha is ignored). Neighbouring pixels usually belong to the same triangle
+// so every row is first collapsed into runs of equal pixels and only the runs
+// go into the hash table. The background (object 0) is skipped.
+//
+// The counts are accumulated in place in an open addressing table (one cache
+// line access per run) and compacted by get_entries(). The memory is kept
+// between clear() calls, so reusing an instance doesn't allocate once it has
+// seen the largest selection.
+//
+class ID_Histogram
+{
+public:
+	void
+	clear();
+
+	void
+	add_span(const unsigned int* rgba, unsigned int num_pixels);
+
+	// In no particular order
+	const std::vector<Pixel_Count>&
+	get_entries();
+
+private:
+	void
+	add_run(const unsigned int* rgba, unsigned int count);
+
+	void
+	grow();
+
+	std::vector<Pixel_Count> m_table;		// object_id 0 (the background) marks an empty slot
+	std::vector<unsigned int> m_used_slots; // to clear only what was touched
+	std::vector<Pixel_Count> m_entries;
+};
+
+//
+// Lasso polygons, in any 2D coordinates (window coordinates for the selection).
+// Both use the even-odd rule.
+//
+bool
+point_in_polygon(const Vector2f* points, unsigned int num_points, float x, float y);
+
+// Sorted x coordinates where the horizontal line y crosses the polygon edges.
+// Consecutive pairs are the inside intervals.
+void
+polygon_row_crossings(const Vector2f* points, unsigned int num_points, float y, std::vector<float>& crossings);
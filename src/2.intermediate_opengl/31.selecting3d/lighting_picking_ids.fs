@@ -0,0 +1,14 @@
+#version 330 core
+uniform uint gObjectIndex;
+uniform uint gDrawIndex;
+
+layout (location = 1) out uvec3 PickingIDs;
+
+// The main() of lighting_new.fs, see LightingTechnique::EnablePickingIDs()
+void LightingMain();
+
+void main()
+{
+    LightingMain();
+    PickingIDs = uvec3(gObjectIndex, gDrawIndex, uint(gl_PrimitiveID));
+}
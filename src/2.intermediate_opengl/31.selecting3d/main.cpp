@@ -20,7 +20,13 @@ MouseButtonCallback(GLFWwindow* window, int Button, int Action, int Mode)
 {
 	double x, y;
 	glfwGetCursorPos(window, &x, &y);
-	app->MouseCB(Button, Action, (int)x, (int)y);
+	app->MouseCB(Button, Action, Mode, (int)x, (int)y);
+}
+
+void
+FramebufferSizeCallback(GLFWwindow* window, int Width, int Height)
+{
+	app->ResizeCB(Width, Height);
 }
 int
 main()
@@ -1,10 +1,10 @@
 #version 330 core
 uniform uint gObjectIndex;
-uniform uint gDRawIndex;
+uniform uint gDrawIndex;
 
 out  uvec3 FragColor;
 
 void main()
 {
-FragColor= uvec3(gObjectIndex, gDRawIndex, gl_PrimitiveID);
+FragColor= uvec3(gObjectIndex, gDrawIndex, uint(gl_PrimitiveID));
 }
\ No newline at end of file
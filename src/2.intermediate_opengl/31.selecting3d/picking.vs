@@ -1,10 +1,9 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection
+layout (location = 0) in vec3 Position;
+
+uniform mat4 gWVP;
 
 void main()
 {
-    gl_Position= model * view * projection vec4(aPos, 1,0f);
+    gl_Position = gWVP * vec4(Position, 1.0);
 }
\ No newline at end of file
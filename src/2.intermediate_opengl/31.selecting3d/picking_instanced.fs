@@ -0,0 +1,11 @@
+#version 330 core
+uniform uint gDrawIndex;
+
+flat in uint ObjectIndex;
+
+out uvec3 FragColor;
+
+void main()
+{
+    FragColor = uvec3(ObjectIndex, gDrawIndex, uint(gl_PrimitiveID));
+}
@@ -0,0 +1,13 @@
+#version 330 core
+layout (location = 0) in vec3 Position;
+layout (location = 3) in mat4 WVP; // one row per location, see BasicMesh::InitInstanceAttributes()
+
+flat out uint ObjectIndex;
+
+void main()
+{
+    gl_Position = vec4(Position, 1.0) * WVP;
+
+    // Background is zero the real objects start 1
+    ObjectIndex = uint(gl_InstanceID + 1);
+}
@@ -0,0 +1,43 @@
+#include "picking_instanced_technique.h"
+#include <ogldev/utility.h>
+
+InstancedPickingTechnique::InstancedPickingTechnique() {}
+
+bool
+InstancedPickingTechnique::Init()
+{
+	if (!Technique::Init())
+	{
+		return false;
+	}
+
+	if (!AddShader(GL_VERTEX_SHADER, "picking_instanced.vs"))
+	{
+		return false;
+	}
+
+	if (!AddShader(GL_FRAGMENT_SHADER, "picking_instanced.fs"))
+	{
+		return false;
+	}
+
+	if (!Finalize())
+	{
+		return false;
+	}
+
+	m_drawIndexLocation = GetUniformLocation("gDrawIndex");
+
+	if (m_drawIndexLocation == INVALID_UNIFORM_LOCATION)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+void
+InstancedPickingTechnique::DrawStartCB(uint DrawIndex)
+{
+	glUniform1ui(m_drawIndexLocation, DrawIndex);
+}
\ No newline at end of file
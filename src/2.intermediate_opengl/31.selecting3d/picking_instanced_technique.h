@@ -0,0 +1,27 @@
+#pragma once
+
+#include <ogldev/basic_mesh.h>
+#include <ogldev/math3d.h>
+#include <ogldev/technique.h>
+#include <ogldev/types.h>
+
+//
+// Picking for all the instances of a mesh in a single draw per submesh. The WVP
+// matrices come from the instance attributes of BasicMesh (see the instanced
+// BasicMesh::Render()) and the object index written into the picking texture
+// is gl_InstanceID + 1.
+//
+class InstancedPickingTechnique : public Technique, public IRenderCallbacks
+{
+public:
+	InstancedPickingTechnique();
+
+	virtual bool
+	Init();
+
+	void
+	DrawStartCB(uint DrawIndex);
+
+private:
+	GLuint m_drawIndexLocation;
+};
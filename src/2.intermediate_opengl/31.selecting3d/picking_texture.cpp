@@ -1,4 +1,6 @@
 #include "picking_texture.h"
+#include "id_histogram.h"
+#include <math.h>
 #include <stdlib.h>
 
 Picking_Texture::Picking_Texture(/* args */)
@@ -11,21 +13,58 @@ Picking_Texture::~Picking_Texture()
 
 void Picking_Texture::init(unsigned int width, unsigned int height)
 {
+	m_window_width = width;
+	m_window_height = height;
+}
+
+void Picking_Texture::resize(unsigned int width, unsigned int height)
+{
+	m_window_width = width;
+	m_window_height = height;
+
+	// Release the memory when the window shrinks below the targets, they will be
+	// recreated at the right size by the next begin_region()
+	if ((m_target_width > width) || (m_target_height > height))
+	{
+		destroy_targets();
+	}
+}
+
+void Picking_Texture::create_targets(unsigned int width, unsigned int height, bool with_color)
+{
+	destroy_targets();
+
+	m_target_width = width;
+	m_target_height = height;
+
+	// The IDs go to the second attachment when the shaded color is rendered too
+	m_id_attachment = with_color ? GL_COLOR_ATTACHMENT1 : GL_COLOR_ATTACHMENT0;
+
 	// create FBO;
 	glGenFramebuffers(1, &m_fbo);
 	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
 
+	if (with_color)
+	{
+		glGenTextures(1, &m_color_texture);
+		glBindTexture(GL_TEXTURE_2D, m_color_texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_color_texture, 0);
+	}
+
 	// create the texture object for the primitive information buffer
 	glGenTextures(1, &m_picking_texture);
 	glBindTexture(GL_TEXTURE_2D, m_picking_texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32UI, width, height, 0, GL_RGB_INTEGER, GL_UNSIGNED_INT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_picking_texture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, m_id_attachment, GL_TEXTURE_2D, m_picking_texture, 0);
 
 	// create the texture object for the depth buffer
 	glGenTextures(1, &m_depth_texture);
-	glBindBuffer(GL_TEXTURE_2D, m_depth_texture);
+	glBindTexture(GL_TEXTURE_2D, m_depth_texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depth_texture, 0);
 
@@ -40,25 +79,382 @@ void Picking_Texture::init(unsigned int width, unsigned int height)
 	// restore the default frame buffer
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// pixel pack buffers for the asynchronous reads
+	if (m_pbos[0] == 0)
+	{
+		glGenBuffers(NUM_PBOS, m_pbos);
+
+		for (unsigned int i = 0; i < NUM_PBOS; i++)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(Pixel_Info), NULL, GL_STREAM_READ);
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+}
+
+void Picking_Texture::destroy_targets()
+{
+	if (m_fbo == 0)
+	{
+		return;
+	}
+
+	// the pending reads refer to the old contents
+	cancel_requests();
+
+	glDeleteFramebuffers(1, &m_fbo);
+	glDeleteTextures(1, &m_picking_texture);
+	glDeleteTextures(1, &m_depth_texture);
+
+	if (m_color_texture != 0)
+	{
+		glDeleteTextures(1, &m_color_texture);
+		m_color_texture = 0;
+	}
+
+	m_fbo = 0;
+	m_picking_texture = 0;
+	m_depth_texture = 0;
+	m_target_width = 0;
+	m_target_height = 0;
+}
+
+void Picking_Texture::begin_region(int x, int y, unsigned int width, unsigned int height)
+{
+	// Clip to the window
+	int x0 = x < 0 ? 0 : x;
+	int y0 = y < 0 ? 0 : y;
+	int x1 = x + (int)width > (int)m_window_width ? (int)m_window_width : x + (int)width;
+	int y1 = y + (int)height > (int)m_window_height ? (int)m_window_height : y + (int)height;
+
+	m_region_x = x0;
+	m_region_y = y0;
+	m_region_width = x1 > x0 ? x1 - x0 : 0;
+	m_region_height = y1 > y0 ? y1 - y0 : 0;
+
+	if ((m_region_width > m_target_width) || (m_region_height > m_target_height) || (m_color_texture != 0))
+	{
+		// Grow in both directions at once to avoid reallocating for every new region shape
+		unsigned int new_width = m_region_width > m_target_width ? m_region_width : m_target_width;
+		unsigned int new_height = m_region_height > m_target_height ? m_region_height : m_target_height;
+		create_targets(new_width, new_height, false);
+	}
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+	glViewport(0, 0, m_region_width, m_region_height);
+
+	// Only the region is cleared and rasterized
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(0, 0, m_region_width, m_region_height);
+
+	const GLuint zero[4] = {0, 0, 0, 0};
+	const GLfloat far_depth = 1.0f;
+	glClearBufferuiv(GL_COLOR, 0, zero);
+	glClearBufferfv(GL_DEPTH, 0, &far_depth);
+}
+
+Matrix4f Picking_Texture::get_region_transform() const
+{
+	return calc_region_transform(
+		m_region_x,
+		m_region_y,
+		m_region_width,
+		m_region_height,
+		m_window_width,
+		m_window_height);
+}
+
+Matrix4f Picking_Texture::calc_region_transform(
+	int x,
+	int y,
+	unsigned int width,
+	unsigned int height,
+	unsigned int window_width,
+	unsigned int window_height)
+{
+	Matrix4f m;
+	m.InitIdentity();
+
+	if ((width == 0) || (height == 0))
+	{
+		return m;
+	}
+
+	// Scale the NDC rectangle of the region up to [-1, 1] and move it to the center.
+	// This is done in clip space, so the translation is multiplied by w.
+	float sx = (float)window_width / (float)width;
+	float sy = (float)window_height / (float)height;
+	float cx = 2.0f * ((float)x + 0.5f * (float)width) / (float)window_width - 1.0f;
+	float cy = 2.0f * ((float)y + 0.5f * (float)height) / (float)window_height - 1.0f;
+
+	m.m[0][0] = sx;
+	m.m[0][3] = -sx * cx;
+	m.m[1][1] = sy;
+	m.m[1][3] = -sy * cy;
+
+	return m;
 }
 
 void Picking_Texture::enable_writing()
 {
+	begin_region(0, 0, m_window_width, m_window_height);
+}
+
+void Picking_Texture::begin_main_pass()
+{
+	m_region_x = 0;
+	m_region_y = 0;
+	m_region_width = m_window_width;
+	m_region_height = m_window_height;
+
+	if ((m_color_texture == 0) || (m_target_width != m_window_width) || (m_target_height != m_window_height))
+	{
+		create_targets(m_window_width, m_window_height, true);
+	}
+
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+	glViewport(0, 0, m_window_width, m_window_height);
+
+	// The IDs are integers so they can't be cleared by glClear()
+	GLfloat clear_color[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+	const GLuint zero[4] = {0, 0, 0, 0};
+	const GLfloat far_depth = 1.0f;
+
+	set_id_output(true);
+	glClearBufferfv(GL_COLOR, 0, clear_color);
+	glClearBufferuiv(GL_COLOR, 1, zero);
+	glClearBufferfv(GL_DEPTH, 0, &far_depth);
+}
+
+void Picking_Texture::set_id_output(bool is_enabled)
+{
+	const GLenum draw_buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+	glDrawBuffers(is_enabled ? 2 : 1, draw_buffers);
 }
+
+void Picking_Texture::end_main_pass()
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+	glBlitFramebuffer(
+		0,
+		0,
+		m_window_width,
+		m_window_height,
+		0,
+		0,
+		m_window_width,
+		m_window_height,
+		GL_COLOR_BUFFER_BIT,
+		GL_NEAREST);
+
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
 void Picking_Texture::disable_writing()
 {
+	glDisable(GL_SCISSOR_TEST);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glViewport(0, 0, m_window_width, m_window_height);
+}
+
+bool Picking_Texture::to_region(unsigned int& x, unsigned int& y) const
+{
+	int rx = (int)x - m_region_x;
+	int ry = (int)y - m_region_y;
+
+	if ((m_fbo == 0) || (rx < 0) || (ry < 0) || (rx >= (int)m_region_width) || (ry >= (int)m_region_height))
+	{
+		return false;
+	}
+
+	x = (unsigned int)rx;
+	y = (unsigned int)ry;
+
+	return true;
+}
+
+void Picking_Texture::bind_id_texture(GLenum texture_unit)
+{
+	glActiveTexture(texture_unit);
+	glBindTexture(GL_TEXTURE_2D, m_picking_texture);
 }
 
 Pixel_Info Picking_Texture::read_pixel(unsigned int x, unsigned int y)
 {
+	// Outside of the rendered region - nothing there
+	if (!to_region(x, y))
+	{
+		return Pixel_Info();
+	}
+
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
-	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(m_id_attachment);
 
 	Pixel_Info pixel;
 	glReadPixels(x, y, 1, 1, GL_RGB_INTEGER, GL_UNSIGNED_INT, &pixel);
 	glReadBuffer(GL_NONE);
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 	return pixel;
+}
+
+void Picking_Texture::read_histogram(
+	int x,
+	int y,
+	unsigned int width,
+	unsigned int height,
+	ID_Histogram& histogram,
+	const Vector2f* lasso,
+	unsigned int num_lasso_points)
+{
+	histogram.clear();
+
+	if (m_fbo == 0)
+	{
+		return;
+	}
+
+	// Intersect with the rendered region
+	int x0 = x > m_region_x ? x : m_region_x;
+	int y0 = y > m_region_y ? y : m_region_y;
+	int x1 = x + (int)width < m_region_x + (int)m_region_width ? x + (int)width : m_region_x + (int)m_region_width;
+	int y1 = y + (int)height < m_region_y + (int)m_region_height ? y + (int)height : m_region_y + (int)m_region_height;
+
+	if ((x1 <= x0) || (y1 <= y0))
+	{
+		return;
+	}
+
+	unsigned int read_width = x1 - x0;
+	unsigned int read_height = y1 - y0;
+	m_read_buffer.resize((size_t)read_width * read_height * 4);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+	glReadBuffer(m_id_attachment);
+
+	// RGBA rather than RGB: 16 bytes per pixel for ID_Histogram (and usually the fast path of the driver)
+	glReadPixels(
+		x0 - m_region_x,
+		y0 - m_region_y,
+		read_width,
+		read_height,
+		GL_RGBA_INTEGER,
+		GL_UNSIGNED_INT,
+		m_read_buffer.data());
+
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	for (unsigned int row = 0; row < read_height; row++)
+	{
+		const unsigned int* pixels = &m_read_buffer[(size_t)row * read_width * 4];
+
+		if (!lasso)
+		{
+			histogram.add_span(pixels, read_width);
+			continue;
+		}
+
+		polygon_row_crossings(lasso, num_lasso_points, (float)(y0 + (int)row) + 0.5f, m_crossings);
+
+		for (size_t i = 0; i + 1 < m_crossings.size(); i += 2)
+		{
+			// Pixels whose centers are between the two crossings
+			int start = (int)ceilf(m_crossings[i] - 0.5f);
+			int end = (int)ceilf(m_crossings[i + 1] - 0.5f);
+			start = start > x0 ? start : x0;
+			end = end < x1 ? end : x1;
+
+			if (end > start)
+			{
+				histogram.add_span(pixels + (start - x0) * 4, end - start);
+			}
+		}
+	}
+}
+
+void Picking_Texture::request_pixel(unsigned int x, unsigned int y)
+{
+	if (!to_region(x, y))
+	{
+		return;
+	}
+
+	if (m_num_pending == NUM_PBOS)
+	{
+		release_slot(m_oldest);
+		m_oldest = (m_oldest + 1) % NUM_PBOS;
+		m_num_pending--;
+	}
+
+	unsigned int slot = (m_oldest + m_num_pending) % NUM_PBOS;
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+	glReadBuffer(m_id_attachment);
+
+	// With a pack buffer bound glReadPixels only queues the copy
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[slot]);
+	glReadPixels(x, y, 1, 1, GL_RGB_INTEGER, GL_UNSIGNED_INT, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	m_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	m_num_pending++;
+}
+
+Pick_Status Picking_Texture::poll_pixel(Pixel_Info& pixel)
+{
+	Pick_Status status = PICK_NOT_READY;
+
+	// The requests complete in order so skip to the newest one that is done
+	while (m_num_pending > 0)
+	{
+		GLenum wait = glClientWaitSync(m_fences[m_oldest], 0, 0);
+
+		if ((wait != GL_ALREADY_SIGNALED) && (wait != GL_CONDITION_SATISFIED))
+		{
+			break;
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[m_oldest]);
+		glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(Pixel_Info), &pixel);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		release_slot(m_oldest);
+		m_oldest = (m_oldest + 1) % NUM_PBOS;
+		m_num_pending--;
+
+		status = PICK_READY;
+	}
+
+	return status;
+}
+
+void Picking_Texture::cancel_requests()
+{
+	while (m_num_pending > 0)
+	{
+		release_slot(m_oldest);
+		m_oldest = (m_oldest + 1) % NUM_PBOS;
+		m_num_pending--;
+	}
+}
+
+void Picking_Texture::release_slot(unsigned int slot)
+{
+	if (m_fences[slot])
+	{
+		glDeleteSync(m_fences[slot]);
+		m_fences[slot] = 0;
+	}
 }
\ No newline at end of file
@@ -2,6 +2,12 @@
 
 #include <cstdio>
 #include <glad/glad.h>
+#include <vector>
+
+#include <ogldev/mat4f.h>
+#include <ogldev/vec2f.h>
+
+class ID_Histogram;
 
 struct Pixel_Info
 {
@@ -15,26 +21,162 @@ struct Pixel_Info
 	}
 };
 
+enum Pick_Status
+{
+	PICK_NOT_READY, // nothing requested yet or the GPU hasn't finished the oldest request
+	PICK_READY
+};
+
+//
+// Render target for the picking pass. Only a region of the window around the
+// cursor is rendered (see begin_region()) so the color and depth textures are
+// only as large as the biggest region used so far. They are created on first use
+// and recreated when a larger region is needed or the window shrinks below them.
+// The read functions take window coordinates.
+//
+// Alternatively the IDs can be produced by the main pass itself as a second
+// render target, see begin_main_pass().
+//
 class Picking_Texture
 {
 public:
 	Picking_Texture(/* args */);
 	~Picking_Texture();
 
+	// Doesn't allocate anything yet
 	void
 	init(unsigned int window_width, unsigned int window_height);
 
+	void
+	resize(unsigned int window_width, unsigned int window_height);
+
+	//
+	// Binds the target for rendering the window rectangle (x, y, width, height),
+	// with (x, y) being the bottom left corner. The rectangle is clipped to the
+	// window. Sets the viewport to the region and clears it. Multiply the
+	// projection by get_region_transform() so that the region fills the
+	// viewport.
+	//
+	void
+	begin_region(int x, int y, unsigned int width, unsigned int height);
+
+	// Maps window clip space to region clip space, i.e. use get_region_transform() * WVP
+	Matrix4f
+	get_region_transform() const;
+
+	// Same for any window rectangle, e.g. to build the frustum of a selection rectangle
+	static Matrix4f
+	calc_region_transform(
+		int x,
+		int y,
+		unsigned int width,
+		unsigned int height,
+		unsigned int window_width,
+		unsigned int window_height);
+
+	// Whole window, for compatibility
 	void
 	enable_writing();
 
+	// Restores the default frame buffer and a full window viewport
 	void
 	disable_writing();
 
+	//
+	// Main pass mode: the whole window is rendered into a color attachment
+	// (fragment output 0) and the IDs (fragment output 1) by a technique that
+	// writes both, e.g. LightingTechnique::EnablePickingIDs(). end_main_pass()
+	// copies the color to the default frame buffer. The read functions then
+	// read the IDs of that pass.
+	//
+	void
+	begin_main_pass();
+
+	// Restricts the output to the color attachment, for draws that don't write IDs
+	void
+	set_id_output(bool is_enabled);
+
+	void
+	end_main_pass();
+
+	// For shaders that read the IDs, e.g. the shading pass of a visibility buffer
+	void
+	bind_id_texture(GLenum texture_unit);
+
+	// Blocking read, waits for the GPU to finish rendering into the texture
 	Pixel_Info
 	read_pixel(unsigned int x, unsigned int y);
 
+	//
+	// Blocking read of the window rectangle (x, y, width, height), clipped to the
+	// rendered region, reduced to the distinct IDs and their pixel counts. With
+	// a lasso (window coordinates, bottom left origin) only the pixels whose
+	// centers are inside the polygon are counted.
+	//
+	void
+	read_histogram(
+		int x,
+		int y,
+		unsigned int width,
+		unsigned int height,
+		ID_Histogram& histogram,
+		const Vector2f* lasso = NULL,
+		unsigned int num_lasso_points = 0);
+
+	//
+	// Asynchronous read. request_pixel() copies the pixel into one of a ring of
+	// pixel pack buffers and returns immediately. poll_pixel() returns the most
+	// recent request that the GPU has completed, usually one or two frames later,
+	// and never waits. If the ring is full the oldest request is dropped.
+	//
+	void
+	request_pixel(unsigned int x, unsigned int y);
+
+	Pick_Status
+	poll_pixel(Pixel_Info& pixel);
+
+	// Drop the requests that are in flight, e.g. when the mouse button is released
+	void
+	cancel_requests();
+
 private:
-	GLuint m_fbo;			  // handle to frame buffer
-	GLuint m_picking_texture; // handle to texture
-	GLuint m_depth_texture;	  // handle to the depth buffer
+	void
+	release_slot(unsigned int slot);
+
+	void
+	create_targets(unsigned int width, unsigned int height, bool with_color);
+
+	void
+	destroy_targets();
+
+	bool
+	to_region(unsigned int& x, unsigned int& y) const;
+
+	static const unsigned int NUM_PBOS = 3;
+
+	GLuint m_fbo = 0;			  // handle to frame buffer
+	GLuint m_picking_texture = 0; // handle to texture
+	GLuint m_depth_texture = 0;	  // handle to the depth buffer
+	GLuint m_color_texture = 0;	  // shaded color, main pass mode only
+	GLenum m_id_attachment = GL_COLOR_ATTACHMENT0;
+	unsigned int m_target_width = 0;
+	unsigned int m_target_height = 0;
+
+	unsigned int m_window_width = 0;
+	unsigned int m_window_height = 0;
+
+	// read_histogram() scratch space
+	std::vector<unsigned int> m_read_buffer;
+	std::vector<float> m_crossings;
+
+	// current region in window coordinates
+	int m_region_x = 0;
+	int m_region_y = 0;
+	unsigned int m_region_width = 0;
+	unsigned int m_region_height = 0;
+
+	GLuint m_pbos[NUM_PBOS] = {0};
+	GLsync m_fences[NUM_PBOS] = {0}; // non zero while a request is in flight
+	unsigned int m_oldest = 0;		 // oldest request in flight
+	unsigned int m_num_pending = 0;
 };
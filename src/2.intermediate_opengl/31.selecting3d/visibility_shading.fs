@@ -0,0 +1,197 @@
+#version 430 core
+
+// See BasicMesh::BindStorageBuffers()
+#define VERTEX_SIZE 8        // floats: position, tex coords, normal
+#define PACKED_VERTEX_SIZE 4 // uints: half position (2), half tex coords, snorm 10:10:10:2 normal
+
+layout (std430, binding = 0) readonly buffer VertexBuffer
+{
+    uint gVertices[];
+};
+
+layout (std430, binding = 1) readonly buffer IndexBuffer
+{
+    uint gIndices[]; // 16 or 32 bit indices, depending on the submesh
+};
+
+layout (std430, binding = 2) readonly buffer DrawInfoBuffer
+{
+    uvec4 gDrawInfo[]; // first index (in units of the index size), BaseVertex, MaterialIndex, index size in bytes
+};
+
+struct ObjectData
+{
+    mat4 WVP;   // rows, i.e. vec4(Pos, 1.0) * WVP
+    mat4 World;
+};
+
+layout (std430, binding = 3) readonly buffer ObjectBuffer
+{
+    ObjectData gObjects[]; // object index 1 is gObjects[0]
+};
+
+struct DirectionalLight
+{
+    vec3 Color;
+    float AmbientIntensity;
+    float DiffuseIntensity;
+    vec3 Direction; // world space
+};
+
+struct Material
+{
+    vec3 AmbientColor;
+    vec3 DiffuseColor;
+};
+
+uniform usampler2D gIDs;
+uniform sampler2D gSampler;
+uniform vec2 gScreenSize;
+uniform DirectionalLight gDirectionalLight;
+uniform Material gMaterial;
+uniform bool gHasDiffuseTexture;
+uniform uint gMaterialIndex;
+uniform uvec3 gPickedIDs;
+uniform bool gPackedVertices; // BasicMesh::HasPackedVertices()
+
+out vec4 FragColor;
+
+float GetFloat(uint i)
+{
+    return uintBitsToFloat(gVertices[i]);
+}
+
+vec3 GetPosition(uint i)
+{
+    if (gPackedVertices) {
+        uint Base = i * PACKED_VERTEX_SIZE;
+        return vec3(unpackHalf2x16(gVertices[Base]), unpackHalf2x16(gVertices[Base + 1]).x);
+    }
+
+    uint Base = i * VERTEX_SIZE;
+    return vec3(GetFloat(Base), GetFloat(Base + 1), GetFloat(Base + 2));
+}
+
+vec2 GetTexCoords(uint i)
+{
+    if (gPackedVertices) {
+        return unpackHalf2x16(gVertices[i * PACKED_VERTEX_SIZE + 2]);
+    }
+
+    uint Base = i * VERTEX_SIZE;
+    return vec2(GetFloat(Base + 3), GetFloat(Base + 4));
+}
+
+vec3 GetNormal(uint i)
+{
+    if (gPackedVertices) {
+        int Packed = int(gVertices[i * PACKED_VERTEX_SIZE + 3]);
+        ivec3 n = ivec3(bitfieldExtract(Packed, 0, 10), bitfieldExtract(Packed, 10, 10), bitfieldExtract(Packed, 20, 10));
+        return max(vec3(n) / 511.0, -1.0);
+    }
+
+    uint Base = i * VERTEX_SIZE;
+    return vec3(GetFloat(Base + 5), GetFloat(Base + 6), GetFloat(Base + 7));
+}
+
+// The i-th index of the index buffer, counting in units of IndexSize
+uint GetIndex(uint i, uint IndexSize)
+{
+    if (IndexSize == 2u) {
+        return bitfieldExtract(gIndices[i >> 1], int(i & 1u) * 16, 16);
+    }
+
+    return gIndices[i];
+}
+
+float Cross2(vec2 a, vec2 b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+// Perspective correct barycentrics of the point p (NDC) inside the triangle
+// given in clip space. The screen space barycentrics are divided by w and
+// renormalized, which holds for any w != 0 so triangles that were clipped by
+// the near plane work too.
+vec3 CalcBarycentrics(vec4 c0, vec4 c1, vec4 c2, vec2 p)
+{
+    vec3 InvW = 1.0 / vec3(c0.w, c1.w, c2.w);
+    vec2 n0 = c0.xy * InvW.x;
+    vec2 n1 = c1.xy * InvW.y;
+    vec2 n2 = c2.xy * InvW.z;
+
+    // Can't be zero, degenerate triangles are not rasterized in the first pass
+    float InvArea = 1.0 / Cross2(n1 - n0, n2 - n0);
+    float b1 = Cross2(p - n0, n2 - n0) * InvArea;
+    float b2 = Cross2(n1 - n0, p - n0) * InvArea;
+
+    vec3 b = vec3(1.0 - b1 - b2, b1, b2) * InvW;
+    return b / (b.x + b.y + b.z);
+}
+
+void main()
+{
+    uvec3 IDs = texelFetch(gIDs, ivec2(gl_FragCoord.xy), 0).xyz;
+
+    // Background, cleared by the first pass
+    if (IDs.x == 0u) {
+        discard;
+    }
+
+    uvec4 DrawInfo = gDrawInfo[IDs.y];
+
+    if (DrawInfo.z != gMaterialIndex) {
+        discard;
+    }
+
+    // Fetch the triangle
+    uint FirstIndex = DrawInfo.x + IDs.z * 3u;
+    uint i0 = DrawInfo.y + GetIndex(FirstIndex, DrawInfo.w);
+    uint i1 = DrawInfo.y + GetIndex(FirstIndex + 1u, DrawInfo.w);
+    uint i2 = DrawInfo.y + GetIndex(FirstIndex + 2u, DrawInfo.w);
+
+    ObjectData Object = gObjects[IDs.x - 1u];
+    vec4 c0 = vec4(GetPosition(i0), 1.0) * Object.WVP;
+    vec4 c1 = vec4(GetPosition(i1), 1.0) * Object.WVP;
+    vec4 c2 = vec4(GetPosition(i2), 1.0) * Object.WVP;
+
+    // The barycentrics of the neighbouring pixels give the texture coordinate
+    // gradients that the rasterizer would have computed for the mip level
+    vec2 PixelSize = 2.0 / gScreenSize;
+    vec2 p = gl_FragCoord.xy * PixelSize - 1.0;
+    vec3 Bary = CalcBarycentrics(c0, c1, c2, p);
+    vec3 BaryX = CalcBarycentrics(c0, c1, c2, p + vec2(PixelSize.x, 0.0));
+    vec3 BaryY = CalcBarycentrics(c0, c1, c2, p + vec2(0.0, PixelSize.y));
+
+    vec2 uv0 = GetTexCoords(i0);
+    vec2 uv1 = GetTexCoords(i1);
+    vec2 uv2 = GetTexCoords(i2);
+    mat3x2 UVs = mat3x2(uv0, uv1, uv2);
+    vec2 TexCoord = UVs * Bary;
+
+    vec3 Normal = mat3(GetNormal(i0), GetNormal(i1), GetNormal(i2)) * Bary;
+    Normal = normalize((vec4(Normal, 0.0) * Object.World).xyz);
+
+    vec4 AmbientColor = vec4(gDirectionalLight.Color, 1.0) * gDirectionalLight.AmbientIntensity *
+                        vec4(gMaterial.AmbientColor, 1.0);
+
+    float DiffuseFactor = max(dot(Normal, -gDirectionalLight.Direction), 0.0);
+    vec4 DiffuseColor = vec4(gDirectionalLight.Color, 1.0) * gDirectionalLight.DiffuseIntensity *
+                        vec4(gMaterial.DiffuseColor, 1.0) * DiffuseFactor;
+
+    vec4 BaseColor = vec4(1.0);
+
+    if (gHasDiffuseTexture) {
+        BaseColor = textureGrad(gSampler, TexCoord, UVs * BaryX - TexCoord, UVs * BaryY - TexCoord);
+    }
+
+    FragColor = BaseColor * (AmbientColor + DiffuseColor);
+
+    if (IDs.x == gPickedIDs.x) {
+        if ((IDs.y == gPickedIDs.y) && (IDs.z == gPickedIDs.z)) {
+            FragColor = vec4(1.0, 0.0, 0.0, 1.0);
+        } else {
+            FragColor *= vec4(0.0, 1.0, 0.0, 1.0);
+        }
+    }
+}
@@ -0,0 +1,8 @@
+#version 430 core
+
+// A single triangle that covers the whole screen, no vertex buffer needed
+void main()
+{
+    vec2 Pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(Pos * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,152 @@
+#include "visibility_shading_technique.h"
+#include <ogldev/utility.h>
+
+VisibilityShadingTechnique::VisibilityShadingTechnique() {}
+
+VisibilityShadingTechnique::~VisibilityShadingTechnique()
+{
+	if (m_objectBuffer != 0)
+	{
+		glDeleteBuffers(1, &m_objectBuffer);
+	}
+
+	if (m_VAO != 0)
+	{
+		glDeleteVertexArrays(1, &m_VAO);
+	}
+}
+
+bool
+VisibilityShadingTechnique::Init()
+{
+	if (!Technique::Init())
+	{
+		return false;
+	}
+
+	if (!AddShader(GL_VERTEX_SHADER, "visibility_shading.vs"))
+	{
+		return false;
+	}
+
+	if (!AddShader(GL_FRAGMENT_SHADER, "visibility_shading.fs"))
+	{
+		return false;
+	}
+
+	if (!Finalize())
+	{
+		return false;
+	}
+
+	m_IDTextureUnitLocation = GetUniformLocation("gIDs");
+	m_textureUnitLocation = GetUniformLocation("gSampler");
+	m_screenSizeLocation = GetUniformLocation("gScreenSize");
+	m_lightColorLocation = GetUniformLocation("gDirectionalLight.Color");
+	m_lightAmbientIntensityLocation = GetUniformLocation("gDirectionalLight.AmbientIntensity");
+	m_lightDiffuseIntensityLocation = GetUniformLocation("gDirectionalLight.DiffuseIntensity");
+	m_lightDirectionLocation = GetUniformLocation("gDirectionalLight.Direction");
+	m_pickedIDsLocation = GetUniformLocation("gPickedIDs");
+	m_materialIndexLocation = GetUniformLocation("gMaterialIndex");
+	m_ambientColorLocation = GetUniformLocation("gMaterial.AmbientColor");
+	m_diffuseColorLocation = GetUniformLocation("gMaterial.DiffuseColor");
+	m_hasDiffuseTextureLocation = GetUniformLocation("gHasDiffuseTexture");
+	m_packedVerticesLocation = GetUniformLocation("gPackedVertices");
+
+	if (m_IDTextureUnitLocation == INVALID_UNIFORM_LOCATION || m_textureUnitLocation == INVALID_UNIFORM_LOCATION ||
+		m_screenSizeLocation == INVALID_UNIFORM_LOCATION || m_lightColorLocation == INVALID_UNIFORM_LOCATION ||
+		m_lightAmbientIntensityLocation == INVALID_UNIFORM_LOCATION ||
+		m_lightDiffuseIntensityLocation == INVALID_UNIFORM_LOCATION ||
+		m_lightDirectionLocation == INVALID_UNIFORM_LOCATION || m_pickedIDsLocation == INVALID_UNIFORM_LOCATION ||
+		m_materialIndexLocation == INVALID_UNIFORM_LOCATION || m_ambientColorLocation == INVALID_UNIFORM_LOCATION ||
+		m_diffuseColorLocation == INVALID_UNIFORM_LOCATION || m_hasDiffuseTextureLocation == INVALID_UNIFORM_LOCATION ||
+		m_packedVerticesLocation == INVALID_UNIFORM_LOCATION)
+	{
+		return false;
+	}
+
+	glGenBuffers(1, &m_objectBuffer);
+	glGenVertexArrays(1, &m_VAO);
+
+	return true;
+}
+
+void
+VisibilityShadingTechnique::SetIDTextureUnit(uint TextureUnit)
+{
+	glUniform1i(m_IDTextureUnitLocation, TextureUnit);
+}
+
+void
+VisibilityShadingTechnique::SetTextureUnit(uint TextureUnit)
+{
+	glUniform1i(m_textureUnitLocation, TextureUnit);
+}
+
+void
+VisibilityShadingTechnique::SetScreenSize(uint Width, uint Height)
+{
+	glUniform2f(m_screenSizeLocation, (float)Width, (float)Height);
+}
+
+void
+VisibilityShadingTechnique::SetDirectionalLight(const ogl::DirectionalLight& Light)
+{
+	glUniform3f(m_lightColorLocation, Light.Color.x, Light.Color.y, Light.Color.z);
+	glUniform1f(m_lightAmbientIntensityLocation, Light.AmbientIntensity);
+	glUniform1f(m_lightDiffuseIntensityLocation, Light.DiffuseIntensity);
+
+	// Shading is done in world space
+	Vector3f Direction = Light.WorldDirection;
+	Direction.Normalize();
+	glUniform3f(m_lightDirectionLocation, Direction.x, Direction.y, Direction.z);
+}
+
+void
+VisibilityShadingTechnique::SetObjects(const Matrix4f* pWVPs, const Matrix4f* pWorlds, uint NumObjects)
+{
+	m_objects.resize(NumObjects);
+
+	for (uint i = 0; i < NumObjects; i++)
+	{
+		m_objects[i].WVP = pWVPs[i];
+		m_objects[i].World = pWorlds[i];
+	}
+
+	// Orphan the previous frame's data instead of waiting for the GPU to finish with it
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(ObjectData) * NumObjects, m_objects.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VIS_OBJECT_BINDING, m_objectBuffer);
+}
+
+void
+VisibilityShadingTechnique::SetPickedIDs(uint ObjectID, uint DrawIndex, uint PrimID)
+{
+	glUniform3ui(m_pickedIDsLocation, ObjectID, DrawIndex, PrimID);
+}
+
+void
+VisibilityShadingTechnique::SetMaterial(const Material& Mat)
+{
+	glUniform3f(m_ambientColorLocation, Mat.AmbientColor.r, Mat.AmbientColor.g, Mat.AmbientColor.b);
+	glUniform3f(m_diffuseColorLocation, Mat.DiffuseColor.r, Mat.DiffuseColor.g, Mat.DiffuseColor.b);
+	glUniform1i(m_hasDiffuseTextureLocation, Mat.pDiffuse ? 1 : 0);
+}
+
+void
+VisibilityShadingTechnique::SetPackedVertices(bool IsPacked)
+{
+	glUniform1i(m_packedVerticesLocation, IsPacked ? 1 : 0);
+}
+
+void
+VisibilityShadingTechnique::DrawMaterialPass(uint MaterialIndex)
+{
+	glUniform1ui(m_materialIndexLocation, MaterialIndex);
+
+	glBindVertexArray(m_VAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+
+#include <ogldev/basic_mesh.h>
+#include <ogldev/lighting2.h>
+#include <ogldev/math3d.h>
+#include <ogldev/technique.h>
+#include <ogldev/types.h>
+
+// Shader storage buffer slots used by the shading pass
+#define VIS_MESH_FIRST_BINDING 0 // BasicMesh::BindStorageBuffers() takes 0-2
+#define VIS_OBJECT_BINDING 3
+
+//
+// Second pass of the visibility buffer mode. The first pass rasterizes only the
+// picking IDs (object, draw, primitive) of the closest triangle into every pixel.
+// This pass draws a full screen triangle and, per pixel, fetches that triangle
+// from the storage buffers of the mesh, transforms it with the WVP matrix of
+// the object, reconstructs the perspective correct barycentrics at the pixel
+// center and shades the interpolated attributes. Every pixel is shaded once no
+// matter how much overdraw the first pass had.
+//
+// The diffuse texture is bound per material so the full screen triangle is
+// drawn once per material (see DrawMaterialPass()) and the other pixels are
+// discarded after reading their IDs.
+//
+class VisibilityShadingTechnique : public Technique
+{
+public:
+	VisibilityShadingTechnique();
+
+	~VisibilityShadingTechnique();
+
+	virtual bool
+	Init();
+
+	void
+	SetIDTextureUnit(uint TextureUnit);
+
+	void
+	SetTextureUnit(uint TextureUnit);
+
+	void
+	SetScreenSize(uint Width, uint Height);
+
+	void
+	SetDirectionalLight(const ogl::DirectionalLight& Light);
+
+	// Object index zero is the background, i.e. pObjects[0] is object index 1
+	void
+	SetObjects(const Matrix4f* pWVPs, const Matrix4f* pWorlds, uint NumObjects);
+
+	// The object is tinted green and the triangle red, zero object id for none
+	void
+	SetPickedIDs(uint ObjectID, uint DrawIndex, uint PrimID);
+
+	void
+	SetMaterial(const Material& Mat);
+
+	// The vertex format of the mesh, see BasicMesh::HasPackedVertices()
+	void
+	SetPackedVertices(bool IsPacked);
+
+	// Shades the pixels whose submesh uses this material
+	void
+	DrawMaterialPass(uint MaterialIndex);
+
+private:
+	struct ObjectData
+	{
+		Matrix4f WVP;
+		Matrix4f World;
+	};
+
+	std::vector<ObjectData> m_objects;
+	GLuint m_objectBuffer = 0;
+	GLuint m_VAO = 0; // the full screen triangle is generated from gl_VertexID
+
+	GLuint m_IDTextureUnitLocation;
+	GLuint m_textureUnitLocation;
+	GLuint m_screenSizeLocation;
+	GLuint m_lightColorLocation;
+	GLuint m_lightAmbientIntensityLocation;
+	GLuint m_lightDiffuseIntensityLocation;
+	GLuint m_lightDirectionLocation;
+	GLuint m_pickedIDsLocation;
+	GLuint m_materialIndexLocation;
+	GLuint m_ambientColorLocation;
+	GLuint m_diffuseColorLocation;
+	GLuint m_hasDiffuseTextureLocation;
+	GLuint m_packedVerticesLocation;
+};
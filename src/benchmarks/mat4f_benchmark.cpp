@@ -0,0 +1,120 @@
+//
+// Times the Matrix4f operations that have a SIMD path (see include/ogldev/simd.h).
+// CMake builds it twice, mat4f_benchmark with the SIMD backend that the compiler
+// targets (add -DOGLDEV_USE_AVX=ON for AVX2/FMA) and mat4f_benchmark_scalar with
+// OGLDEV_NO_SIMD, so the two can be compared on the same machine.
+//
+// usage: mat4f_benchmark [num repetitions]
+//
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <ogldev/mat4f.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const size_t NUM_MATRICES = 4096; // 256KB, stays in the L2 cache
+
+#if defined(OGLDEV_FMA)
+static const char* BACKEND = "AVX2/FMA";
+#elif defined(OGLDEV_AVX)
+static const char* BACKEND = "AVX";
+#elif defined(OGLDEV_SSE)
+static const char* BACKEND = "SSE2";
+#else
+static const char* BACKEND = "scalar";
+#endif
+
+#ifdef _MSC_VER
+static const void* volatile s_pSink = NULL;
+#endif
+
+// Makes the compiler assume that Value is read, so no iteration of the loop that writes it can be dropped
+template <typename T>
+static inline void
+DoNotOptimize(const T& Value)
+{
+#ifdef _MSC_VER
+	s_pSink = &Value;
+	_ReadWriteBarrier();
+#else
+	asm volatile("" : : "r"(&Value) : "memory");
+#endif
+}
+
+// Runs Op(i) over all the matrices NumReps times and prints the time per call
+template <typename OpFunc>
+static void
+Measure(const char* pName, uint NumReps, OpFunc Op)
+{
+	std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+	for (uint r = 0; r < NumReps; r++)
+	{
+		for (size_t i = 0; i < NUM_MATRICES; i++)
+		{
+			Op(i);
+		}
+	}
+
+	std::chrono::duration<double, std::nano> Elapsed = std::chrono::steady_clock::now() - Start;
+	printf("%-12s %8.2f ns\n", pName, Elapsed.count() / ((double)NumReps * (double)NUM_MATRICES));
+}
+
+int
+main(int argc, char* argv[])
+{
+	uint NumReps = (argc > 1) ? (uint)atoi(argv[1]) : 1000;
+
+	// Random matrices close to the identity so that they can all be inverted
+	std::mt19937 Generator(1);
+	std::uniform_real_distribution<float> Distribution(-0.5f, 0.5f);
+
+	std::vector<Matrix4f> Matrices(NUM_MATRICES);
+	std::vector<Matrix4f> Results(NUM_MATRICES);
+	std::vector<Vector4f> Vectors(NUM_MATRICES);
+	std::vector<Vector4f> ResultVectors(NUM_MATRICES);
+
+	for (size_t i = 0; i < NUM_MATRICES; i++)
+	{
+		for (int Row = 0; Row < 4; Row++)
+		{
+			for (int Col = 0; Col < 4; Col++)
+			{
+				Matrices[i].m[Row][Col] = Distribution(Generator) + ((Row == Col) ? 1.0f : 0.0f);
+			}
+		}
+
+		Vectors[i] = Vector4f(Distribution(Generator), Distribution(Generator), Distribution(Generator), 1.0f);
+	}
+
+	printf("Matrix4f backend: %s, %u x %u calls per operation\n", BACKEND, NumReps, (uint)NUM_MATRICES);
+
+	Measure("M * M", NumReps, [&](size_t i) {
+		Results[i] = Matrices[i] * Matrices[(i + 1) % NUM_MATRICES];
+		DoNotOptimize(Results[i]);
+	});
+
+	Measure("M * v", NumReps, [&](size_t i) {
+		ResultVectors[i] = Matrices[i] * Vectors[i];
+		DoNotOptimize(ResultVectors[i]);
+	});
+
+	Measure("Transpose", NumReps, [&](size_t i) {
+		Results[i] = Matrices[i].Transpose();
+		DoNotOptimize(Results[i]);
+	});
+
+	Measure("Inverse", NumReps, [&](size_t i) {
+		Results[i] = Matrices[i].Inverse();
+		DoNotOptimize(Results[i]);
+	});
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+//
+// Round trips the packed vertex formats on the CPU (see include/ogldev/vertex_packing.h
+// and BasicMesh::PackedVertex) and checks the errors that MeshLoadOptions::PackVertices
+// promises: positions and tex coords within 2^-11 of their value, normal components
+// within 1/1022. Returns non zero on the first failure.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ogldev/vertex_packing.h>
+
+static const float HALF_MAX = 65504.0f;
+static const float HALF_MAX_REL_ERROR = 1.0f / 2048.0f;		// 2^-11, half of the 10 bit mantissa step
+static const float HALF_MAX_ABS_ERROR = 1.0f / 33554432.0f; // 2^-25, half of the denormal step
+static const float SNORM10_MAX_ERROR = 1.0f / 1022.0f;		// half of the 1/511 step
+
+static int NumFailures = 0;
+
+static void
+CheckHalf(float v)
+{
+	float Result = ogl::HalfToFloat(ogl::FloatToHalf(v));
+	float Error = fabsf(Result - v);
+	float MaxError = fmaxf(fabsf(v) * HALF_MAX_REL_ERROR, HALF_MAX_ABS_ERROR);
+
+	if (Error > MaxError)
+	{
+		if (NumFailures++ < 10)
+		{
+			printf("half: %.9g came back as %.9g, error %g > %g\n", v, Result, Error, MaxError);
+		}
+	}
+}
+
+static void
+CheckNormal(float x, float y, float z)
+{
+	float ux, uy, uz;
+	ogl::UnpackSnorm1010102(ogl::PackSnorm1010102(x, y, z), ux, uy, uz);
+
+	float Error = fmaxf(fabsf(ux - x), fmaxf(fabsf(uy - y), fabsf(uz - z)));
+
+	if (Error > SNORM10_MAX_ERROR)
+	{
+		if (NumFailures++ < 10)
+		{
+			printf(
+				"snorm: (%g %g %g) came back as (%g %g %g), error %g > %g\n",
+				x,
+				y,
+				z,
+				ux,
+				uy,
+				uz,
+				Error,
+				SNORM10_MAX_ERROR);
+		}
+	}
+}
+
+int
+main()
+{
+	// Every half must survive the trip through float unchanged
+	for (u32 h = 0; h <= 0xffff; h++)
+	{
+		bool IsNaN = ((h & 0x7c00) == 0x7c00) && ((h & 0x3ff) != 0);
+		u16 Result = ogl::FloatToHalf(ogl::HalfToFloat((u16)h));
+
+		if (IsNaN ? ((Result & 0x7fff) <= 0x7c00) : (Result != h))
+		{
+			if (NumFailures++ < 10)
+			{
+				printf("half 0x%04x came back as 0x%04x\n", h, Result);
+			}
+		}
+	}
+
+	// Positions and tex coords: a spread of the floats in the half range, including the denormals
+	u32 MaxBits;
+	memcpy(&MaxBits, &HALF_MAX, sizeof(MaxBits));
+
+	for (u32 Bits = 0; Bits <= MaxBits; Bits += 97)
+	{
+		float v;
+		memcpy(&v, &Bits, sizeof(v));
+		CheckHalf(v);
+		CheckHalf(-v);
+	}
+
+	// The values around the rounding points of every half interval
+	for (u32 h = 0; h < 0x7bff; h++)
+	{
+		float Low = ogl::HalfToFloat((u16)h);
+		float High = ogl::HalfToFloat((u16)(h + 1));
+		float Mid = (Low + High) * 0.5f;
+		CheckHalf(nextafterf(Mid, 0.0f));
+		CheckHalf(Mid);
+		CheckHalf(nextafterf(Mid, HALF_MAX));
+	}
+
+	// Normals: unit vectors all around the sphere and every axis aligned step
+	const int NUM_STEPS = 512;
+
+	for (int i = 0; i <= NUM_STEPS; i++)
+	{
+		float Theta = (float)M_PI * (float)i / (float)NUM_STEPS;
+
+		for (int j = 0; j < 2 * NUM_STEPS; j++)
+		{
+			float Phi = (float)M_PI * (float)j / (float)NUM_STEPS;
+			CheckNormal(sinf(Theta) * cosf(Phi), cosf(Theta), sinf(Theta) * sinf(Phi));
+		}
+	}
+
+	for (int i = -2048; i <= 2048; i++)
+	{
+		float v = (float)i / 2048.0f;
+		CheckNormal(v, -v, 0.0f);
+	}
+
+	if (NumFailures > 0)
+	{
+		printf("vertex_packing_test: %d failures\n", NumFailures);
+		return 1;
+	}
+
+	printf("vertex_packing_test: passed\n");
+	return 0;
+}